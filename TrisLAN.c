@@ -11,189 +11,351 @@
 #include <sys/select.h>
 #include <signal.h>
 #include <errno.h>
+#include <getopt.h>
 
+#include "capture.h"
 #include "common.h"
 #include "communication.h"
 #include "minilogger.h"
 #include "discovery.h"
 #include "protocol.h"
 #include "gameLogic.h"
+#include "eventLoop.h"
+#include "hostTable.h"
+#include "localDiscovery.h"
+#include "server.h"
+#include "frontend.h"
+#include "handoff.h"
+#include "headless.h"
+#include "mux.h"
 
-#define HOST_LIST_SIZE 10
+#define HOSTS_PER_PAGE 10
+
+/* milliseconds between two questions to the discovery leader while the user chooses a game */
+#define HOSTS_REFRESH_INTERVAL 1000
+
+/* milliseconds a guest waits for the host to accept the connection */
+#define JOIN_TIMEOUT 2000
 
 int tcp_port;
 
-int connection_manager_socket;
+extern int connection_manager_socket;
 
 bool keep_advertising;
 pthread_mutex_t keep_advertising_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-void search_for_hosts(){
+void (*advertised_load)(struct host_load* load) = NULL;
+
+/* the server whose load is advertised by run_server */
+static struct server* advertised_server;
+
+/* Prints the hosts of the given page of the list (pages start at 0) */
+void print_host_page(const struct host_table* table, int page){
+    char ip[INET_ADDRSTRLEN];
+    int n_pages = (table->n_hosts + HOSTS_PER_PAGE - 1) / HOSTS_PER_PAGE;
+
     clean_console();
 
-    struct endpoint{
-        char ip[INET_ADDRSTRLEN];
-        int port;
-    };
-    struct endpoint host_list[HOST_LIST_SIZE];
-    int host_list_index;
-    
-    int discovery_scanner_socket;
+    if(table->n_hosts == 1){
+        printf("\n\n\tThe scan has found 1 game on your LAN.\n");
+    }
+    else{
+        printf("\n\n\tThe scan has found %d games on your LAN.\n", table->n_hosts);
+    }
+
+    printf("\n");
+    for(int i = page * HOSTS_PER_PAGE; i < table->n_hosts && i < (page + 1) * HOSTS_PER_PAGE; ++i){
+        const struct host_load* load = &table->hosts[i].load;
+
+        inet_ntop(AF_INET, &table->hosts[i].ip, ip, INET_ADDRSTRLEN);
+        if(table->hosts[i].rtt >= 0 && load->active_games >= 0 && load->free_slots >= 0){
+            printf("\t%d. Connect to the game hosted by %s:%d (%.1f ms, %d games, %d free", i+1, ip, table->hosts[i].port,
+                table->hosts[i].rtt / 1000.0, load->active_games, load->free_slots);
+            if(load->cpu_load >= 0){
+                printf(", load %d%%", load->cpu_load);
+            }
+            printf(")\n");
+        }
+        else if(table->hosts[i].rtt >= 0){
+            printf("\t%d. Connect to the game hosted by %s:%d (%.1f ms)\n", i+1, ip, table->hosts[i].port, table->hosts[i].rtt / 1000.0);
+        }
+        else{
+            printf("\t%d. Connect to the game hosted by %s:%d (no answer to the ping)\n", i+1, ip, table->hosts[i].port);
+        }
+    }
+    printf("\t0. Go back to the main menu\n");
+
+    if(n_pages > 1){
+        printf("\n\tPage %d of %d: input n for the next page, p for the previous one\n", page + 1, n_pages);
+    }
+    printf("\n\tTo select an item, input the corresponding number:");
+    fflush(stdout);
+}
+
+/* Connects to the game of host, waiting at most JOIN_TIMEOUT ms. Returns the connection, or -1 with errno set */
+int connect_to_game(const struct host* host){
     int connection_socket;
+    int error;
 
-    discovery_scanner_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if(discovery_scanner_socket < 0){
-        mini_log(ERROR, "search_for_host", -1, "Unable to create the scanner socket");
-        return;
+    struct sockaddr_in srv_address;
+    memset(&srv_address, 0, sizeof(srv_address));
+    srv_address.sin_family = AF_INET;
+    srv_address.sin_addr.s_addr = host->ip;
+    srv_address.sin_port = htons(host->port);
+
+    if((connection_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+        mini_log(ERROR, "connect_to_game", -1, "Unable to create the tcp socket");
+        return -1;
+    }
+
+    if(connect_with_timeout(connection_socket, &srv_address, JOIN_TIMEOUT) < 0){
+        error = errno;
+        close(connection_socket);
+        errno = error;
+        return -1;
     }
 
-    struct sockaddr_in rcv_address;
+    return connection_socket;
+}
+
+/* Connects to the chosen host and plays the game */
+void join_game(const struct host* host){
+    char ip[INET_ADDRSTRLEN];
+    int connection_socket;
 
-    rcv_address.sin_family = AF_INET;
-    rcv_address.sin_addr.s_addr = INADDR_ANY;
-    rcv_address.sin_port = htons(DISCOVERY_PORT);
+    inet_ntop(AF_INET, &host->ip, ip, INET_ADDRSTRLEN);
 
-    if( bind(discovery_scanner_socket, (const struct sockaddr*)&rcv_address, sizeof(struct sockaddr)) < 0){
-        mini_log(ERROR, "search_for_host", -1, "Bind returned -1");
-        close_socket(discovery_scanner_socket);
+    printf("\tTrying to connect to %s:%d...\n", ip, host->port);
+    fflush(stdout);
+    if((connection_socket = connect_to_game(host)) < 0){
+        if(errno == ETIMEDOUT){
+            printf("\tConnection failed: the host did not answer within %d seconds\n", JOIN_TIMEOUT / 1000);
+        }
+        else{
+            printf("\tConnection failed: %s\n", strerror(errno));
+        }
         return;
     }
 
-    struct sockaddr_in srv_address;
-    int srv_address_size;
-    char srv_ip[INET_ADDRSTRLEN];
+    printf("\tConnection successful\n");
 
-    for(int i=0; i < INET_ADDRSTRLEN; ++i){
-        srv_ip[i] = '\0';
-    }
-    
-    discoveryMesssage msg;
-    int n_byte_read;
-
-    int search_time = 4000;
-    struct timeval small_timeout = {0, 4000000};
-    struct timespec scanner_stop_absolute_time;
-    struct timespec current_timestamp;
-    fd_set read_fd_set;
-    
-    get_absolute_time_with_offset(search_time, &scanner_stop_absolute_time);
+    /* Start the game */
+
+    struct gameState gs;
+    gs.role = GUEST;
+
+    connection_manager_socket = connection_socket;
 
-    host_list_index = 0;
+    game(&gs, &terminal_frontend);
+}
+
+/*  Asks the discovery leader of the machine for the games on the LAN and waits for the answer (a new leader
+    scans the LAN first, the user can stop earlier by writing 0, if watch_input). Returns false if the leader
+    did not answer or stdin was closed. */
+bool ask_for_hosts(int channel, struct host_table* host_table, bool watch_input){
+    struct timespec deadline;
+    char line[INPUT_LINE_SIZE];
+    enum event event;
+
+    if(!local_discovery_ask(channel)){
+        return false;
+    }
 
-    printf("\n\n\tLooking for games on your LAN (%d seconds search time)...\n", search_time/1000);
+    get_absolute_time_with_offset(LOCAL_DISCOVERY_TIMEOUT, &deadline);
 
     do{
+        event = wait_for_event(channel, ms_until(&deadline), watch_input ? line : NULL, sizeof(line));
 
-        FD_ZERO(&read_fd_set);
-        FD_SET(discovery_scanner_socket, &read_fd_set);
+        if(event == EVENT_READABLE){
+            return local_discovery_read(channel, host_table) >= 0;
+        }
+        else if(event == EVENT_INPUT && strcmp(line, "0") == 0){
+            return true;
+        }
+        else if(event == EVENT_INPUT_CLOSED || event == EVENT_ERROR){
+            return false;
+        }
+    }while(ms_until(&deadline) > 0);
 
-        if(select(discovery_scanner_socket + 1, &read_fd_set, NULL, NULL, &small_timeout) > 0){
-            
-            if (FD_ISSET(discovery_scanner_socket, &read_fd_set)){
+    mini_log(WARNING, "ask_for_hosts", -1, "The discovery leader did not answer");
+    return false;
+}
 
-                n_byte_read = recvfrom(discovery_scanner_socket, &msg, 8, 0, (struct sockaddr*)&srv_address, (socklen_t*)&srv_address_size);
-                if(n_byte_read <= 0){
-                    mini_log(ERROR, "search_for_host", -1, "Recv returned 0 or -1 !");
-                    close_socket(discovery_scanner_socket);
-                    return;
-                }
-                else{
-                    inet_ntop(AF_INET, &(srv_address.sin_addr), srv_ip, INET_ADDRSTRLEN);
-                    #ifdef DEBUG
-                    printf("\n\tReceived from %s: Version=%d Tcp port=%d\n", srv_ip, msg.version, msg.tcp_port);
-                    #endif
-
-                    if(host_list_index < HOST_LIST_SIZE){
-                        bool present = false;
-                        
-                        for(int i=0; i <= host_list_index; ++i){
-                            if(strcmp(srv_ip, host_list[i].ip) == 0 && msg.tcp_port == host_list[i].port){
-                                present = true;
-                            }
-                        }
-
-                        if(!present){
-                            strcpy(host_list[host_list_index].ip, srv_ip);
-                            host_list[host_list_index].port = msg.tcp_port;
-                            ++host_list_index;
-                        }
-                    }
-                }
-            }
+void search_for_hosts(){
+    clean_console();
+
+    struct host_table host_table;
+    struct timespec next_query;
+    int channel;
+    char line[INPUT_LINE_SIZE];
+    enum event event;
+    bool asked = false;
+
+    if(!host_table_init(&host_table)){
+        return;
+    }
+
+    channel = local_discovery_connect();
+    if(channel < 0){
+        if(errno == EACCES){
+            printf("\n\n\tAnother user of this computer is looking for games: only one user at a time can scan the LAN.\n");
         }
-        get_current_time_in_timespec(&current_timestamp);
-    }while(is_greater(&scanner_stop_absolute_time, &current_timestamp));
-    
-    close_socket(discovery_scanner_socket);
+        else{
+            printf("\n\n\tUnable to scan the LAN.\n");
+        }
+        printf("\n\tPress ENTER to go back.\n");
+        wait_for_any_key_press();
+        host_table_destroy(&host_table);
+        return;
+    }
+
+    printf("\n\n\tLooking for games on your LAN (input 0 to stop)...\n");
+    fflush(stdout);
 
+    if(!ask_for_hosts(channel, &host_table, true)){
+        close(channel);
+        host_table_destroy(&host_table);
+        return;
+    }
+    
     clean_console();
-    if(host_list_index == 0){
+    if(host_table.n_hosts == 0){
+        close(channel);
+
         printf("\n\n\tNo hosts are active on your LAN.\n");
         
         printf("\n\tPress ENTER to go back.\n");
+        wait_for_any_key_press();
     }
     else{
-        if(host_list_index == 1){
-            printf("\n\n\tThe scan has found 1 game on your LAN.\n");
-        }
-        else{
-            printf("\n\n\tThe scan has found %d games on your LAN.\n", host_list_index);
-        }
+        /* the least busy hosts come first (the full ones last), the round trip time only breaks the ties */
+        host_table_sort(&host_table, compare_host_load);
 
-        printf("\n");
-        for(int i=0; i < host_list_index; ++i){
-            printf("\t%d. Connect to the game hosted by %s:%d\n", i+1, host_list[i].ip, host_list[i].port);
-        }
-        printf("\t0. Go back to the main menu\n");
-        printf("\n\tTo select an item, input the corresponding number:");
+        /* the leader is asked again while the user chooses: late hosts are added at the end of the list */
+        int page = 0;
+        int option = -1;
+        int n_new_hosts;
+
+        print_host_page(&host_table, page);
+        get_absolute_time_with_offset(HOSTS_REFRESH_INTERVAL, &next_query);
+
+        do{
+            event = wait_for_event(channel, asked ? -1 : ms_until(&next_query), line, sizeof(line));
+
+            if(event == EVENT_TIMEOUT){
+                /* the leader is gone: this process, or another one, takes its place */
+                if(channel < 0 && (channel = local_discovery_connect()) < 0){
+                    get_absolute_time_with_offset(HOSTS_REFRESH_INTERVAL, &next_query);
+                    continue;
+                }
+                asked = local_discovery_ask(channel);
+                if(!asked){
+                    close(channel);
+                    channel = -1;
+                    get_absolute_time_with_offset(HOSTS_REFRESH_INTERVAL, &next_query);
+                }
+            }
+            else if(event == EVENT_READABLE){
+                n_new_hosts = local_discovery_read(channel, &host_table);
+                if(n_new_hosts < 0){
+                    close(channel);
+                    channel = -1;
+                }
+                asked = false;
+                get_absolute_time_with_offset(HOSTS_REFRESH_INTERVAL, &next_query);
+
+                if(n_new_hosts == 1){
+                    printf("\n\tA new game was found (%d in total)\n", host_table.n_hosts);
+                    printf("\n\tTo select an item, input the corresponding number:");
+                    fflush(stdout);
+                }
+                else if(n_new_hosts > 1){
+                    printf("\n\t%d new games found (%d in total)\n", n_new_hosts, host_table.n_hosts);
+                    printf("\n\tTo select an item, input the corresponding number:");
+                    fflush(stdout);
+                }
+            }
+            else if(event == EVENT_INPUT){
+                if(strcmp(line, "n") == 0 && (page + 1) * HOSTS_PER_PAGE < host_table.n_hosts){
+                    print_host_page(&host_table, ++page);
+                }
+                else if(strcmp(line, "p") == 0 && page > 0){
+                    print_host_page(&host_table, --page);
+                }
+                else if(parse_int(line, &option) && option >= 0 && option <= host_table.n_hosts){
+                    break;
+                }
+                else{
+                    print_host_page(&host_table, page);
+                }
+            }
+        }while(event != EVENT_INPUT_CLOSED && event != EVENT_ERROR);
 
-        int option;
-        scanf("%d", &option);
+        if(channel >= 0){
+            close(channel);
+        }
 
         printf("\n");
 
-        if(option <= 0 || option > host_list_index){
-            return;
+        if(option > 0){
+            join_game(&host_table.hosts[option - 1]); // the array starts at index 0 but it is shown to the user as starting at 1
+            wait_for_any_key_press();
         }
-        else{
-            option = option - 1; // the array starts at index 0 but it is shown to the user as starting at 1
+    }
 
-            inet_pton(AF_INET, host_list[option].ip, &srv_address.sin_addr);
-            srv_address.sin_port = htons(host_list[option].port);
+    host_table_destroy(&host_table);
+}
 
-            if((connection_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0){
-                mini_log(ERROR, "search_for_host", -1, "Unable to create the tcp socket");
-                return;
-            }
+void stop_searching_handler(int signal){
+    printf("\n\tStopping\n");
+}
 
-            printf("\tTrying to connect to %s:%d...\n", host_list[option].ip, host_list[option].port);
-            if( connect(connection_socket, (struct sockaddr*)&srv_address, sizeof(srv_address)) < 0){
-                printf("\tConnection failed\n");
-                close(connection_socket);
-                return;
-            }
-            else{
-                printf("\tConnection successful\n");
+/* stdout of the headless mode only has the events */
+void stop_server_handler(int signal){
+}
 
-                /* Start the game */
+/* A computer hosting a single game has room for the guest until it joins */
+void single_game_load(struct host_load* load){
+    load->free_slots = 1;
+    load->active_games = 0;
+    load->move_latency_p99 = -1;
+    load->cpu_load = cpu_load_percent();
+}
 
-                struct gameState gs;
-                gs.role = GUEST;
+void server_load(struct host_load* load){
+    long long accepted, finished, rejected;
+    int active;
 
-                connection_manager_socket = connection_socket;
+    server_get_stats(advertised_server, &accepted, &finished, &rejected, &active);
 
-                game(&gs);
+    load->active_games = active;
+    load->free_slots = active < advertised_server->max_sessions ? advertised_server->max_sessions - active : 0;
+    load->move_latency_p99 = server_move_latency_p99(advertised_server);
+    load->cpu_load = cpu_load_percent();
+}
 
-                close(connection_socket);
-            }
-        }
+/*  Starts a discovery thread advertising tcp_port, with the load filled by load (NULL if it is unknown).
+    Returns false if it cannot be created */
+bool start_advertising(pthread_t* discovery_thread_tid, void (*load)(struct host_load* load)){
+    keep_advertising = true;
+    advertised_load = load;
+
+    if(pthread_create(discovery_thread_tid, NULL, discovery, NULL) != 0){
+        mini_log(ERROR, "start_advertising", -1, "Unable to create the discovery thread");
+        return false;
     }
 
-    wait_for_any_key_press();
+    mini_log(LOG, "start_advertising", -1, "Discovery thread created successfully");
+    return true;
 }
 
-void stop_searching_handler(int signal){
-    printf("\n\tStopping\n");
+void stop_advertising(pthread_t discovery_thread_tid){
+    pthread_mutex_lock(&keep_advertising_mutex);
+    keep_advertising = false;
+    pthread_mutex_unlock(&keep_advertising_mutex);
+
+    pthread_join(discovery_thread_tid, NULL);
+    mini_log(LOG, "stop_advertising", -1, "Discovery thread terminated successfully");
 }
 
 void host_new_game(){
@@ -204,21 +366,13 @@ void host_new_game(){
     int accept_address_size;
     char guest_ip[INET_ADDRSTRLEN];
     struct sockaddr_in guest_adddress;
-    int guest_address_size;
+    socklen_t guest_address_size = sizeof(guest_adddress);
+    char line[INPUT_LINE_SIZE];
+    enum event event;
 
 
-    if ((accept_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0){
-        mini_log(ERROR, "host_new_game", -1, "Unable to create the tcp socket");
-        return;
-    }
-
-    accept_adddress.sin_family = AF_INET;
-    accept_adddress.sin_addr.s_addr = INADDR_ANY;
-    accept_adddress.sin_port = htons(0);
-
-    if (bind(accept_socket, (struct sockaddr *)&accept_adddress, sizeof(struct sockaddr_in)) < 0){
-        mini_log(ERROR, "host_new_game", -1, "Unable to bind the tcp socket");
-        close(accept_socket);
+    /* the backlog lets a burst of guests complete the handshake: the ones that lose the race are reset, not left waiting for a timeout */
+    if((accept_socket = create_listening_socket(0, false)) < 0){
         return;
     }
     
@@ -231,56 +385,43 @@ void host_new_game(){
     }
     tcp_port = ntohs(accept_adddress.sin_port);
 
-    if (listen(accept_socket, 0) < 0){
-        mini_log(ERROR, "host_new_game", -1, "Unable to listen on the tcp socket");
-        close(accept_socket);
-        return;
-    }
-    
-
-    /* Creating the discovery thread */
-    keep_advertising = true;
-
     pthread_t discovery_thread_tid;
-    pthread_attr_t discovery_thread_attr;
 
-    pthread_attr_init(&discovery_thread_attr);
-    pthread_attr_setdetachstate(&discovery_thread_attr, PTHREAD_CREATE_JOINABLE);
-
-    if(pthread_create(&discovery_thread_tid, NULL, discovery, NULL) < 0){
-        mini_log(ERROR, "host_new_game", -1, "Unable to create the discovery thread");
-        pthread_attr_destroy(&discovery_thread_attr);
+    if(!start_advertising(&discovery_thread_tid, single_game_load)){
+        close(accept_socket);
         return;
     }
-    else{
-        mini_log(LOG, "host_new_game", -1, "Discovery thread created successfully");
-    }
 
-    printf("\n\n\tWaiting for a guest to join... (Use [CTRL + C] to go back)\n");
+    printf("\n\n\tWaiting for a guest to join... (Input 0 or use [CTRL + C] to go back)\n");
+    fflush(stdout);
 
     struct sigaction handle_ctrl_c = {0};
     struct sigaction previous_handler = {0};
     handle_ctrl_c.sa_handler = stop_searching_handler;
     sigaction(SIGINT, &handle_ctrl_c, &previous_handler);
 
-    if ((connection_socket = accept(accept_socket, (struct sockaddr *)&guest_adddress, &guest_address_size)) < 0){
-        if(errno != EINTR){
-            mini_log(ERROR, "host_new_game", -1, "Unable to accept a guest");
+    connection_socket = -1;
+
+    /* the accept socket and the terminal are watched together, the user can go back at any time */
+    do{
+        event = wait_for_event(accept_socket, -1, line, sizeof(line));
+
+        if(event == EVENT_READABLE){
+            if ((connection_socket = accept(accept_socket, (struct sockaddr *)&guest_adddress, &guest_address_size)) < 0){
+                mini_log(ERROR, "host_new_game", -1, "Unable to accept a guest");
+            }
         }
-    }
+        else if(event == EVENT_INPUT && strcmp(line, "0") == 0){
+            break;
+        }
+    }while(connection_socket < 0 && event != EVENT_INTERRUPTED && event != EVENT_INPUT_CLOSED && event != EVENT_ERROR);
     close(accept_socket);
 
     sigaction(SIGINT, &previous_handler, NULL);
 
-    pthread_mutex_lock(&keep_advertising_mutex);
-    keep_advertising = false;
-    pthread_mutex_unlock(&keep_advertising_mutex);
+    stop_advertising(discovery_thread_tid);
 
-    pthread_join(discovery_thread_tid, NULL);
-    mini_log(LOG, "host_new_game", -1, "Discovery thread terminated successfully");
-    pthread_attr_destroy(&discovery_thread_attr);
-
-    if(connection_socket > 0){
+    if(connection_socket >= 0){
         inet_ntop(AF_INET, &(guest_adddress.sin_addr), guest_ip, INET_ADDRSTRLEN);
         clean_console();
         printf("\n\tOne player joined, starting the game...\n");
@@ -290,31 +431,347 @@ void host_new_game(){
 
         connection_manager_socket = connection_socket;
 
-        game(&gs);
+        game(&gs, &terminal_frontend);
+    }
+}
 
-        close(connection_socket);
+
+/*  A new process asked for the sessions of server on *handoff_socket: they are given to it.
+    Returns true if it took them, the server has nothing left. Otherwise the server goes on and waits for
+    the next process on a new *handoff_socket (-1 if it cannot be created) */
+bool hand_off_server(struct server* server, int* handoff_socket){
+    int channel = handoff_accept(*handoff_socket);
+
+    if(channel < 0){
+        return false;
+    }
+
+    /* the name is free again for the new process, that waits for its own successor on it */
+    close(*handoff_socket);
+    *handoff_socket = -1;
+
+    if(server_hand_off(server, channel)){
+        close(channel);
+        return true;
+    }
+
+    close(channel);
+    *handoff_socket = handoff_listen(server->port);
+    return false;
+}
+
+/* The computer hosts games for every guest that joins, on all the cores, until the user stops it */
+void run_server(){
+    struct server* server = malloc(sizeof(struct server));
+    pthread_t discovery_thread_tid;
+    char line[INPUT_LINE_SIZE];
+    enum event event;
+    long long accepted, finished, rejected;
+    int active;
+    int handoff_socket;
+    bool handed_off = false;
+
+    if(server == NULL){
+        mini_log(ERROR, "run_server", -1, "Unable to allocate the server");
+        return;
+    }
+
+    if(!server_start(server, 0, 0, NULL)){
+        free(server);
+        return;
+    }
+    tcp_port = server->port;
+
+    advertised_server = server;
+    if(!start_advertising(&discovery_thread_tid, server_load)){
+        server_stop(server);
+        free(server);
+        return;
+    }
+
+    /* without it the server runs as before, it only cannot be replaced */
+    handoff_socket = handoff_listen(server->port);
+
+    clean_console();
+    printf("\n\n\tServer running on port %d with %d acceptors: the computer plays against every guest that joins.\n", server->port, server->n_shards);
+    printf("\tInput 0 to stop the server (tris --server --port %d --takeover replaces it without closing the games)\n\n", server->port);
+
+    do{
+        server_get_stats(server, &accepted, &finished, &rejected, &active);
+        printf("\r\tGames in progress: %d   games finished: %lld   guests accepted: %lld   refused: %lld   ", active, finished, accepted, rejected);
+        fflush(stdout);
+
+        event = wait_for_event(handoff_socket, 1000, line, sizeof(line));
+
+        if(event == EVENT_READABLE){
+            handed_off = hand_off_server(server, &handoff_socket);
+        }
+    }while(!handed_off && !(event == EVENT_INPUT && strcmp(line, "0") == 0) && event != EVENT_INPUT_CLOSED && event != EVENT_ERROR);
+
+    if(handoff_socket >= 0){
+        close(handoff_socket);
+    }
+
+    stop_advertising(discovery_thread_tid);
+    server_stop(server);
+    free(server);
+
+    if(handed_off){
+        printf("\n\n\tThe games in progress go on in the new server process.\n");
+        wait_for_any_key_press();
     }
 }
 
+/* --- headless mode: nothing is asked, the events of the game are written on stdout as JSON lines --- */
+
+/* Plays the game on connection_socket with the headless player */
+void play_headless_game(int connection_socket, enum role role){
+    struct sockaddr_in peer_address;
+    socklen_t address_size = sizeof(peer_address);
+    char ip[INET_ADDRSTRLEN] = "";
+    struct gameState gs;
+
+    if(getpeername(connection_socket, (struct sockaddr*)&peer_address, &address_size) == 0){
+        inet_ntop(AF_INET, &peer_address.sin_addr, ip, INET_ADDRSTRLEN);
+    }
+    print_event("connected", "\"role\": \"%s\", \"peer\": \"%s:%d\"", role == HOST ? "host" : "guest", ip, ntohs(peer_address.sin_port));
+
+    if(headless_config.streams > 0){
+        play_headless_streams(connection_socket, role);
+        return;
+    }
+
+    gs.role = role;
+    connection_manager_socket = connection_socket;
+
+    game(&gs, get_headless_frontend());
+}
+
+/* --host: advertises a game on port (0 for any free port) and plays it with the first guest that joins */
+bool headless_host(int port){
+    int accept_socket, connection_socket = -1;
+    struct sockaddr_in accept_address;
+    socklen_t accept_address_size = sizeof(accept_address);
+    pthread_t discovery_thread_tid;
+    enum event event;
+
+    if((accept_socket = create_listening_socket(port, false)) < 0){
+        print_event("error", "\"message\": \"unable to listen on port %d\"", port);
+        return false;
+    }
+
+    /* the discovery thread reads tcp_port when it starts */
+    if(getsockname(accept_socket, (struct sockaddr*)&accept_address, &accept_address_size) < 0 ||
+        (tcp_port = ntohs(accept_address.sin_port), !start_advertising(&discovery_thread_tid, single_game_load))){
+        print_event("error", "\"message\": \"unable to advertise the game\"");
+        close(accept_socket);
+        return false;
+    }
+
+    print_event("listening", "\"port\": %d", tcp_port);
+
+    do{
+        event = wait_for_event(accept_socket, -1, NULL, 0);
+
+        if(event == EVENT_READABLE){
+            connection_socket = accept(accept_socket, NULL, NULL);
+        }
+    }while(connection_socket < 0 && event != EVENT_INTERRUPTED && event != EVENT_ERROR);
+    close(accept_socket);
+
+    stop_advertising(discovery_thread_tid);
+
+    if(connection_socket < 0){
+        print_event("error", "\"message\": \"no guest joined\"");
+        return false;
+    }
+
+    play_headless_game(connection_socket, HOST);
+    return headless_game_completed();
+}
+
+/* Connects to host and plays the game. Returns false if the connection failed */
+bool headless_join_host(const struct host* host){
+    char ip[INET_ADDRSTRLEN];
+    char message[256];
+    int connection_socket;
+
+    inet_ntop(AF_INET, &host->ip, ip, INET_ADDRSTRLEN);
+
+    if((connection_socket = connect_to_game(host)) < 0){
+        json_escape(strerror(errno), message, sizeof(message));
+        print_event("error", "\"message\": \"unable to connect to %s:%d: %s\"", ip, host->port, message);
+        return false;
+    }
+
+    play_headless_game(connection_socket, GUEST);
+    return true;
+}
+
+/* --join ip:port */
+bool headless_join(const char* endpoint){
+    char ip[INET_ADDRSTRLEN];
+    const char* separator = strrchr(endpoint, ':');
+    struct in_addr address;
+    struct host host = {0};
+
+    if(separator == NULL || separator - endpoint >= INET_ADDRSTRLEN || !parse_int(separator + 1, &host.port) || host.port < 1 || host.port > 65535){
+        print_event("error", "\"message\": \"the endpoint must be ip:port\"");
+        return false;
+    }
+
+    memcpy(ip, endpoint, separator - endpoint);
+    ip[separator - endpoint] = '\0';
+    if(inet_pton(AF_INET, ip, &address) != 1){
+        print_event("error", "\"message\": \"the endpoint must be ip:port\"");
+        return false;
+    }
+    host.ip = address.s_addr;
+
+    return headless_join_host(&host) && headless_game_completed();
+}
+
+/* --auto-join: scans the LAN and joins the least loaded host (the next one if the connection fails) */
+bool headless_auto_join(){
+    struct host_table host_table;
+    int channel;
+    bool joined = false;
+
+    if(!host_table_init(&host_table)){
+        return false;
+    }
+
+    channel = local_discovery_connect();
+    if(channel < 0 && errno == EACCES){
+        print_event("error", "\"message\": \"another user of this computer is scanning the LAN\"");
+        host_table_destroy(&host_table);
+        return false;
+    }
+    if(channel < 0 || !ask_for_hosts(channel, &host_table, false)){
+        print_event("error", "\"message\": \"unable to scan the LAN\"");
+        if(channel >= 0){
+            close(channel);
+        }
+        host_table_destroy(&host_table);
+        return false;
+    }
+    close(channel);
+
+    host_table_sort(&host_table, compare_host_load);
+    print_event("scan", "\"hosts\": %d", host_table.n_hosts);
+
+    for(int i=0; i < host_table.n_hosts && !joined; ++i){
+        joined = headless_join_host(&host_table.hosts[i]);
+    }
+    if(host_table.n_hosts == 0){
+        print_event("error", "\"message\": \"no games found on the LAN\"");
+    }
+
+    host_table_destroy(&host_table);
+    return joined && headless_game_completed();
+}
+
+/*  --server: runs the game server on port (0 for any free port) until SIGINT or SIGTERM, or until another
+    process takes its place. With takeover the server running on port is replaced: its games go on here. */
+bool headless_server(int port, bool takeover){
+    struct server* server = malloc(sizeof(struct server));
+    struct sigaction handle_stop = {0};
+    pthread_t discovery_thread_tid;
+    enum event event;
+    long long accepted, finished, rejected;
+    int active;
+    int handoff_socket, channel;
+    bool started, handed_off = false;
+
+    if(server == NULL){
+        print_event("error", "\"message\": \"unable to allocate the server\"");
+        return false;
+    }
+
+    if(takeover){
+        started = (channel = handoff_connect(port)) >= 0 && server_take_over(server, channel, NULL);
+        if(channel >= 0){
+            close(channel);
+        }
+    }
+    else{
+        started = server_start(server, port, 0, NULL);
+    }
+    if(!started){
+        print_event("error", "\"message\": \"unable to %s the server on port %d\"", takeover ? "take over" : "start", port);
+        free(server);
+        return false;
+    }
+
+    tcp_port = server->port;
+    advertised_server = server;
+    if(!start_advertising(&discovery_thread_tid, server_load)){
+        print_event("error", "\"message\": \"unable to advertise the server\"");
+        server_stop(server);
+        free(server);
+        return false;
+    }
+
+    handoff_socket = handoff_listen(server->port);
+
+    server_get_stats(server, &accepted, &finished, &rejected, &active);
+    print_event("server", "\"port\": %d, \"shards\": %d, \"games\": %d, \"taken_over\": %s", server->port, server->n_shards, active, takeover ? "true" : "false");
+
+    /* the signals only interrupt the wait */
+    handle_stop.sa_handler = stop_server_handler;
+    sigaction(SIGINT, &handle_stop, NULL);
+    sigaction(SIGTERM, &handle_stop, NULL);
+
+    do{
+        event = wait_for_event(handoff_socket, -1, NULL, 0);
+
+        /* the totals go on in the new process, these are the ones it receives */
+        server_get_stats(server, &accepted, &finished, &rejected, &active);
+
+        if(event == EVENT_READABLE){
+            handed_off = hand_off_server(server, &handoff_socket);
+        }
+    }while(!handed_off && event != EVENT_INTERRUPTED && event != EVENT_ERROR);
+
+    if(handoff_socket >= 0){
+        close(handoff_socket);
+    }
+
+    stop_advertising(discovery_thread_tid);
+    server_stop(server);
+    free(server);
+
+    print_event(handed_off ? "handed_off" : "stopped", "\"games_finished\": %lld, \"guests_accepted\": %lld, \"refused\": %lld",
+        finished, accepted, rejected);
+    return true;
+}
 
 void show_main_menu_options(){
     printf("\n\n");
 
     printf("\t1) Host a new game.\n");
     printf("\t2) Look for available games on your LAN.\n");
+    printf("\t3) Run a game server (the computer plays against every guest).\n");
     printf("\t0) Exit the program.\n");
     
     printf("\n\tTo select an item, input the corresponding number:");
 }
 
-int main(){
+void run_menus(){
     int option = -1;
+    char line[INPUT_LINE_SIZE];
 
     do{
         clean_console();
         show_main_menu_options();
+        fflush(stdout);
 
-        scanf("%d", &option);
+        if(!read_input_line(line, sizeof(line))){
+            option = 0;
+        }
+        else if(!parse_int(line, &option)){
+            option = -1;
+        }
 
         switch(option){
             case 0:
@@ -325,8 +782,164 @@ int main(){
             case 2:
                 search_for_hosts();
                 break;
+            case 3:
+                run_server();
+                break;
         }
 
     }while(option != 0);
     clean_console();
 }
+
+void print_usage(const char* program){
+    printf("Usage: %s                                       play with the menus\n", program);
+    printf("       %s --host [--port N] [--first me|peer] [MOVES]\n", program);
+    printf("       %s --join IP:PORT [MOVES]\n", program);
+    printf("       %s --auto-join [MOVES]\n", program);
+    printf("       %s --server [--port N] [--takeover]    the game server, --takeover replaces the one on port N\n", program);
+    printf("MOVES: --bot (the default), --moves 5,1,9 (then the bot) or --stdin (one line for each move)\n");
+    printf("       --games N plays N games on the same connection (bot and moves only, the first turn alternates)\n");
+    printf("       --streams N (--host and --join, the bot only) plays the games N at a time on the connection\n");
+    printf("       --capture FILE writes every message sent and received in FILE (alone: the menus, captured)\n");
+    printf("The events of the game are written on stdout as JSON lines. The exit status is 0 if the last game\n");
+    printf("ended with a result, 1 if it did not, 2 if the options are not valid.\n");
+}
+
+/* Plays the games the command line options say, without menus. Returns the exit status */
+int run_headless(int argc, char* argv[]){
+    static const struct option options[] = {
+        {"host", no_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"first", required_argument, NULL, 'f'},
+        {"join", required_argument, NULL, 'j'},
+        {"auto-join", no_argument, NULL, 'a'},
+        {"bot", no_argument, NULL, 'b'},
+        {"moves", required_argument, NULL, 'm'},
+        {"stdin", no_argument, NULL, 's'},
+        {"games", required_argument, NULL, 'g'},
+        {"streams", required_argument, NULL, 'n'},
+        {"capture", required_argument, NULL, 'c'},
+        {"server", no_argument, NULL, 'S'},
+        {"takeover", no_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int mode = 0;
+    int port = 0;
+    const char* endpoint = NULL;
+    const char* capture_path = NULL;
+    static struct capture capture;
+    int option;
+    bool completed;
+    bool takeover = false;
+
+    while((option = getopt_long(argc, argv, "", options, NULL)) != -1){
+        switch(option){
+            case 'H':
+            case 'a':
+            case 'S':
+                mode = option;
+            break;
+            case 'j':
+                mode = option;
+                endpoint = optarg;
+            break;
+            case 'p':
+                if(!parse_int(optarg, &port) || port < 0 || port > 65535){
+                    fprintf(stderr, "%s: the port must be a number from 0 to 65535\n", argv[0]);
+                    return 2;
+                }
+            break;
+            case 'f':
+                if(strcmp(optarg, "me") != 0 && strcmp(optarg, "peer") != 0){
+                    fprintf(stderr, "%s: --first must be me or peer\n", argv[0]);
+                    return 2;
+                }
+                headless_config.first_turn = strcmp(optarg, "me") == 0 ? HOST : GUEST;
+            break;
+            case 'b':
+                headless_config.moves = MOVES_BOT;
+            break;
+            case 'm':
+                headless_config.moves = MOVES_SCRIPT;
+                headless_config.script = optarg;
+            break;
+            case 's':
+                headless_config.moves = MOVES_STDIN;
+            break;
+            case 'g':
+                if(!parse_int(optarg, &headless_config.games) || headless_config.games < 1){
+                    fprintf(stderr, "%s: --games must be a number greater than 0\n", argv[0]);
+                    return 2;
+                }
+            break;
+            case 'n':
+                if(!parse_int(optarg, &headless_config.streams) || headless_config.streams < 1 || headless_config.streams > MUX_MAX_STREAMS){
+                    fprintf(stderr, "%s: --streams must be a number from 1 to %d\n", argv[0], MUX_MAX_STREAMS);
+                    return 2;
+                }
+            break;
+            case 'c':
+                capture_path = optarg;
+            break;
+            case 't':
+                takeover = true;
+            break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if((mode == 0 && capture_path == NULL) || optind < argc || (takeover && (mode != 'S' || port == 0))
+        || (headless_config.streams > 0 && ((mode != 'H' && mode != 'j') || headless_config.moves != MOVES_BOT))){
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    if(capture_path != NULL){
+        if(!capture_open(&capture, capture_path)){
+            fprintf(stderr, "%s: unable to write the capture file %s\n", argv[0], capture_path);
+            return 2;
+        }
+        message_capture = &capture;
+    }
+
+    switch(mode){
+        case 'H':
+            completed = headless_host(port);
+        break;
+        case 'j':
+            completed = headless_join(endpoint);
+        break;
+        case 'a':
+            completed = headless_auto_join();
+        break;
+        case 'S':
+            completed = headless_server(port, takeover);
+        break;
+        default:
+            /* only --capture: the menus as usual */
+            run_menus();
+            completed = true;
+        break;
+    }
+
+    if(message_capture != NULL){
+        capture_close(message_capture);
+        message_capture = NULL;
+    }
+
+    return completed ? 0 : 1;
+}
+
+int main(int argc, char* argv[]){
+    if(argc > 1){
+        return run_headless(argc, argv);
+    }
+
+    run_menus();
+}
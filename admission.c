@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "admission.h"
+
+/* a connection costs one token */
+#define ADMISSION_TOKEN_SCALE 1000
+
+void admission_init(struct admission* admission, int rate, int burst){
+    memset(admission, 0, sizeof(struct admission));
+    admission->rate = rate > 0 ? rate : 0;
+    admission->burst = burst > 0 ? burst : 1;
+}
+
+static unsigned int hash_address(in_addr_t ip){
+    uint32_t key = ip;
+
+    /* 32 bit finalizer of MurmurHash3 */
+    key ^= key >> 16;
+    key *= 0x85ebca6b;
+    key ^= key >> 13;
+    key *= 0xc2b2ae35;
+    key ^= key >> 16;
+
+    return key;
+}
+
+/* Adds the tokens earned since the last refill, up to the burst */
+static void refill(const struct admission* admission, struct admission_bucket* bucket, long long now_ms){
+    long long tokens = bucket->tokens + (now_ms - bucket->refill_ms) * admission->rate;
+
+    bucket->tokens = tokens < (long long)admission->burst * ADMISSION_TOKEN_SCALE ? (int)tokens : admission->burst * ADMISSION_TOKEN_SCALE;
+    bucket->refill_ms = now_ms;
+}
+
+/*  Returns the bucket of ip, refilled: a new address gets a free slot among its probes (or the one refilled
+    the longest time ago) with a full bucket */
+static struct admission_bucket* find_bucket(struct admission* admission, in_addr_t ip, long long now_ms){
+    unsigned int slot = hash_address(ip);
+    struct admission_bucket* oldest = NULL;
+
+    for(int i=0; i < ADMISSION_PROBES; ++i){
+        struct admission_bucket* bucket = &admission->buckets[(slot + i) & (ADMISSION_SLOTS - 1)];
+
+        if(bucket->refill_ms != 0 && bucket->ip == ip){
+            refill(admission, bucket, now_ms);
+            return bucket;
+        }
+        if(oldest == NULL || bucket->refill_ms < oldest->refill_ms){
+            oldest = bucket;
+        }
+    }
+
+    oldest->ip = ip;
+    oldest->tokens = admission->burst * ADMISSION_TOKEN_SCALE;
+    oldest->refill_ms = now_ms > 0 ? now_ms : 1;
+
+    return oldest;
+}
+
+/* Takes a token from the bucket of ip: returns false if the address opened too many connections */
+bool admission_allow(struct admission* admission, in_addr_t ip, long long now_ms){
+    struct admission_bucket* bucket;
+
+    if(admission->rate == 0){
+        return true;
+    }
+
+    bucket = find_bucket(admission, ip, now_ms);
+    if(bucket->tokens < ADMISSION_TOKEN_SCALE){
+        return false;
+    }
+
+    bucket->tokens -= ADMISSION_TOKEN_SCALE;
+    return true;
+}
+
+/*  ip sent something that is not valid or did not complete the opening sequence in time: its bucket is
+    emptied and goes in debt for a whole burst, so its next connection waits (burst + 1) / rate seconds */
+void admission_penalize(struct admission* admission, in_addr_t ip, long long now_ms){
+    struct admission_bucket* bucket;
+
+    if(admission->rate == 0){
+        return;
+    }
+
+    bucket = find_bucket(admission, ip, now_ms);
+    bucket->tokens = -admission->burst * ADMISSION_TOKEN_SCALE;
+}
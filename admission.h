@@ -0,0 +1,35 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+/* addresses remembered by a table, always a power of 2 */
+#define ADMISSION_SLOTS 1024
+
+/* slots looked at for an address before one is taken from another address */
+#define ADMISSION_PROBES 8
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+/* The connections an address can still open: tokens are counted in thousandths of a connection */
+struct admission_bucket{
+    in_addr_t ip;
+    int tokens;
+    long long refill_ms;        /* when tokens was last refilled, 0 if the slot is free */
+};
+
+/*  Token bucket rate limiting for each source address: an address can open burst connections at once,
+    then rate connections per second. The table has a fixed size, so a flood of addresses costs no memory:
+    when the slots of an address are all taken, the one refilled the longest time ago is reused. */
+struct admission{
+    int rate;                   /* connections per second of each address, 0 means no limit */
+    int burst;
+    struct admission_bucket buckets[ADMISSION_SLOTS];
+};
+
+void admission_init(struct admission* admission, int rate, int burst);
+
+bool admission_allow(struct admission* admission, in_addr_t ip, long long now_ms);
+
+void admission_penalize(struct admission* admission, in_addr_t ip, long long now_ms);
+
+#endif /* ADMISSION_H */
@@ -0,0 +1,478 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "communication.h"
+#include "eventLoop.h"
+#include "gameLogic.h"
+#include "protocol.h"
+#include "server.h"
+#include "mux.h"
+
+/*  Micro-benchmarks of the hot paths shared by every game. The results are printed on stdout as one
+    JSON document, so two runs (e.g. before and after a change, or a normal and a PGO build) can be compared.
+    Usage: tris_bench [scale]   (scale multiplies the number of iterations, default 1) */
+
+#define MAX_RESULTS 16
+
+struct result{
+    const char* name;
+    long long operations;
+    double seconds;
+};
+
+static struct result results[MAX_RESULTS];
+static int n_results = 0;
+
+/* written by every benchmark so the compiler cannot drop the measured code */
+volatile long long sink;
+
+static double elapsed_seconds(const struct timespec* start){
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void add_result(const char* name, long long operations, double seconds){
+    if(n_results < MAX_RESULTS){
+        results[n_results].name = name;
+        results[n_results].operations = operations;
+        results[n_results].seconds = seconds;
+        ++n_results;
+    }
+}
+
+/* Fills boards with random positions: some full, some won, some open */
+static void random_boards(struct board* boards, int n_boards, unsigned int seed){
+    srand(seed);
+
+    for(int b=0; b < n_boards; ++b){
+        clear_board(&boards[b]);
+
+        int n_moves = rand() % 10;
+        for(int m=0; m < n_moves; ++m){
+            place_symbol(&boards[b], rand() % 9, (m % 2) + 1);
+        }
+    }
+}
+
+static void bench_check_victory(long long iterations){
+    struct board boards[256];
+    struct timespec start;
+    long long acc = 0;
+
+    random_boards(boards, 256, 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; i < iterations; ++i){
+        acc += check_victory(&boards[i & 255]);
+    }
+    add_result("check_victory", iterations, elapsed_seconds(&start));
+    sink = acc;
+}
+
+static void bench_check_field_full(long long iterations){
+    struct board boards[256];
+    struct timespec start;
+    long long acc = 0;
+
+    random_boards(boards, 256, 2);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; i < iterations; ++i){
+        acc += check_field_full(&boards[i & 255]);
+    }
+    add_result("check_field_full", iterations, elapsed_seconds(&start));
+    sink = acc;
+}
+
+static void bench_check_draw(long long iterations){
+    struct board boards[256];
+    struct timespec start;
+    long long acc = 0;
+
+    random_boards(boards, 256, 3);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; i < iterations; ++i){
+        acc += check_draw(&boards[i & 255]);
+    }
+    add_result("check_draw", iterations, elapsed_seconds(&start));
+    sink = acc;
+}
+
+/* A mix of valid and invalid messages, as the connection manager could receive them */
+static void random_messages(struct message* messages, int n_messages, unsigned int seed){
+    srand(seed);
+
+    for(int i=0; i < n_messages; ++i){
+        messages[i].stream = 0;
+        messages[i].communication = (enum comm)(rand() % (COMM_COUNT + 2));
+        messages[i].n_args = rand() % 3;
+        messages[i].arg1 = rand() % 11;
+        messages[i].arg2 = rand() % 11;
+    }
+}
+
+static void bench_validate_message(long long iterations){
+    struct message messages[256];
+    struct timespec start;
+    long long acc = 0;
+
+    random_messages(messages, 256, 3);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; i < iterations; ++i){
+        acc += validate_message(&messages[i & 255]);
+    }
+    add_result("validate_message", iterations, elapsed_seconds(&start));
+    sink = acc;
+}
+
+static void bench_encode_decode(long long iterations){
+    struct message messages[256];
+    struct message decoded;
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+    struct timespec start;
+    long long acc = 0;
+
+    random_messages(messages, 256, 4);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; i < iterations; ++i){
+        encode_message(&messages[i & 255], buffer);
+        decode_message(buffer, &decoded);
+        acc += decoded.arg1;
+    }
+    add_result("message_encode_decode", iterations, elapsed_seconds(&start));
+    sink = acc;
+}
+
+static bool count_message(struct message* msg, void* context){
+    *(long long*)context += msg->communication;
+    return true;
+}
+
+/* The framing loop of the connection manager, fed with a stream of valid messages cut in random chunks */
+static void bench_parse_frames(long long iterations){
+    const int n_messages = 4096;
+    const int stream_size = n_messages * MESSAGE_WIRE_SIZE;
+    unsigned char* stream = malloc(stream_size);
+    int chunks[256];
+    struct message msg;
+    struct frame_parser parser;
+    struct timespec start;
+    long long acc = 0;
+    long long parsed = 0;
+
+    if(stream == NULL){
+        return;
+    }
+
+    srand(5);
+    for(int i=0; i < n_messages; ++i){
+        msg.stream = 0;
+        msg.communication = PLACE;
+        msg.n_args = 1;
+        msg.arg1 = (rand() % 9) + 1;
+        msg.arg2 = 0;
+        encode_message(&msg, &stream[i * MESSAGE_WIRE_SIZE]);
+    }
+    for(int i=0; i < 256; ++i){
+        chunks[i] = (rand() % (4 * MESSAGE_WIRE_SIZE)) + 1;     /* like the sizes returned by recv */
+    }
+
+    frame_parser_init(&parser);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(long long i=0; parsed < iterations; ++i){
+        int offset = 0;
+
+        while(offset < stream_size){
+            int chunk = chunks[(i + offset) & 255];
+            if(chunk > stream_size - offset){
+                chunk = stream_size - offset;
+            }
+
+            parsed += parse_frames(&parser, &stream[offset], chunk, count_message, &acc);
+            offset += chunk;
+        }
+    }
+    add_result("parse_frames", parsed, elapsed_seconds(&start));
+    sink = acc;
+
+    free(stream);
+}
+
+struct queue_bench{
+    struct message_queue queue;
+    long long n_messages;
+};
+
+static void* queue_consumer(void* arg){
+    struct queue_bench* bench = arg;
+    struct message msg;
+    long long received = 0;
+    long long acc = 0;
+
+    while(received < bench->n_messages){
+        if(queue_pop(&bench->queue, &msg)){
+            acc += msg.arg1;
+            ++received;
+        }
+        else{
+            /* the consumer sleeps on the event pipe, like the game does */
+            wait_for_event(queue_event_fd(&bench->queue), -1, NULL, 0);
+            drain_events(queue_event_fd(&bench->queue));
+        }
+    }
+    sink = acc;
+
+    return NULL;
+}
+
+/* One thread pushes and one pops, as the game and the connection manager do */
+static void bench_queue(long long iterations){
+    struct queue_bench bench;
+    struct message msg;
+    pthread_t consumer;
+    struct timespec start;
+
+    if(!queue_init(&bench.queue)){
+        return;
+    }
+    bench.n_messages = iterations;
+
+    msg.stream = 0;
+    msg.communication = PLACE;
+    msg.n_args = 1;
+    msg.arg2 = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_create(&consumer, NULL, queue_consumer, &bench);
+    for(long long i=0; i < iterations; ++i){
+        msg.arg1 = (i % 9) + 1;
+        while(!queue_push(&bench.queue, &msg)){
+            sched_yield();
+        }
+    }
+    pthread_join(consumer, NULL);
+
+    add_result("queue_push_pop_2_threads", iterations, elapsed_seconds(&start));
+
+    queue_destroy(&bench.queue);
+}
+
+/* guests connecting at the same time in the accept benchmark */
+#define ACCEPT_BENCH_IN_FLIGHT 128
+
+/* Starts the connection of a guest to address, watched by epoll_fd. Returns the socket or -1 */
+static int connect_guest(int epoll_fd, const struct sockaddr_in* address){
+    struct linger reset = {1, 0};   /* close sends a RST: the load generator does not run out of ports in TIME_WAIT */
+    struct epoll_event event;
+    int guest_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if(guest_socket < 0){
+        return -1;
+    }
+    setsockopt(guest_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+
+    if(connect(guest_socket, (const struct sockaddr*)address, sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS){
+        close(guest_socket);
+        return -1;
+    }
+
+    event.events = EPOLLIN;
+    event.data.fd = guest_socket;
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, guest_socket, &event) < 0){
+        close(guest_socket);
+        return -1;
+    }
+
+    return guest_socket;
+}
+
+/*  Load generator for the server: ACCEPT_BENCH_IN_FLIGHT guests connect on loopback at the same time,
+    every one waits for the WELCOME of its session and leaves. An operation is a session opened. */
+static void bench_accept(long long connections){
+    struct server* server = malloc(sizeof(struct server));
+    struct sockaddr_in address;
+    struct epoll_event events[ACCEPT_BENCH_IN_FLIGHT];
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+    struct timespec start;
+    long long started = 0;
+    long long welcomed = 0;
+    long long refused = 0;
+    int in_flight = 0;
+    int epoll_fd;
+
+    /* every guest comes from the loopback address: only the limit on each address is removed */
+    struct server_limits limits = server_default_limits;
+    limits.connections_per_second = 0;
+
+    if(server == NULL || !server_start(server, 0, 0, &limits)){
+        free(server);
+        return;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(server->port);
+
+    epoll_fd = epoll_create1(0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(welcomed + refused < connections){
+        while(in_flight < ACCEPT_BENCH_IN_FLIGHT && started < connections){
+            if(connect_guest(epoll_fd, &address) < 0){
+                break;
+            }
+            ++started;
+            ++in_flight;
+        }
+
+        int n_events = epoll_wait(epoll_fd, events, ACCEPT_BENCH_IN_FLIGHT, 1000);
+        if(n_events <= 0){
+            if(n_events < 0 && errno == EINTR){
+                continue;
+            }
+            fprintf(stderr, "accept benchmark: no progress, stopped after %lld sessions\n", welcomed);
+            break;
+        }
+
+        for(int i=0; i < n_events; ++i){
+            if(recv(events[i].data.fd, buffer, sizeof(buffer), 0) > 0){
+                ++welcomed;
+            }
+            else{
+                ++refused;
+            }
+            close(events[i].data.fd);
+            --in_flight;
+        }
+    }
+    add_result("server_accept_welcome", welcomed, elapsed_seconds(&start));
+
+    if(refused > 0){
+        fprintf(stderr, "accept benchmark: %lld connections refused\n", refused);
+    }
+
+    close(epoll_fd);
+    server_stop(server);
+    free(server);
+}
+
+/* games played at the same time over the connection of the mux benchmark */
+#define MUX_BENCH_STREAMS 256
+
+struct mux_bench_guest{
+    int socket;
+    long long n_games;
+};
+
+static void* mux_bench_guest(void* arg){
+    struct mux_bench_guest* guest = arg;
+
+    guest->n_games = mux_play_bot_games(guest->socket, GUEST, -1, MUX_BENCH_STREAMS);
+    return NULL;
+}
+
+/*  Two bots play many games over one loopback connection, MUX_BENCH_STREAMS at a time (the guest runs
+    in its own thread). An operation is a game played to the end. */
+static void bench_mux(long long games){
+    struct sockaddr_in address;
+    socklen_t address_size = sizeof(address);
+    struct mux_bench_guest guest;
+    pthread_t guest_tid;
+    struct timespec start;
+    long long played;
+
+    int listen_socket = create_listening_socket(0, false);
+    if(listen_socket < 0){
+        return;
+    }
+    getsockname(listen_socket, (struct sockaddr*)&address, &address_size);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    guest.socket = socket(AF_INET, SOCK_STREAM, 0);
+    if(guest.socket < 0 || connect(guest.socket, (struct sockaddr*)&address, sizeof(address)) < 0){
+        close(listen_socket);
+        return;
+    }
+
+    struct pollfd pfd = {listen_socket, POLLIN, 0};
+    poll(&pfd, 1, 1000);
+    int host_socket = accept(listen_socket, NULL, NULL);
+    close(listen_socket);
+    if(host_socket < 0){
+        close(guest.socket);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_create(&guest_tid, NULL, mux_bench_guest, &guest);
+    played = mux_play_bot_games(host_socket, HOST, games, MUX_BENCH_STREAMS);
+    close(host_socket);
+    pthread_join(guest_tid, NULL);
+
+    add_result("mux_bot_games_256_streams", played, elapsed_seconds(&start));
+    close(guest.socket);
+}
+
+static void print_results(){
+    printf("{\n");
+    printf("  \"benchmarks\": [\n");
+
+    for(int i=0; i < n_results; ++i){
+        double ns_per_op = results[i].operations > 0 ? results[i].seconds * 1e9 / results[i].operations : 0;
+        double ops_per_sec = results[i].seconds > 0 ? results[i].operations / results[i].seconds : 0;
+
+        printf("    {\"name\": \"%s\", \"operations\": %lld, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n",
+            results[i].name, results[i].operations, results[i].seconds, ns_per_op, ops_per_sec, i < n_results - 1 ? "," : "");
+    }
+
+    printf("  ]\n");
+    printf("}\n");
+}
+
+int main(int argc, char* argv[]){
+    long long scale = 1;
+
+    if(argc > 1){
+        scale = atoll(argv[1]);
+        if(scale <= 0){
+            fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_check_victory(scale * 50000000LL);
+    bench_check_field_full(scale * 50000000LL);
+    bench_check_draw(scale * 50000000LL);
+    bench_validate_message(scale * 50000000LL);
+    bench_encode_decode(scale * 50000000LL);
+    bench_parse_frames(scale * 20000000LL);
+    bench_queue(scale * 1000000LL);
+    bench_accept(scale * 50000LL);
+    bench_mux(scale * 200000LL);
+
+    print_results();
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "clock.h"
+#include "minilogger.h"
+
+/*  Capture file: the header (CAPTURE_MAGIC, then the start time in milliseconds from the epoch), then one
+    record for each message: a 32 bit word with the kind in the top 2 bits and the microseconds from the
+    previous record in the others, followed by the 16 bytes of the message as they are on the wire.
+    All the numbers are little endian. */
+
+struct capture* message_capture = NULL;
+
+static long long now_us(){
+    struct timespec now;
+
+    clock_now(&now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void write_le(unsigned char* buffer, unsigned long long value, int size){
+    for(int i=0; i < size; ++i){
+        buffer[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static unsigned long long read_le(const unsigned char* buffer, int size){
+    unsigned long long value = 0;
+
+    for(int i=0; i < size; ++i){
+        value |= (unsigned long long)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+/* Creates (or truncates) the capture file at path and writes its header. Returns false if it cannot be written */
+bool capture_open(struct capture* capture, const char* path){
+    unsigned char header[CAPTURE_HEADER_SIZE];
+
+    capture->file = fopen(path, "wb");
+    if(capture->file == NULL){
+        mini_log(ERROR, "capture_open", -1, "Unable to create the capture file");
+        return false;
+    }
+
+    capture->last_us = now_us();
+    capture->partial_size = 0;
+
+    memcpy(header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+    write_le(&header[CAPTURE_MAGIC_SIZE], capture->last_us / 1000, 8);
+
+    if(fwrite(header, sizeof(header), 1, capture->file) != 1 || fflush(capture->file) != 0){
+        mini_log(ERROR, "capture_open", -1, "Unable to write the capture file");
+        fclose(capture->file);
+        capture->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void capture_close(struct capture* capture){
+    if(capture->file != NULL){
+        fclose(capture->file);
+        capture->file = NULL;
+    }
+}
+
+static void write_record(struct capture* capture, enum capture_kind kind, const unsigned char* frame){
+    unsigned char record[CAPTURE_RECORD_SIZE];
+    long long now = now_us();
+    long long delta = now - capture->last_us;
+
+    if(delta < 0){
+        delta = 0;      /* the clock of the system was moved back */
+    }
+    if(delta > CAPTURE_MAX_DELTA){
+        delta = CAPTURE_MAX_DELTA;
+    }
+    capture->last_us = now;
+
+    write_le(record, ((unsigned long long)kind << 30) | (unsigned long long)delta, 4);
+    memcpy(&record[4], frame, MESSAGE_WIRE_SIZE);
+
+    if(fwrite(record, sizeof(record), 1, capture->file) != 1){
+        mini_log(ERROR, "capture", -1, "Unable to write the capture file");
+    }
+}
+
+/* A record of the game thread, written as four 32 bit numbers like a message */
+static void write_marker(struct capture* capture, enum capture_kind kind, int value1, int value2){
+    unsigned char frame[MESSAGE_WIRE_SIZE];
+
+    memset(frame, 0, sizeof(frame));
+    write_le(&frame[0], (unsigned int)value1, 4);
+    write_le(&frame[4], (unsigned int)value2, 4);
+
+    write_record(capture, kind, frame);
+    fflush(capture->file);
+}
+
+/* A new connection begins: the bytes of the last one that did not form a message are dropped */
+void capture_connection(struct capture* capture, enum role role){
+    if(capture == NULL || capture->file == NULL){
+        return;
+    }
+
+    capture->partial_size = 0;
+    write_marker(capture, CAPTURE_CONNECTION, role, 0);
+}
+
+void capture_resumed(struct capture* capture, int board_index, enum role turn){
+    if(capture == NULL || capture->file == NULL){
+        return;
+    }
+
+    capture->partial_size = 0;
+    write_marker(capture, CAPTURE_RESUMED, board_index, turn);
+}
+
+/* frames holds size / MESSAGE_WIRE_SIZE encoded messages, written to the socket together */
+void capture_sent(struct capture* capture, const unsigned char* frames, int size){
+    if(capture == NULL || capture->file == NULL){
+        return;
+    }
+
+    for(int i=0; i + MESSAGE_WIRE_SIZE <= size; i += MESSAGE_WIRE_SIZE){
+        write_record(capture, CAPTURE_SENT, &frames[i]);
+    }
+    fflush(capture->file);
+}
+
+/*  data holds size bytes read from the socket: they are split in messages as the connection manager does,
+    before they are validated, so a message that is not correct is captured as well */
+void capture_received(struct capture* capture, const unsigned char* data, int size){
+    if(capture == NULL || capture->file == NULL){
+        return;
+    }
+
+    while(size > 0){
+        int copied = MESSAGE_WIRE_SIZE - capture->partial_size;
+
+        if(copied > size){
+            copied = size;
+        }
+        memcpy(&capture->partial[capture->partial_size], data, copied);
+        capture->partial_size += copied;
+        data += copied;
+        size -= copied;
+
+        if(capture->partial_size == MESSAGE_WIRE_SIZE){
+            write_record(capture, CAPTURE_RECEIVED, capture->partial);
+            capture->partial_size = 0;
+        }
+    }
+    fflush(capture->file);
+}
+
+/*  Reads every record of the capture file at path in *entries (allocated, to be freed by the caller).
+    Returns the number of records, or -1 if the file cannot be read or is not a capture. A record cut
+    at the end of the file (the program was stopped while writing it) is ignored. */
+int capture_load(const char* path, struct capture_entry** entries){
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    unsigned char record[CAPTURE_RECORD_SIZE];
+    struct capture_entry* loaded = NULL;
+    int n_entries = 0;
+    int capacity = 0;
+    long long time_us = 0;
+    FILE* file = fopen(path, "rb");
+
+    if(file == NULL){
+        mini_log(ERROR, "capture_load", -1, "Unable to open the capture file");
+        return -1;
+    }
+
+    if(fread(header, sizeof(header), 1, file) != 1 || memcmp(header, CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE) != 0){
+        mini_log(ERROR, "capture_load", -1, "Not a capture file");
+        fclose(file);
+        return -1;
+    }
+
+    while(fread(record, sizeof(record), 1, file) == 1){
+        unsigned int word = (unsigned int)read_le(record, 4);
+
+        if(n_entries == capacity){
+            struct capture_entry* grown;
+
+            capacity = capacity > 0 ? capacity * 2 : 256;
+            grown = realloc(loaded, capacity * sizeof(struct capture_entry));
+            if(grown == NULL){
+                mini_log(ERROR, "capture_load", -1, "Unable to allocate the records");
+                free(loaded);
+                fclose(file);
+                return -1;
+            }
+            loaded = grown;
+        }
+
+        time_us += word & CAPTURE_MAX_DELTA;
+        loaded[n_entries].kind = (enum capture_kind)(word >> 30);
+        loaded[n_entries].time_us = time_us;
+        memcpy(loaded[n_entries].frame, &record[4], MESSAGE_WIRE_SIZE);
+        ++n_entries;
+    }
+
+    fclose(file);
+    *entries = loaded;
+    return n_entries;
+}
+
+/* The two numbers of a CAPTURE_CONNECTION or CAPTURE_RESUMED record */
+void capture_marker_values(const struct capture_entry* entry, int* value1, int* value2){
+    *value1 = (int)(unsigned int)read_le(&entry->frame[0], 4);
+    *value2 = (int)(unsigned int)read_le(&entry->frame[4], 4);
+}
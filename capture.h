@@ -0,0 +1,64 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/* first bytes of a capture file, the version is the last character */
+#define CAPTURE_MAGIC "TRISCAP1"
+#define CAPTURE_MAGIC_SIZE 8
+
+/* bytes of the header (magic and start time) and of each record (time and frame) */
+#define CAPTURE_HEADER_SIZE (CAPTURE_MAGIC_SIZE + 8)
+#define CAPTURE_RECORD_SIZE (4 + MESSAGE_WIRE_SIZE)
+
+/* the longest time between two records, in microseconds (a longer pause is recorded as this one) */
+#define CAPTURE_MAX_DELTA ((1 << 30) - 1)
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "communication.h"
+#include "protocol.h"
+
+/* what a record holds: the kind is in the top 2 bits of the time word */
+enum capture_kind{
+    CAPTURE_SENT,           /* a message written to the socket */
+    CAPTURE_RECEIVED,       /* 16 bytes read from the socket, valid or not */
+    CAPTURE_CONNECTION,     /* a new connection begins: the frame holds the local role */
+    CAPTURE_RESUMED         /* the connection was replaced: the frame holds the game field (base 3) and who moves */
+};
+
+/*  Every message sent or received by the connection manager, with the time from the previous one. The
+    records are written by one thread at a time: the game thread before it starts the connection manager,
+    then the connection manager. */
+struct capture{
+    FILE* file;
+    long long last_us;                              /* time of the last record */
+    unsigned char partial[MESSAGE_WIRE_SIZE];       /* bytes received that do not form a message yet */
+    int partial_size;
+};
+
+struct capture_entry{
+    enum capture_kind kind;
+    long long time_us;                              /* from the start of the capture */
+    unsigned char frame[MESSAGE_WIRE_SIZE];
+};
+
+/* the capture written by the connection manager, NULL if the messages are not captured */
+extern struct capture* message_capture;
+
+bool capture_open(struct capture* capture, const char* path);
+
+void capture_close(struct capture* capture);
+
+void capture_connection(struct capture* capture, enum role role);
+
+void capture_resumed(struct capture* capture, int board_index, enum role turn);
+
+void capture_sent(struct capture* capture, const unsigned char* frames, int size);
+
+void capture_received(struct capture* capture, const unsigned char* data, int size);
+
+int capture_load(const char* path, struct capture_entry** entries);
+
+void capture_marker_values(const struct capture_entry* entry, int* value1, int* value2);
+
+#endif /* CAPTURE_H */
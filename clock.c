@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+
+#include "clock.h"
+#include "minilogger.h"
+
+/*  The system clock reads the time of the machine and really waits. The virtual clock only moves when
+    something waits on it: the timers scheduled before the end of the wait run in order of time (in order of
+    scheduling at the same time), then the time jumps to the end of the wait. Given the same timers, a
+    simulation always runs the same way, and a game that would last minutes takes microseconds.
+    The virtual clock can be used by one thread only. */
+
+static void system_now(struct timespec* timestamp){
+    clock_gettime(CLOCK_REALTIME, timestamp);
+}
+
+static void system_sleep(int ms){
+    struct timespec time_left;
+
+    if(ms <= 0){
+        return;
+    }
+
+    time_left.tv_sec = ms / 1000;
+    time_left.tv_nsec = (ms % 1000) * 1000000L;
+
+    while(nanosleep(&time_left, &time_left) != 0 && errno == EINTR);
+}
+
+const struct clock_ops system_clock = {
+    .now = system_now,
+    .sleep = system_sleep,
+    .poll = poll
+};
+
+static const struct clock_ops* current_clock = &system_clock;
+
+void clock_now(struct timespec* timestamp){
+    current_clock->now(timestamp);
+}
+
+/* The caller is suspended for at least ms milliseconds */
+void clock_sleep(int ms){
+    current_clock->sleep(ms);
+}
+
+int clock_poll(struct pollfd* fds, nfds_t n_fds, int timeout_ms){
+    return current_clock->poll(fds, n_fds, timeout_ms);
+}
+
+/* --- the virtual clock --- */
+
+struct timer{
+    long long at_ms;
+    unsigned long long sequence;        /* timers at the same time run in the order they were scheduled */
+    void (*callback)(void* context);
+    void* context;
+};
+
+static long long virtual_now_ms;
+static unsigned long long next_sequence;
+
+/* binary min-heap of the timers, the next one to run is timers[0] */
+static struct timer timers[VIRTUAL_CLOCK_TIMERS];
+static int n_timers;
+
+static bool runs_before(const struct timer* t1, const struct timer* t2){
+    return t1->at_ms < t2->at_ms || (t1->at_ms == t2->at_ms && t1->sequence < t2->sequence);
+}
+
+static void swap_timers(int i, int j){
+    struct timer tmp = timers[i];
+
+    timers[i] = timers[j];
+    timers[j] = tmp;
+}
+
+static struct timer pop_timer(){
+    struct timer first = timers[0];
+    int pos = 0;
+
+    timers[0] = timers[--n_timers];
+
+    while(1){
+        int smallest = pos;
+        int left = 2 * pos + 1;
+        int right = left + 1;
+
+        if(left < n_timers && runs_before(&timers[left], &timers[smallest])){
+            smallest = left;
+        }
+        if(right < n_timers && runs_before(&timers[right], &timers[smallest])){
+            smallest = right;
+        }
+        if(smallest == pos){
+            break;
+        }
+
+        swap_timers(pos, smallest);
+        pos = smallest;
+    }
+
+    return first;
+}
+
+/*  Calls callback(context) when the virtual time reaches at_ms (at once if it has passed, but only when
+    somebody waits on the clock). Returns false if there are already VIRTUAL_CLOCK_TIMERS timers */
+bool virtual_clock_schedule(long long at_ms, void (*callback)(void* context), void* context){
+    int pos = n_timers;
+
+    if(n_timers == VIRTUAL_CLOCK_TIMERS){
+        mini_log(ERROR, "virtual_clock_schedule", -1, "Too many timers");
+        return false;
+    }
+
+    timers[pos].at_ms = at_ms;
+    timers[pos].sequence = next_sequence++;
+    timers[pos].callback = callback;
+    timers[pos].context = context;
+    ++n_timers;
+
+    while(pos > 0 && runs_before(&timers[pos], &timers[(pos - 1) / 2])){
+        swap_timers(pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+
+    return true;
+}
+
+/* Moves the virtual time to the next timer and runs it. Returns false if no timer is scheduled */
+bool virtual_clock_run_next(){
+    struct timer timer;
+
+    if(n_timers == 0){
+        return false;
+    }
+
+    timer = pop_timer();
+    if(timer.at_ms > virtual_now_ms){
+        virtual_now_ms = timer.at_ms;
+    }
+
+    timer.callback(timer.context);
+    return true;
+}
+
+long long virtual_clock_ms(){
+    return virtual_now_ms;
+}
+
+static void virtual_now(struct timespec* timestamp){
+    timestamp->tv_sec = virtual_now_ms / 1000;
+    timestamp->tv_nsec = (virtual_now_ms % 1000) * 1000000L;
+}
+
+static void virtual_sleep(int ms){
+    long long wake_up_ms = virtual_now_ms + (ms > 0 ? ms : 0);
+
+    while(n_timers > 0 && timers[0].at_ms <= wake_up_ms){
+        virtual_clock_run_next();
+    }
+    virtual_now_ms = wake_up_ms;
+}
+
+/*  The descriptors are checked without waiting: while none is ready the timers due before the timeout run
+    (they may make one ready), then the time jumps to the timeout */
+static int virtual_poll(struct pollfd* fds, nfds_t n_fds, int timeout_ms){
+    long long deadline_ms = virtual_now_ms + timeout_ms;
+
+    while(1){
+        int ready = poll(fds, n_fds, 0);
+
+        if(ready != 0 || timeout_ms == 0){
+            return ready;
+        }
+
+        if(n_timers > 0 && (timeout_ms < 0 || timers[0].at_ms <= deadline_ms)){
+            virtual_clock_run_next();
+        }
+        else if(timeout_ms < 0){
+            /* nothing can happen in virtual time: only another thread can make a descriptor ready */
+            return poll(fds, n_fds, -1);
+        }
+        else{
+            virtual_now_ms = deadline_ms;
+            return 0;
+        }
+    }
+}
+
+static const struct clock_ops virtual_clock = {
+    .now = virtual_now,
+    .sleep = virtual_sleep,
+    .poll = virtual_poll
+};
+
+/* From now on the time starts from start_ms and only moves when somebody waits; the old timers are dropped */
+void use_virtual_clock(long long start_ms){
+    virtual_now_ms = start_ms;
+    next_sequence = 0;
+    n_timers = 0;
+    current_clock = &virtual_clock;
+}
+
+void use_system_clock(){
+    current_clock = &system_clock;
+}
@@ -0,0 +1,37 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/* timers that can be scheduled at the same time on the virtual clock */
+#define VIRTUAL_CLOCK_TIMERS 1024
+
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+
+/*  Where the time of the game comes from: every deadline, sleep and wait goes through the clock in use.
+    The system clock is the default, the virtual clock lets a simulation run whole games at CPU speed. */
+struct clock_ops{
+    void (*now)(struct timespec* timestamp);
+    void (*sleep)(int ms);
+    int (*poll)(struct pollfd* fds, nfds_t n_fds, int timeout_ms);     /* the same result of poll */
+};
+
+extern const struct clock_ops system_clock;
+
+void clock_now(struct timespec* timestamp);
+
+void clock_sleep(int ms);
+
+int clock_poll(struct pollfd* fds, nfds_t n_fds, int timeout_ms);
+
+void use_virtual_clock(long long start_ms);
+
+void use_system_clock();
+
+long long virtual_clock_ms();
+
+bool virtual_clock_schedule(long long at_ms, void (*callback)(void* context), void* context);
+
+bool virtual_clock_run_next();
+
+#endif /* CLOCK_H */
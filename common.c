@@ -4,12 +4,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #include "common.h"
+#include "clock.h"
 #include "minilogger.h"
+#include "eventLoop.h"
+#include "render.h"
 
 void get_current_time_in_timespec(struct timespec* timestamp){
-    clock_gettime(CLOCK_REALTIME, timestamp);
+    clock_now(timestamp);
 }
 
 /* Returns true if t1 is greater than t2*/
@@ -74,30 +81,31 @@ void get_absolute_time_with_offset(int ms, struct timespec* absolute_time){
     add_timespec(&ms_offset, absolute_time);
 }
 
-/* The caller is supended for at least ms milliseconds */
-void ms_sleep(const int ms){
-    if(ms < 0){
-        return;
+/* Returns the milliseconds left before absolute_time (rounded up), or 0 if it has already passed */
+int ms_until(const struct timespec* absolute_time){
+    struct timespec now;
+
+    if(absolute_time == NULL){
+        return 0;
     }
 
-    int tmp = 0;
-    struct timespec time_left;
+    get_current_time_in_timespec(&now);
 
-    ms_to_timespec(ms, &time_left);
+    long long ns_left = (long long)(absolute_time->tv_sec - now.tv_sec) * 1000000000LL + (absolute_time->tv_nsec - now.tv_nsec);
+    if(ns_left <= 0){
+        return 0;
+    }
 
-    do {
-        tmp = nanosleep(&time_left, &time_left);
-    } while (tmp != 0 && errno == EINTR);
+    return (int)((ns_left + 999999) / 1000000);
+}
 
-    return; 
+/* The caller is supended for at least ms milliseconds */
+void ms_sleep(const int ms){
+    clock_sleep(ms);
 }
 
 void clean_console(){
-    #ifndef DEBUG
-    system("clear");
-    #endif
-
-    return;
+    render_clear_screen();
 }
 
 void close_socket(int socket){
@@ -107,7 +115,54 @@ void close_socket(int socket){
 }
 
 void wait_for_any_key_press(){
-    int tmp;
-    while( (tmp = getchar()) != '\n' && tmp != EOF);
-    getchar();
+    char line[INPUT_LINE_SIZE];
+
+    fflush(stdout);
+    read_input_line(line, sizeof(line));
+}
+
+/*  Connects socket to address, giving up after timeout_ms milliseconds instead of waiting for the kernel's
+    SYN retries. The socket is left blocking. Returns 0 on success, -1 otherwise (errno is ETIMEDOUT if the time ran out). */
+int connect_with_timeout(int socket, const struct sockaddr_in* address, int timeout_ms){
+    int flags = fcntl(socket, F_GETFL, 0);
+    if(flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0){
+        mini_log(ERROR, "connect_with_timeout", -1, "Unable to make the socket non-blocking");
+        return -1;
+    }
+
+    int result = connect(socket, (const struct sockaddr*)address, sizeof(struct sockaddr_in));
+    if(result < 0 && errno == EINPROGRESS){
+        struct pollfd pfd;
+        struct timespec deadline;
+        int ready;
+
+        pfd.fd = socket;
+        pfd.events = POLLOUT;
+        get_absolute_time_with_offset(timeout_ms, &deadline);
+
+        do{
+            ready = clock_poll(&pfd, 1, ms_until(&deadline));
+        }while(ready < 0 && errno == EINTR);
+
+        if(ready > 0){
+            int error = 0;
+            socklen_t error_size = sizeof(error);
+
+            if(getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &error_size) == 0 && error == 0){
+                result = 0;
+            }
+            else{
+                errno = error;
+            }
+        }
+        else if(ready == 0){
+            errno = ETIMEDOUT;
+        }
+    }
+
+    int connect_errno = errno;
+    fcntl(socket, F_SETFL, flags);
+    errno = connect_errno;
+
+    return result == 0 ? 0 : -1;
 }
@@ -19,10 +19,16 @@ void add_timespec(const struct timespec* op1, struct timespec* op2);
 
 void get_absolute_time_with_offset(int ms, struct timespec* absolute_time);
 
+int ms_until(const struct timespec* absolute_time);
+
 void clean_console();
 
 void close_socket(int socket);
 
+struct sockaddr_in;
+
+int connect_with_timeout(int socket, const struct sockaddr_in* address, int timeout_ms);
+
 void wait_for_any_key_press();
 
 #endif /* COMMON_H */
\ No newline at end of file
@@ -3,32 +3,33 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "minilogger.h"
+#include "capture.h"
 #include "common.h"
 #include "communication.h"
+#include "resume.h"
 #include "protocol.h"
+#include "eventLoop.h"
 
 extern struct conn_status conn_status;
 extern pthread_mutex_t conn_status_mutex;
 
-extern struct message message_queue_in[MESSAGE_QUEUE_SIZE];
-extern int message_queue_in_curr_size;
-extern pthread_mutex_t message_queue_in_mutex;
+extern struct message_queue message_queue_in;
+extern struct message_queue message_queue_out;
 
-extern struct message message_queue_out[MESSAGE_QUEUE_SIZE];
-extern int message_queue_out_curr_size;
-extern pthread_mutex_t message_queue_out_mutex;
-
-extern int connection_manager_socket;
+int connection_manager_socket;
 
 void print_message(struct message* msg){
     #ifdef DEBUG
     if(msg != NULL)
-        printf("Message: comm=%d n_args=%d arg1=%d arg2=%d\n", msg->communication, msg->n_args, msg->arg1, msg->arg2);
+        printf("Message: stream=%d comm=%d n_args=%d arg1=%d arg2=%d\n", msg->stream, msg->communication, msg->n_args, msg->arg1, msg->arg2);
     else
         mini_log(ERROR, "print_message", -1, "Invalid parameter");
     #endif
@@ -42,191 +43,462 @@ void copy_message(struct message* dest, struct message* src){
         return;
     }
 
+    dest->stream = src->stream;
     dest->communication = src->communication;
     dest->n_args = src->n_args;
     dest->arg1 = src->arg1;
     dest->arg2 = src->arg2;
 }
 
+bool queue_init(struct message_queue* queue){
+    if(queue == NULL){
+        mini_log(ERROR, "queue_init", -1, "Invalid parameter");
+        return false;
+    }
+
+    queue->head = 0;
+    queue->size = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+
+    return create_event_pipe(queue->event_pipe);
+}
+
+void queue_destroy(struct message_queue* queue){
+    if(queue == NULL){
+        return;
+    }
+
+    close_event_pipe(queue->event_pipe);
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+/* Appends a copy of msg to the queue and wakes up the consumer. Returns false if the queue is full */
+bool queue_push(struct message_queue* queue, struct message* msg){
+    if(queue == NULL || msg == NULL){
+        mini_log(ERROR, "queue_push", -1, "Invalid parameters");
+        return false;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if(queue->size >= MESSAGE_QUEUE_SIZE){
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+
+    copy_message(&queue->messages[(queue->head + queue->size) % MESSAGE_QUEUE_SIZE], msg);
+    ++queue->size;
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    queue_notify(queue);
+    return true;
+}
+
+/* Removes the oldest message of the queue and puts it in msg. Returns false if the queue is empty */
+bool queue_pop(struct message_queue* queue, struct message* msg){
+    if(queue == NULL || msg == NULL){
+        mini_log(ERROR, "queue_pop", -1, "Invalid parameters");
+        return false;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if(queue->size == 0){
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+
+    copy_message(msg, &queue->messages[queue->head]);
+    queue->head = (queue->head + 1) % MESSAGE_QUEUE_SIZE;
+    --queue->size;
+
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+/* The returned descriptor becomes readable when something was pushed (or queue_notify was called) */
+int queue_event_fd(struct message_queue* queue){
+    return queue->event_pipe[0];
+}
+
+/* Wakes up the consumer of the queue even if no message was pushed (e.g. to signal a termination) */
+void queue_notify(struct message_queue* queue){
+    notify_event(queue->event_pipe[1]);
+}
+
+/* Puts the specified values in the msg pointed by msg */
+void prepare_message(struct message* msg, enum comm comm, int n_args, int arg1, int arg2){
+    if(msg == NULL){
+        mini_log(ERROR, "prepare_message", -1, "Invalid parameter!");
+        return;
+    }
+
+    msg->stream = 0;
+    msg->communication = comm;
+    msg->n_args = n_args;
+    msg->arg1 = arg1;
+    msg->arg2 = arg2;
+}
+
+static void write_int32(unsigned char* buffer, int value){
+    unsigned int v = (unsigned int)value;
+
+    buffer[0] = v & 0xff;
+    buffer[1] = (v >> 8) & 0xff;
+    buffer[2] = (v >> 16) & 0xff;
+    buffer[3] = (v >> 24) & 0xff;
+}
+
+static int read_int32(const unsigned char* buffer){
+    return (int)((unsigned int)buffer[0] | ((unsigned int)buffer[1] << 8) | ((unsigned int)buffer[2] << 16) | ((unsigned int)buffer[3] << 24));
+}
+
+/*  Writes msg in buffer (MESSAGE_WIRE_SIZE bytes). The layout is the one of struct message on the
+    little endian machines that run the older versions, so they can still play with this one. */
+/*  The first word carries the stream id in its upper 16 bits and the command in the lower 16 bits:
+    a connection with a single game (stream 0) is encoded as before the streams existed. */
+void encode_message(const struct message* msg, unsigned char* buffer){
+    write_int32(&buffer[0], (int)(((unsigned int)msg->stream << 16) | ((unsigned int)msg->communication & 0xffff)));
+    write_int32(&buffer[4], msg->n_args);
+    write_int32(&buffer[8], msg->arg1);
+    write_int32(&buffer[12], msg->arg2);
+}
+
+void decode_message(const unsigned char* buffer, struct message* msg){
+    unsigned int first_word = (unsigned int)read_int32(&buffer[0]);
+
+    msg->stream = (int)(first_word >> 16);
+    msg->communication = (enum comm)(first_word & 0xffff);
+    msg->n_args = read_int32(&buffer[4]);
+    msg->arg1 = read_int32(&buffer[8]);
+    msg->arg2 = read_int32(&buffer[12]);
+}
+
+void frame_parser_init(struct frame_parser* parser){
+    parser->size = 0;
+}
+
+/*  Splits size bytes received from the stream in messages, which are validated and passed to handler.
+    A message split between two calls is kept in the parser. Returns the number of messages delivered,
+    or -1 if a message is not valid or handler refused one. */
+int parse_frames(struct frame_parser* parser, const unsigned char* data, int size, message_handler handler, void* context){
+    struct message msg;
+    int delivered = 0;
+
+    /* complete the message left incomplete by the previous call */
+    if(parser->size > 0){
+        int missing = MESSAGE_WIRE_SIZE - parser->size;
+        int copied = size < missing ? size : missing;
+
+        memcpy(&parser->buffer[parser->size], data, copied);
+        parser->size += copied;
+        data += copied;
+        size -= copied;
+
+        if(parser->size < MESSAGE_WIRE_SIZE){
+            return 0;
+        }
+
+        parser->size = 0;
+        decode_message(parser->buffer, &msg);
+
+        if(!validate_message(&msg) || !handler(&msg, context)){
+            return -1;
+        }
+        ++delivered;
+    }
+
+    /* whole messages are decoded directly from the received bytes */
+    while(size >= MESSAGE_WIRE_SIZE){
+        decode_message(data, &msg);
+
+        if(!validate_message(&msg) || !handler(&msg, context)){
+            return -1;
+        }
+        ++delivered;
+
+        data += MESSAGE_WIRE_SIZE;
+        size -= MESSAGE_WIRE_SIZE;
+    }
+
+    memcpy(parser->buffer, data, size);
+    parser->size = size;
+
+    return delivered;
+}
+
+/*  Number of arguments and accepted range of each argument of a message. An argument past n_args is a field
+    added after the first version, which the older versions do not read: its range is checked all the same,
+    and it is {0, 0} when the message has no such field */
+struct message_format{
+    int n_args;
+    int arg1_min;
+    int arg1_max;
+    int arg2_min;
+    int arg2_max;
+};
+
+/* one entry for each enum comm, in the order of the enum */
+static const struct message_format message_formats[] = {
+    /* OK */                {0, 0, INT_MAX, 0, 0},          /* protocol version of the guest in the answer to WELCOME, 0 otherwise */
+    /* NO_RESYNC */         {0, 0, 0, 0, 0},
+    /* NO_UNEXPECTED */     {0, 0, 0, 0, 0},
+    /* WELCOME */           {1, HOST, GUEST, 0, INT_MAX},   /* who plays first, protocol version of the host (0: version 1) */
+    /* DENIED */            {0, 0, 0, 0, 0},
+    /* DISCONNECT */        {0, 0, 0, 0, 0},
+    /* SET */               {2, 1, 9, HOST, GUEST},         /* cell, symbol */
+    /* PLACE */             {1, 1, 9, 0, 3},                /* cell, outcome claimed by the move (0: no claim, then as WIN) */
+    /* WIN */               {1, HOST, 3, 0, 0},             /* winner, 3 means draw */
+    /* SYNC_START */        {0, 0, 0, 0, 0},
+    /* SYNC_FINISCHED */    {2, 0, BOARD_INDEX_COUNT - 1, HOST, GUEST},    /* game field, who moves */
+    /* RESUME */            {1, 1, INT_MAX, 0, 0},          /* session token */
+    /* DRAW_OFFER */        {0, 0, 0, 0, 0},
+    /* REMATCH */           {0, 0, 0, 0, 0},
+    /* TOKEN */             {1, 1, INT_MAX, 0, 0}           /* session token, only sent to a guest of version 2 or later */
+};
+
+_Static_assert(sizeof(message_formats) / sizeof(message_formats[0]) == COMM_COUNT, "message_formats must have an entry for every enum comm");
+
+/* Returns true if msg is a known command with the expected arguments */
 bool validate_message(struct message* msg){
     if(msg == NULL)
         return false;
 
-    if(msg->communication < 0 || msg->communication > 10){
+    if((unsigned)msg->communication >= COMM_COUNT){
+        return false;
+    }
+
+    const struct message_format* format = &message_formats[msg->communication];
+
+    if(msg->n_args != format->n_args){
+        return false;
+    }
+    if(msg->arg1 < format->arg1_min || msg->arg1 > format->arg1_max){
+        return false;
+    }
+    if(msg->arg2 < format->arg2_min || msg->arg2 > format->arg2_max){
         return false;
     }
 
-    switch(msg->n_args){
-        case 0:
-            return true;
-        break;
-        case 1:
-            if(msg->arg1 <= 0 || msg->arg1 > 9)
-                return false;
-            else
-                return true;
-        break;
-        case 2:
-            if(msg->arg1 <= 0 || msg->arg1 > 9 || msg->arg2 <= 0 || msg->arg2 > 9)
-                return false;
-            else
-                return true;
-        break;
-        default:
+    return true;
+}
+
+/* Writes every message in the outgoing queue to the socket. Returns false if send failed */
+static bool flush_outgoing_messages(){
+    struct message msg;
+    unsigned char send_buffer[MESSAGE_QUEUE_SIZE * MESSAGE_WIRE_SIZE];
+    int send_buffer_size = 0;
+
+    while(send_buffer_size < (int)sizeof(send_buffer) && queue_pop(&message_queue_out, &msg)){
+        encode_message(&msg, &send_buffer[send_buffer_size]);
+        send_buffer_size += MESSAGE_WIRE_SIZE;
+
+        mini_log(LOG, "connection_manager", -1, "Message sent");
+        print_message(&msg);
+    }
+
+    /* a short write would leave half a frame on the stream and desynchronize the parser of the other peer */
+    for(int sent = 0; sent < send_buffer_size;){
+        int n_byte_sent = send(connection_manager_socket, &send_buffer[sent], send_buffer_size - sent, MSG_NOSIGNAL);
+
+        if(n_byte_sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            mini_log(ERROR, "connection_manager", -1, "Unable to send messages!");
             return false;
-        break;
+        }
+        sent += n_byte_sent;
+    }
+    capture_sent(message_capture, send_buffer, send_buffer_size);
+
+    return true;
+}
+
+/* Returns true if the game (or the other peer) asked to close the connection */
+static bool termination_requested(){
+    bool res;
+
+    pthread_mutex_lock(&conn_status_mutex);
+    res = conn_status.terminated_by_game == true || conn_status.terminated_by_other_peer == true;
+    pthread_mutex_unlock(&conn_status_mutex);
+
+    return res;
+}
+
+/*  Without traffic a broken connection is noticed only after minutes: keepalive probes and a limit on
+    unacknowledged data make the connection fail after about CONNECTION_DEAD_AFTER milliseconds. */
+static void detect_dead_peer(int socket){
+    int enable = 1;
+    int idle = 2;
+    int interval = 1;
+    int count = (CONNECTION_DEAD_AFTER / 1000) - idle;
+    unsigned int user_timeout = CONNECTION_DEAD_AFTER;
+
+    setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+    setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+}
+
+/* Closes the connection because of an error and wakes up the game thread */
+static void terminate_connection(){
+    close_socket(connection_manager_socket);
+
+    pthread_mutex_lock(&conn_status_mutex);
+    conn_status.terminated_by_conn_manager = true;
+    pthread_mutex_unlock(&conn_status_mutex);
+
+    queue_notify(&message_queue_in);
+}
+
+/* message_handler used by the connection manager: received messages go to the game */
+static bool deliver_to_game(struct message* msg, void* context){
+    (void)context;
+
+    if(msg->stream != 0){
+        mini_log(ERROR, "connection_manager", -1, "Multiplexed message on a single game connection!");
+        return false;
+    }
+
+    if(!queue_push(&message_queue_in, msg)){
+        /* Too many messages in the queue */
+        mini_log(ERROR, "connection_manager", -1, "Message queue full!");
+        return false;
     }
 
+    mini_log(LOG, "connection_manager", -1, "Received a message");
+    print_message(msg);
     return true;
 }
 
+/* Closes the connection that did not send its RESUME yet: if it is the guest coming back, it tries again */
+static void close_pending_resume(struct pending_resume* pending){
+    if(pending->socket >= 0){
+        close_socket(pending->socket);
+        pending->socket = -1;
+    }
+}
+
 void* connection_manager(){
 
-    struct message received_message;
-    const int buffered_message_max_size = sizeof(struct message);
+    struct frame_parser parser;
+    unsigned char receive_buffer[MESSAGE_QUEUE_SIZE * MESSAGE_WIRE_SIZE];
+    int n_byte_read = 0;
 
-    char buffered_message[buffered_message_max_size];
-    int buffered_message_size = 0;
-    char temp_message_buffer[buffered_message_max_size];
-    int temp_message_buffer_size = 0;
+    int outgoing_event_fd = queue_event_fd(&message_queue_out);
+    int max_fd = connection_manager_socket > outgoing_event_fd ? connection_manager_socket : outgoing_event_fd;
+    if(resume_listen_socket > max_fd){
+        max_fd = resume_listen_socket;
+    }
+
+    detect_dead_peer(connection_manager_socket);
+
+    /* every send is a whole message that the other player is waiting for: it is not held back to be merged */
+    int enable = 1;
+    setsockopt(connection_manager_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
 
     fd_set socket_read_fd_set;
 
-    struct timeval socket_block_timeout = {0, 250000};
+    /* a connection on the port of the game is read only when it is readable, one at a time, so it never holds up the game */
+    struct pending_resume pending;
+    pending.socket = -1;
+
+    frame_parser_init(&parser);
 
     while(1){
 
-        pthread_mutex_lock(&conn_status_mutex);
-        if(conn_status.terminated_by_game == true || conn_status.terminated_by_other_peer == true){
+        /* the last messages (e.g. DISCONNECT or the final OK) are still delivered before closing */
+        if(termination_requested()){
+            flush_outgoing_messages();
             close_socket(connection_manager_socket);
+            close_pending_resume(&pending);
             mini_log(INFO, "connection_manager", -1, "Terminating as requested");
-            pthread_mutex_unlock(&conn_status_mutex);
             return NULL;
         }
-        pthread_mutex_unlock(&conn_status_mutex);
 
         /* if there are any messages, write them to the socket */
-        pthread_mutex_lock(&message_queue_out_mutex);
-
-        int bytes_sent;
-
-        while(message_queue_out_curr_size > 0){
-            
-            bytes_sent = send(connection_manager_socket, &message_queue_out[0], sizeof(struct message), 0);
-            if(bytes_sent < 0){
-                mini_log(ERROR, "connection_manager", -1, "Unable to send messages!");
-                close_socket(connection_manager_socket);
-
-                pthread_mutex_lock(&conn_status_mutex);
-                conn_status.terminated_by_conn_manager = true;
-                pthread_mutex_unlock(&conn_status_mutex);
-                
-                pthread_mutex_unlock(&message_queue_out_mutex);
-                return NULL;
-            }
-            mini_log(LOG, "connection_manager", -1, "Message sent");
-            print_message(&message_queue_out[0]);
+        drain_events(outgoing_event_fd);
 
-            --message_queue_out_curr_size;
-
-            /* the message queue has max lenght = 2 */
-            if(message_queue_out_curr_size == 1){
-                copy_message(&message_queue_out[0], &message_queue_out[1]);
-            }
+        if(!flush_outgoing_messages()){
+            close_pending_resume(&pending);
+            terminate_connection();
+            return NULL;
         }
-        pthread_mutex_unlock(&message_queue_out_mutex);
-
 
-        /* try to read something from the socket */
+        /*  wait for something to read or for new outgoing messages: a request to terminate is notified
+            on the outgoing queue too, so no timeout is needed */
 
         FD_ZERO(&socket_read_fd_set);
         FD_SET(connection_manager_socket, &socket_read_fd_set);
+        FD_SET(outgoing_event_fd, &socket_read_fd_set);
 
-        if(select(connection_manager_socket + 1, &socket_read_fd_set, NULL, NULL, &socket_block_timeout) > 0){
+        struct timeval timeout;
+        struct timeval* select_timeout = NULL;
+        int select_max_fd = max_fd;
 
-            pthread_mutex_lock(&conn_status_mutex);
-            if(conn_status.terminated_by_game == true || conn_status.terminated_by_other_peer == true){
-                close_socket(connection_manager_socket);
-                mini_log(INFO, "connection_manager", -1, "Terminating as requested");
-                pthread_mutex_unlock(&conn_status_mutex);
-                return NULL;
+        if(pending.socket >= 0){
+            int ms_left = ms_until(&pending.deadline);
+
+            if(ms_left <= 0){
+                refuse_resume(&pending);
+                continue;
+            }
+            FD_SET(pending.socket, &socket_read_fd_set);
+            if(pending.socket > select_max_fd){
+                select_max_fd = pending.socket;
+            }
+            timeout.tv_sec = ms_left / 1000;
+            timeout.tv_usec = (ms_left % 1000) * 1000;
+            select_timeout = &timeout;
+        }
+        else if(resume_listen_socket >= 0){
+            FD_SET(resume_listen_socket, &socket_read_fd_set);
+        }
+
+        if(select(select_max_fd + 1, &socket_read_fd_set, NULL, NULL, select_timeout) > 0){
+
+            if(termination_requested()){
+                continue;
+            }
+
+            if(pending.socket < 0 && resume_listen_socket >= 0 && FD_ISSET(resume_listen_socket, &socket_read_fd_set)){
+                start_resume(&pending, resume_listen_socket);
             }
-            pthread_mutex_unlock(&conn_status_mutex);
-            
+            else if(pending.socket >= 0 && FD_ISSET(pending.socket, &socket_read_fd_set)){
+                resumed_socket = continue_resume(&pending, resume_token);
+
+                /* the guest came back on a new connection: this one is dead even if the host did not notice */
+                if(resumed_socket >= 0){
+                    mini_log(WARNING, "connection_manager", -1, "The guest reconnected, the old connection is closed");
+                    terminate_connection();
+                    return NULL;
+                }
+            }
+
             if (FD_ISSET(connection_manager_socket, &socket_read_fd_set)){
 
-                temp_message_buffer_size = recv(connection_manager_socket, temp_message_buffer, buffered_message_max_size-buffered_message_size, 0);
-                if(temp_message_buffer_size <= 0){
-                    if(temp_message_buffer_size == buffered_message_max_size){
-                        mini_log(ERROR, "connection_manager", -1, "Message buffer full !");    
-                    }
-                    else{
-                        mini_log(WARNING, "connection_manager", -1, "Recv returned 0 or -1 !");
-                    }
-                    close_socket(connection_manager_socket);
-
-                    pthread_mutex_lock(&conn_status_mutex);
-                    conn_status.terminated_by_conn_manager = true;
-                    pthread_mutex_unlock(&conn_status_mutex);
+                n_byte_read = recv(connection_manager_socket, receive_buffer, sizeof(receive_buffer), 0);
+                if(n_byte_read <= 0){
+                    mini_log(WARNING, "connection_manager", -1, "Recv returned 0 or -1 !");
+                    close_pending_resume(&pending);
+                    terminate_connection();
                     return NULL;
                 }
-                else{
-                    /* Copy the bytes received in the message buffer */
-
-                    for(int i=0; i < temp_message_buffer_size; ++i){
-                        buffered_message[buffered_message_size + i] = temp_message_buffer[i];
-                    }
-                    buffered_message_size += temp_message_buffer_size;
-                    temp_message_buffer_size = 0;
-
-                    /* if enough bytes were received try to "parse" a message */
-
-                    if(buffered_message_size == buffered_message_max_size){
-                        memcpy(&received_message, buffered_message, sizeof(struct message));
-
-                        buffered_message_size = 0;
-
-                        if(validate_message(&received_message)){
-                            
-                            pthread_mutex_lock(&message_queue_in_mutex);
-
-                            if(message_queue_in_curr_size < MESSAGE_QUEUE_SIZE){
-                                copy_message(&message_queue_in[message_queue_in_curr_size], &received_message);
-                                ++message_queue_in_curr_size;
-
-                                mini_log(LOG, "connection_manager", -1, "Received a message");
-                                print_message(&received_message);
-
-                                pthread_mutex_unlock(&message_queue_in_mutex);
-                            }
-                            else{
-                                /* Too many messages in the queue */
-                                mini_log(ERROR, "connection_manager", -1, "Message queue full!");
-                                close_socket(connection_manager_socket);
-
-                                pthread_mutex_lock(&conn_status_mutex);
-                                conn_status.terminated_by_conn_manager = true;
-                                pthread_mutex_unlock(&conn_status_mutex);
-
-                                pthread_mutex_unlock(&message_queue_in_mutex);
-                                return NULL;
-                            }
-                        }
-                        else{
-                            mini_log(ERROR, "connection_manager", -1, "The message received is not correct!");
-                            close_socket(connection_manager_socket);
-
-                            pthread_mutex_lock(&conn_status_mutex);
-                            conn_status.terminated_by_conn_manager = true;
-                            pthread_mutex_unlock(&conn_status_mutex);
-
-                            return NULL;
-                        }
-                    }
+                capture_received(message_capture, receive_buffer, n_byte_read);
+
+                /* "parse" every complete message */
+                if(parse_frames(&parser, receive_buffer, n_byte_read, deliver_to_game, NULL) < 0){
+                    mini_log(ERROR, "connection_manager", -1, "The message received is not correct!");
+                    close_pending_resume(&pending);
+                    terminate_connection();
+                    return NULL;
                 }
             }
         }
     }
 
     return NULL;
-}
\ No newline at end of file
+}
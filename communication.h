@@ -1,9 +1,16 @@
 #ifndef COMMUNICATION_H
 #define COMMUNICATION_H
 
-/* do not modify MESSAGE_QUEUE_SIZE */
 #define MESSAGE_QUEUE_SIZE 2
 
+/* milliseconds after which a connection that does not answer is considered lost */
+#define CONNECTION_DEAD_AFTER 5000
+
+/* size of a message on the wire: four 32 bit little endian integers */
+#define MESSAGE_WIRE_SIZE 16
+
+#include <pthread.h>
+
 #include "stdbool.h"
 #include "protocol.h"
 #include "common.h"
@@ -14,10 +21,51 @@ struct conn_status{
     bool terminated_by_other_peer;
 };
 
+/* Circular FIFO shared by the game and the connection manager threads.
+   Each push writes one byte in event_pipe, so the consumer can wait for messages with poll. */
+struct message_queue{
+    struct message messages[MESSAGE_QUEUE_SIZE];
+    int head;
+    int size;
+    pthread_mutex_t mutex;
+    int event_pipe[2];
+};
+
+bool queue_init(struct message_queue* queue);
+
+void queue_destroy(struct message_queue* queue);
+
+bool queue_push(struct message_queue* queue, struct message* msg);
+
+bool queue_pop(struct message_queue* queue, struct message* msg);
+
+int queue_event_fd(struct message_queue* queue);
+
+void queue_notify(struct message_queue* queue);
+
+/* Collects the bytes received from a stream socket until they form whole messages */
+struct frame_parser{
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+    int size;
+};
+
+/* Receives each parsed message, returns false to stop the parsing */
+typedef bool (*message_handler)(struct message* msg, void* context);
+
+void encode_message(const struct message* msg, unsigned char* buffer);
+
+void decode_message(const unsigned char* buffer, struct message* msg);
+
+void frame_parser_init(struct frame_parser* parser);
+
+int parse_frames(struct frame_parser* parser, const unsigned char* data, int size, message_handler handler, void* context);
+
 bool validate_message(struct message* msg);
 
 void copy_message(struct message* dest, struct message* src);
 
+void prepare_message(struct message* msg, enum comm comm, int n_args, int arg1, int arg2);
+
 void* connection_manager();
 
 void print_message(struct message* msg);
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
@@ -6,6 +8,13 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <limits.h>
+#include <net/if.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
@@ -13,6 +22,7 @@
 #include "discovery.h"
 #include "minilogger.h"
 #include "common.h"
+#include "eventLoop.h"
 
 extern int tcp_port;    // the tcp port won't change during the execution of the advertising thread
 
@@ -43,9 +53,117 @@ int create_broadcast_socket(int discovery_port){
     return broadcast_socket;
 }
 
-int broadcast(int socket, struct sockaddr_in* broadcast_address, const discoveryMesssage* msg){
+/*  Sends msg to every address with a single sendmmsg. The beacon is read by all the versions, so only the
+    first DISCOVERY_LEGACY_SIZE bytes are sent. Returns the number of datagrams sent or -1 */
+int broadcast(int socket, struct sockaddr_in* broadcast_addresses, int n_addresses, const discoveryMesssage* msg){
+    struct mmsghdr datagrams[MAX_BROADCAST_ADDRESSES];
+    struct iovec payload;
 
-    return sendto(socket, (const void*)msg, sizeof(discoveryMesssage), 0, (struct sockaddr *)broadcast_address, sizeof(struct sockaddr_in));
+    payload.iov_base = (void*)msg;
+    payload.iov_len = DISCOVERY_LEGACY_SIZE;
+
+    if(n_addresses > MAX_BROADCAST_ADDRESSES){
+        n_addresses = MAX_BROADCAST_ADDRESSES;
+    }
+
+    memset(datagrams, 0, sizeof(struct mmsghdr) * n_addresses);
+    for(int i=0; i < n_addresses; ++i){
+        datagrams[i].msg_hdr.msg_name = &broadcast_addresses[i];
+        datagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        datagrams[i].msg_hdr.msg_iov = &payload;
+        datagrams[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return sendmmsg(socket, datagrams, n_addresses, 0);
+}
+
+/*  Puts in addresses the directed broadcast address (address | ~netmask) of every active IPv4 interface
+    that supports broadcast, and joins the multicast group of the probes on each of them.
+    If no interface qualifies, the limited broadcast address 255.255.255.255 is used. Returns the number of addresses. */
+int scan_interfaces(struct sockaddr_in* addresses, int max_addresses, int probe_socket){
+    struct ifaddrs* interfaces;
+    int n_addresses = 0;
+
+    if(getifaddrs(&interfaces) < 0){
+        mini_log(ERROR, "scan_interfaces", -1, "getifaddrs returned -1");
+        interfaces = NULL;
+    }
+
+    for(struct ifaddrs* i = interfaces; i != NULL && n_addresses < max_addresses; i = i->ifa_next){
+        if(i->ifa_addr == NULL || i->ifa_netmask == NULL || i->ifa_addr->sa_family != AF_INET){
+            continue;
+        }
+        if(!(i->ifa_flags & IFF_UP) || !(i->ifa_flags & IFF_BROADCAST) || (i->ifa_flags & IFF_LOOPBACK)){
+            continue;
+        }
+
+        struct in_addr interface_address = ((struct sockaddr_in*)i->ifa_addr)->sin_addr;
+        in_addr_t netmask = ((struct sockaddr_in*)i->ifa_netmask)->sin_addr.s_addr;
+        in_addr_t directed_broadcast = interface_address.s_addr | ~netmask;
+
+        bool present = false;
+        for(int j=0; j < n_addresses; ++j){
+            if(addresses[j].sin_addr.s_addr == directed_broadcast){
+                present = true;
+            }
+        }
+        if(present){
+            continue;
+        }
+
+        memset((void *)&addresses[n_addresses], 0, sizeof(struct sockaddr_in));
+        addresses[n_addresses].sin_family = AF_INET;
+        addresses[n_addresses].sin_addr.s_addr = directed_broadcast;
+        addresses[n_addresses].sin_port = htons(DISCOVERY_PORT);
+        ++n_addresses;
+
+        if(probe_socket >= 0){
+            struct ip_mreq membership;
+            membership.imr_multiaddr.s_addr = inet_addr(DISCOVERY_MULTICAST_GROUP);
+            membership.imr_interface = interface_address;
+
+            /* EADDRINUSE: the group was already joined on this interface */
+            if( setsockopt(probe_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0 && errno != EADDRINUSE){
+                mini_log(WARNING, "scan_interfaces", -1, "Unable to join the multicast group on an interface");
+            }
+        }
+    }
+
+    if(interfaces != NULL){
+        freeifaddrs(interfaces);
+    }
+
+    if(n_addresses == 0 && max_addresses > 0){
+        memset((void *)&addresses[0], 0, sizeof(struct sockaddr_in));
+        addresses[0].sin_family = AF_INET;
+        addresses[0].sin_addr.s_addr = htonl(INADDR_BROADCAST);
+        addresses[0].sin_port = htons(DISCOVERY_PORT);
+        n_addresses = 1;
+    }
+
+    return n_addresses;
+}
+
+/* Creates a netlink socket that becomes readable when an interface or an IPv4 address is added or removed */
+int create_netlink_socket(){
+    int netlink_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(netlink_socket < 0){
+        mini_log(WARNING, "create_netlink_socket", -1, "Unable to create the netlink socket");
+        return -1;
+    }
+
+    struct sockaddr_nl netlink_address;
+    memset((void *)&netlink_address, 0, sizeof(struct sockaddr_nl));
+    netlink_address.nl_family = AF_NETLINK;
+    netlink_address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+
+    if( bind(netlink_socket, (struct sockaddr *)&netlink_address, sizeof(struct sockaddr_nl)) < 0){
+        mini_log(WARNING, "create_netlink_socket", -1, "Unable to bind the netlink socket");
+        close_socket(netlink_socket);
+        return -1;
+    }
+
+    return netlink_socket;
 }
 
 void prepare_discovery_message(discoveryMesssage* msg, int port){
@@ -54,23 +172,361 @@ void prepare_discovery_message(discoveryMesssage* msg, int port){
         return;
     }
 
-    msg->version = 1;
+    msg->version = DISCOVERY_MAGIC | DISCOVERY_VERSION;
     msg->tcp_port = port;
+    msg->load.free_slots = -1;
+    msg->load.active_games = -1;
+    msg->load.move_latency_p99 = -1;
+    msg->load.cpu_load = -1;
 }
 
-void* discovery(){
+/* The load average of the last minute as a percent of the cores (more than 100 if processes are waiting), -1 if not known */
+int cpu_load_percent(){
+    double load_average;
+    long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
 
-    struct sockaddr_in broadcast_address;
-    memset((void *)&broadcast_address, 0, sizeof(struct sockaddr_in));
+    if(getloadavg(&load_average, 1) != 1 || n_cores < 1){
+        return -1;
+    }
+    if(load_average * 100 / n_cores > INT_MAX){
+        return INT_MAX;
+    }
+    return (int)(load_average * 100 / n_cores);
+}
+
+/* The version of an advertisement with version_word, -1 if the word is not one that TrisLAN writes */
+int advertisement_version(int version_word){
+    if(((unsigned int)version_word & DISCOVERY_MAGIC_MASK) == DISCOVERY_MAGIC){
+        return version_word & ~DISCOVERY_MAGIC_MASK;
+    }
+    if(version_word >= 1 && version_word <= 3){
+        return version_word;
+    }
+    return -1;
+}
+
+/*  Attaches the classic BPF program to socket: the kernel drops the datagrams it refuses before they wake
+    the thread reading the socket. Without it (the kernel does not allow it) the checks of userspace remain. */
+static void attach_filter(int socket, struct sock_filter* program, int n_instructions, const char* function){
+    struct sock_fprog filter = {n_instructions, program};
+
+    if( setsockopt(socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0){
+        mini_log(WARNING, function, -1, "Unable to attach the socket filter");
+    }
+}
+
+/*  The scanner only receives advertisements: the legacy 8 bytes or the full message, with a version word
+    that is the magic value or an older version (only 3 in a full message, the first with the load), and
+    a tcp port from 1 to 65535. The words are loaded in network order: ntohl gives the value of the bytes
+    written in host order, the order the advertisements are sent in. */
+static void attach_advertisement_filter(int scanner_socket){
+    struct sock_filter program[] = {
+        /*  0 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        /*  1 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DISCOVERY_UDP_HEADER_SIZE + DISCOVERY_LEGACY_SIZE, 3, 0),
+        /*  2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DISCOVERY_UDP_HEADER_SIZE + sizeof(discoveryMesssage), 0, 12),
+        /* full message: version 3 or the magic */
+        /*  3 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, DISCOVERY_UDP_HEADER_SIZE),
+        /*  4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(3), 6, 4),
+        /* legacy size: versions 1 to 3 or the magic */
+        /*  5 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, DISCOVERY_UDP_HEADER_SIZE),
+        /*  6 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(1), 4, 0),
+        /*  7 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(2), 3, 0),
+        /*  8 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(3), 2, 0),
+        /*  9 */ BPF_STMT(BPF_ALU | BPF_AND | BPF_K, ntohl(DISCOVERY_MAGIC_MASK)),
+        /* 10 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(DISCOVERY_MAGIC), 0, 4),
+        /* tcp port from 1 to 65535 */
+        /* 11 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, DISCOVERY_UDP_HEADER_SIZE + offsetof(discoveryMesssage, tcp_port)),
+        /* 12 */ BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, ntohl(0xffff0000), 2, 0),
+        /* 13 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0),
+        /* 14 */ BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        /* 15 */ BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+
+    attach_filter(scanner_socket, program, sizeof(program) / sizeof(program[0]), "create_scanner_socket");
+}
+
+/* The probe socket only receives probes: the legacy 8 bytes or the full message, with tcp port 0 */
+static void attach_probe_filter(int probe_socket){
+    struct sock_filter program[] = {
+        /* 0 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        /* 1 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DISCOVERY_UDP_HEADER_SIZE + DISCOVERY_LEGACY_SIZE, 1, 0),
+        /* 2 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, DISCOVERY_UDP_HEADER_SIZE + sizeof(discoveryMesssage), 0, 3),
+        /* 3 */ BPF_STMT(BPF_LD | BPF_W | BPF_ABS, DISCOVERY_UDP_HEADER_SIZE + offsetof(discoveryMesssage, tcp_port)),
+        /* 4 */ BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+        /* 5 */ BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        /* 6 */ BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+
+    attach_filter(probe_socket, program, sizeof(program) / sizeof(program[0]), "create_probe_socket");
+}
+
+/* Measures the load written in the advertisements */
+static void refresh_load(discoveryMesssage* msg){
+    if(advertised_load != NULL){
+        advertised_load(&msg->load);
+    }
+    msg->load.cpu_load = cpu_load_percent();
+}
+
+/*  Creates the socket that receives the probes of the guests: it joins the multicast group, but unicast
+    probes sent directly to DISCOVERY_PROBE_PORT are received as well. More hosts can run on the same machine. */
+int create_probe_socket(){
+    int probe_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(probe_socket < 0){
+        mini_log(ERROR, "create_probe_socket", -1, "Unable to create the probe socket");
+        return -1;
+    }
 
-    broadcast_address.sin_family = AF_INET;
-    broadcast_address.sin_addr.s_addr = inet_addr("255.255.255.255");
-    broadcast_address.sin_port = htons(DISCOVERY_PORT);
+    int enable_reuse = 1;
+    if( setsockopt(probe_socket, SOL_SOCKET, SO_REUSEADDR, &enable_reuse, sizeof(enable_reuse)) < 0){
+        mini_log(ERROR, "create_probe_socket", -1, "Unable to set socket options");
+        close_socket(probe_socket);
+        return -1;
+    }
+
+    struct sockaddr_in probe_address;
+    memset((void *)&probe_address, 0, sizeof(struct sockaddr_in));
+    probe_address.sin_family = AF_INET;
+    probe_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    probe_address.sin_port = htons(DISCOVERY_PROBE_PORT);
+
+    if( bind(probe_socket, (struct sockaddr *)&probe_address, sizeof(struct sockaddr_in)) < 0){
+        mini_log(ERROR, "create_probe_socket", -1, "Unable to bind the probe socket");
+        close_socket(probe_socket);
+        return -1;
+    }
+
+    struct ip_mreq membership;
+    membership.imr_multiaddr.s_addr = inet_addr(DISCOVERY_MULTICAST_GROUP);
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+
+    if( setsockopt(probe_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0){
+        /* without a multicast route only the unicast probes arrive, the beacon still works */
+        mini_log(WARNING, "create_probe_socket", -1, "Unable to join the multicast group");
+    }
+
+    attach_probe_filter(probe_socket);
+
+    return probe_socket;
+}
+
+/* Creates the socket of a guest looking for games: it receives the beacons and the answers to the probes */
+int create_scanner_socket(){
+    int scanner_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(scanner_socket < 0){
+        mini_log(ERROR, "create_scanner_socket", -1, "Unable to create the scanner socket");
+        return -1;
+    }
+
+    /* with thousands of hosts answering the same probe the default buffer would drop most answers */
+    int buffer_size = 1 << 20;
+    setsockopt(scanner_socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+
+    struct sockaddr_in rcv_address;
+    memset((void *)&rcv_address, 0, sizeof(struct sockaddr_in));
+    rcv_address.sin_family = AF_INET;
+    rcv_address.sin_addr.s_addr = htonl(INADDR_ANY);
+    rcv_address.sin_port = htons(DISCOVERY_PORT);
+
+    if( bind(scanner_socket, (const struct sockaddr*)&rcv_address, sizeof(struct sockaddr_in)) < 0){
+        mini_log(ERROR, "create_scanner_socket", -1, "Bind returned -1");
+        close_socket(scanner_socket);
+        return -1;
+    }
+
+    attach_advertisement_filter(scanner_socket);
+
+    return scanner_socket;
+}
+
+/*  Reads all the advertisements waiting on the scanner socket, DISCOVERY_BATCH_SIZE at a time, and adds the
+    new hosts to table. Returns the number of new hosts, or -1 if the socket cannot be read anymore. */
+int receive_advertisements(int scanner_socket, struct host_table* table){
+    discoveryMesssage messages[DISCOVERY_BATCH_SIZE];
+    struct sockaddr_in senders[DISCOVERY_BATCH_SIZE];
+    struct iovec payloads[DISCOVERY_BATCH_SIZE];
+    struct mmsghdr datagrams[DISCOVERY_BATCH_SIZE];
+    int n_datagrams;
+    struct timespec arrival_time;
+    int n_new_hosts = 0;
+    int index;
+    bool added;
+
+    do{
+        memset(datagrams, 0, sizeof(datagrams));
+        for(int i=0; i < DISCOVERY_BATCH_SIZE; ++i){
+            payloads[i].iov_base = &messages[i];
+            payloads[i].iov_len = sizeof(discoveryMesssage);
+            datagrams[i].msg_hdr.msg_name = &senders[i];
+            datagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            datagrams[i].msg_hdr.msg_iov = &payloads[i];
+            datagrams[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        n_datagrams = recvmmsg(scanner_socket, datagrams, DISCOVERY_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if(n_datagrams < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR){
+                break;
+            }
+            mini_log(ERROR, "receive_advertisements", -1, "recvmmsg returned -1");
+            return -1;
+        }
+
+        get_current_time_in_timespec(&arrival_time);
+
+        for(int i=0; i < n_datagrams; ++i){
+            /*  the filter of the socket has already dropped the probes and the foreign datagrams, the same checks
+                are made here in case it could not be attached. The advertisements of the older versions have no load */
+            int version = advertisement_version(messages[i].version);
+            bool with_load = datagrams[i].msg_len == sizeof(discoveryMesssage) && version >= 3;
+
+            if(version < 0 || (!with_load && datagrams[i].msg_len != DISCOVERY_LEGACY_SIZE) || (datagrams[i].msg_hdr.msg_flags & MSG_TRUNC)){
+                continue;
+            }
+            if(messages[i].tcp_port <= 0 || messages[i].tcp_port > 65535){
+                continue;
+            }
+
+            #ifdef DEBUG
+            char sender_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &senders[i].sin_addr, sender_ip, INET_ADDRSTRLEN);
+            printf("\n\tReceived from %s: Version=%d Tcp port=%d\n", sender_ip, version, messages[i].tcp_port);
+            #endif
+
+            index = host_table_add(table, senders[i].sin_addr.s_addr, messages[i].tcp_port, version, &added);
+            if(index < 0){
+                continue;
+            }
+            if(added){
+                ++n_new_hosts;
+            }
+
+            struct host* host = &table->hosts[index];
+            host->last_seen = arrival_time;
+            if(with_load){
+                host->load = messages[i].load;
+            }
+
+            /* the first advertisement after a ping is its answer */
+            if(host->rtt < 0 && host->ping_time.tv_sec != 0){
+                host->rtt = (arrival_time.tv_sec - host->ping_time.tv_sec) * 1000000 + (arrival_time.tv_nsec - host->ping_time.tv_nsec) / 1000;
+            }
+        }
+    }while(n_datagrams == DISCOVERY_BATCH_SIZE);
+
+    return n_new_hosts;
+}
+
+/*  Sends a probe by unicast to every host of the table that has not been pinged yet, DISCOVERY_BATCH_SIZE
+    at a time. receive_advertisements measures the round trip time when the answer arrives.
+    Returns the number of pings sent, or -1 if none could be sent. */
+int ping_hosts(int scanner_socket, struct host_table* table){
+    discoveryMesssage probe;
+    struct sockaddr_in addresses[DISCOVERY_BATCH_SIZE];
+    struct iovec payload;
+    struct mmsghdr datagrams[DISCOVERY_BATCH_SIZE];
+    int pinged_host[DISCOVERY_BATCH_SIZE];
+    struct timespec send_time;
+    int n_datagrams;
+    int n_sent = 0;
+    int i = 0;
+
+    prepare_discovery_message(&probe, 0);      /* a probe does not advertise a game */
+
+    payload.iov_base = &probe;
+    payload.iov_len = sizeof(discoveryMesssage);
+
+    while(i < table->n_hosts){
+        n_datagrams = 0;
+        memset(datagrams, 0, sizeof(datagrams));
+
+        for(; i < table->n_hosts && n_datagrams < DISCOVERY_BATCH_SIZE; ++i){
+            if(table->hosts[i].ping_time.tv_sec != 0){
+                continue;
+            }
+
+            memset(&addresses[n_datagrams], 0, sizeof(struct sockaddr_in));
+            addresses[n_datagrams].sin_family = AF_INET;
+            addresses[n_datagrams].sin_addr.s_addr = table->hosts[i].ip;
+            addresses[n_datagrams].sin_port = htons(DISCOVERY_PROBE_PORT);
+
+            datagrams[n_datagrams].msg_hdr.msg_name = &addresses[n_datagrams];
+            datagrams[n_datagrams].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            datagrams[n_datagrams].msg_hdr.msg_iov = &payload;
+            datagrams[n_datagrams].msg_hdr.msg_iovlen = 1;
+            pinged_host[n_datagrams] = i;
+            ++n_datagrams;
+        }
+
+        if(n_datagrams == 0){
+            break;
+        }
+
+        get_current_time_in_timespec(&send_time);
+
+        int sent = sendmmsg(scanner_socket, datagrams, n_datagrams, 0);
+        if(sent < 0){
+            mini_log(WARNING, "ping_hosts", -1, "sendmmsg returned -1");
+            return n_sent > 0 ? n_sent : -1;
+        }
+
+        for(int d=0; d < sent; ++d){
+            table->hosts[pinged_host[d]].ping_time = send_time;
+        }
+        n_sent += sent;
+    }
+
+    return n_sent;
+}
+
+/* Sends a probe from the scanner socket: the hosts answer to the address and port of that socket */
+bool send_discovery_probe(int scanner_socket){
+    struct sockaddr_in group_address;
+    memset((void *)&group_address, 0, sizeof(struct sockaddr_in));
+
+    group_address.sin_family = AF_INET;
+    group_address.sin_addr.s_addr = inet_addr(DISCOVERY_MULTICAST_GROUP);
+    group_address.sin_port = htons(DISCOVERY_PROBE_PORT);
+
+    discoveryMesssage probe;
+    prepare_discovery_message(&probe, 0);      /* a probe does not advertise a game */
+
+    if( sendto(scanner_socket, (const void*)&probe, sizeof(discoveryMesssage), 0, (struct sockaddr *)&group_address, sizeof(struct sockaddr_in)) < 0){
+        mini_log(WARNING, "send_discovery_probe", -1, "Unable to send the multicast probe");
+        return false;
+    }
+
+    return true;
+}
+
+/*  Answers a probe waiting on probe_socket by sending the advertisement to the guest that sent it, as long
+    as the probe: an older guest gets the advertisement without the load */
+void answer_probe(int probe_socket, int answer_socket, const discoveryMesssage* msg){
+    discoveryMesssage probe;
+    struct sockaddr_in guest_address;
+    socklen_t guest_address_size = sizeof(guest_address);
+
+    int n_byte_read = recvfrom(probe_socket, &probe, sizeof(probe), 0, (struct sockaddr *)&guest_address, &guest_address_size);
+    if((n_byte_read != sizeof(discoveryMesssage) && n_byte_read != DISCOVERY_LEGACY_SIZE) || probe.tcp_port != 0){
+        return;     /* not a probe */
+    }
+
+    if( sendto(answer_socket, (const void*)msg, n_byte_read, 0, (struct sockaddr *)&guest_address, sizeof(struct sockaddr_in)) < 0){
+        mini_log(WARNING, "discovery thread", -1, "Unable to answer a probe");
+    }
+}
+
+void* discovery(){
+
+    struct sockaddr_in broadcast_addresses[MAX_BROADCAST_ADDRESSES];
+    int n_broadcast_addresses;
 
     discoveryMesssage msg;
     prepare_discovery_message(&msg, tcp_port);
 
     int broadcast_socket;
+    int probe_socket;
+    int netlink_socket;
     
     broadcast_socket = create_broadcast_socket(DISCOVERY_PORT);
     if(broadcast_socket < 0){
@@ -78,7 +534,23 @@ void* discovery(){
         return NULL;
     }
 
-    // advertising packet in broadcast
+    probe_socket = create_probe_socket();       /* if it fails the host is still found through the beacon */
+    netlink_socket = create_netlink_socket();   /* if it fails the interfaces are only scanned once */
+
+    n_broadcast_addresses = scan_interfaces(broadcast_addresses, MAX_BROADCAST_ADDRESSES, probe_socket);
+
+    struct timespec next_beacon;
+    get_current_time_in_timespec(&next_beacon);
+
+    struct timespec next_load_refresh = next_beacon;
+
+    /*  probes are answered as they arrive, the advertising packet in broadcast is only a slow keep-alive,
+        sent on every interface at once. A change of the interfaces is notified by netlink. */
+    struct pollfd fds[2];
+    fds[0].fd = probe_socket;       /* poll ignores negative descriptors */
+    fds[0].events = POLLIN;
+    fds[1].fd = netlink_socket;
+    fds[1].events = POLLIN;
 
     while(1){
         pthread_mutex_lock(&keep_advertising_mutex);
@@ -86,21 +558,45 @@ void* discovery(){
         if(keep_advertising){
             pthread_mutex_unlock(&keep_advertising_mutex);
 
-            if( broadcast(broadcast_socket, &broadcast_address, &msg) < 0){
-                mini_log(ERROR, "discovery thread", -1, "Unable to send a discovery datagram");
-                close_socket(broadcast_socket);
-                return NULL;
+            if(ms_until(&next_beacon) == 0){
+                if( broadcast(broadcast_socket, broadcast_addresses, n_broadcast_addresses, &msg) < 0){
+                    /* e.g. an interface went down just now: netlink will trigger a rescan */
+                    mini_log(WARNING, "discovery thread", -1, "Unable to send the discovery datagrams");
+                }
+                //mini_log(LOG, "discovery thread", -1, "discovery datagrams sent");
+                get_absolute_time_with_offset(DISCOVERY_KEEPALIVE_INTERVAL, &next_beacon);
             }
-            else{   // No errors while broadcasting
-                //mini_log(LOG, "discovery thread", -1, "discovery datagram sent");
-                ms_sleep(500);
+
+            /* keep_advertising is checked at least every 250 ms */
+            int timeout = ms_until(&next_beacon) < 250 ? ms_until(&next_beacon) : 250;
+
+            if(poll(fds, 2, timeout) > 0){
+                if(fds[0].revents != 0){
+                    /* a burst of probes is answered with the same measure */
+                    if(ms_until(&next_load_refresh) == 0){
+                        refresh_load(&msg);
+                        get_absolute_time_with_offset(DISCOVERY_LOAD_REFRESH, &next_load_refresh);
+                    }
+                    answer_probe(probe_socket, broadcast_socket, &msg);
+                }
+                if(fds[1].revents != 0){
+                    drain_events(netlink_socket);
+                    n_broadcast_addresses = scan_interfaces(broadcast_addresses, MAX_BROADCAST_ADDRESSES, probe_socket);
+                    mini_log(LOG, "discovery thread", -1, "interfaces changed, broadcast addresses updated");
+                }
             }
         }
         else{   // Stop advertising
             pthread_mutex_unlock(&keep_advertising_mutex);
             close_socket(broadcast_socket);
+            if(probe_socket >= 0){
+                close_socket(probe_socket);
+            }
+            if(netlink_socket >= 0){
+                close_socket(netlink_socket);
+            }
             mini_log(LOG, "discovery thread", -1, "exiting");
             return NULL;
         }
     }
-}
\ No newline at end of file
+}
@@ -3,15 +3,74 @@
 
 #define DISCOVERY_PORT 49999
 
+/*  version written in the advertisements (the first version only had the broadcast beacon, the third adds the load,
+    the fourth the magic value) */
+#define DISCOVERY_VERSION 4
+
+/*  from version 4 the upper three bytes of the version word are the magic value ("TRI"), the lowest one the
+    version: the older versions only read the word as a number, and wrote numbers from 1 to 3 */
+#define DISCOVERY_MAGIC 0x54524900
+#define DISCOVERY_MAGIC_MASK 0xffffff00
+
+/* the socket filters see the datagrams from the udp header, the advertisement begins after it */
+#define DISCOVERY_UDP_HEADER_SIZE 8
+
+/* bytes of the advertisements and of the probes before version 3: version and tcp_port */
+#define DISCOVERY_LEGACY_SIZE (2 * sizeof(int))
+
+/* milliseconds between two measures of the load advertised by a host */
+#define DISCOVERY_LOAD_REFRESH 1000
+
+/* guests send a probe to this group, every host answers immediately by unicast */
+#define DISCOVERY_MULTICAST_GROUP "239.255.73.76"
+#define DISCOVERY_PROBE_PORT 49998
+
+/*  milliseconds between two broadcast advertisements. Guests running this version find the hosts with the
+    probe, the slow beacon is kept for the older versions, which scan for 4 seconds */
+#define DISCOVERY_KEEPALIVE_INTERVAL 3000
+
+/* maximum number of interfaces (subnets) the advertisement is broadcast on */
+#define MAX_BROADCAST_ADDRESSES 32
+
+/* advertisements read from the scanner socket with one recvmmsg */
+#define DISCOVERY_BATCH_SIZE 64
+
+/* milliseconds a guest waits for the answers to its probes (older hosts beacon every 500 ms) */
+#define DISCOVERY_SCAN_TIME 600
+
+/* milliseconds a guest waits for the answers to the pings sent to the hosts it found */
+#define DISCOVERY_PING_TIME 200
+
+#include <stdbool.h>
+
 #include "common.h"
+#include "hostTable.h"
 
+/*  The older versions read only the first DISCOVERY_LEGACY_SIZE bytes and drop longer datagrams: the beacon
+    and the answers to their probes are sent without the load */
 typedef struct discoveryMesssage{
     int version;
     int tcp_port;       // specifies the tcp port that guest can use to join a game
+    struct host_load load;
 } discoveryMesssage;
 
+/* fills the sessions of the host (the cpu load is measured by the discovery thread), NULL if not known */
+extern void (*advertised_load)(struct host_load* load);
+
 void* discovery();
 
 void prepare_discovery_message(discoveryMesssage* msg, int tcp_port);
 
+int cpu_load_percent();
+
+int advertisement_version(int version_word);
+
+int create_scanner_socket();
+
+bool send_discovery_probe(int scanner_socket);
+
+int receive_advertisements(int scanner_socket, struct host_table* table);
+
+int ping_hosts(int scanner_socket, struct host_table* table);
+
 #endif /* DISCOVERY_H */
\ No newline at end of file
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "discovery.h"
+#include "hostTable.h"
+
+/*  Benchmark of the discovery: a thread plays N hosts on the loopback interface, each one with its own address
+    (127.1.x.y, the whole 127.0.0.0/8 is local) and tcp port, answering the probes and the pings and sending the
+    8 byte beacon every DISCOVERY_KEEPALIVE_INTERVAL (spread over the interval). The scanner runs the same code
+    as the discovery leader (create_scanner_socket, the two probes, the pings at the end of DISCOVERY_SCAN_TIME)
+    and reads until it has every host or the timeout expires. For every N it measures the time to the first host
+    and to the last one, the hosts a scan would list, the datagrams sent to the scanner and dropped by its socket
+    (the drops column of /proc/net/udp) and the CPU time of the scanner thread.
+    No other TrisLAN process may run on the machine: the scanner port would be taken, and the pings could reach
+    a real host instead of the simulated ones.
+    Usage: tris_discobench [hosts ...]   (default 1 10 100 1000 10000) */
+
+/* hosts that can be simulated: the addresses are 127.1.0.1 - 127.1.199.250 */
+#define BENCH_MAX_HOSTS 50000
+#define BENCH_HOSTS_PER_SUBNET 250
+
+/* milliseconds the scanner waits for the hosts whose answers were lost: every host beacons once in the meantime */
+#define BENCH_TIMEOUT (DISCOVERY_SCAN_TIME + DISCOVERY_KEEPALIVE_INTERVAL + 1000)
+
+/* the first tcp port advertised, the host i advertises BENCH_FIRST_PORT + i % BENCH_HOSTS_PER_SUBNET */
+#define BENCH_FIRST_PORT 20000
+
+/* discovery.c reads these globals of the game */
+int tcp_port;
+bool keep_advertising;
+pthread_mutex_t keep_advertising_mutex = PTHREAD_MUTEX_INITIALIZER;
+void (*advertised_load)(struct host_load* load) = NULL;
+
+struct advertisers{
+    int n_hosts;
+    int probe_socket;                   /* receives the probes (multicast) and the pings (unicast) */
+    int send_socket;                    /* sends for every host, with the source address of the host */
+    long long datagrams_sent;           /* to the scanner */
+    volatile bool stop;
+    pthread_t tid;
+};
+
+static struct advertisers advertisers;
+
+static in_addr_t host_address(int host){
+    return htonl((127u << 24) | (1u << 16) | ((unsigned)(host / BENCH_HOSTS_PER_SUBNET) << 8) | (host % BENCH_HOSTS_PER_SUBNET + 1));
+}
+
+/* The simulated host of an address, -1 if it is not one */
+static int address_host(in_addr_t address){
+    unsigned int a = ntohl(address);
+    int host = ((a >> 8) & 0xff) * BENCH_HOSTS_PER_SUBNET + (int)(a & 0xff) - 1;
+
+    if((a >> 16) != ((127u << 8) | 1u) || (a & 0xff) == 0 || (a & 0xff) > BENCH_HOSTS_PER_SUBNET || host >= advertisers.n_hosts){
+        return -1;
+    }
+    return host;
+}
+
+static double ms_between(const struct timespec* from, const struct timespec* to){
+    return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1e6;
+}
+
+static long long thread_cpu_us(){
+    struct rusage usage;
+
+    getrusage(RUSAGE_THREAD, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/*  Sends the advertisement of the hosts from first to last (excluded) to the scanner, size bytes of it (the 8 byte
+    beacon or the 24 byte answer), DISCOVERY_BATCH_SIZE datagrams with one sendmmsg. Every datagram has the address
+    of its host as source (IP_PKTINFO) */
+static void advertise(int first, int last, const struct sockaddr_in* scanner, int size){
+    discoveryMesssage messages[DISCOVERY_BATCH_SIZE];
+    struct iovec payloads[DISCOVERY_BATCH_SIZE];
+    struct mmsghdr datagrams[DISCOVERY_BATCH_SIZE];
+    char controls[DISCOVERY_BATCH_SIZE][CMSG_SPACE(sizeof(struct in_pktinfo))];
+
+    while(first < last){
+        int n_datagrams = last - first < DISCOVERY_BATCH_SIZE ? last - first : DISCOVERY_BATCH_SIZE;
+
+        memset(datagrams, 0, sizeof(datagrams));
+        memset(controls, 0, sizeof(controls));
+        for(int i=0; i < n_datagrams; ++i){
+            int host = first + i;
+
+            prepare_discovery_message(&messages[i], BENCH_FIRST_PORT + host % BENCH_HOSTS_PER_SUBNET);
+            messages[i].load.free_slots = 1;
+            messages[i].load.active_games = 0;
+            messages[i].load.move_latency_p99 = -1;
+            messages[i].load.cpu_load = host % 100;
+
+            payloads[i].iov_base = &messages[i];
+            payloads[i].iov_len = size;
+
+            datagrams[i].msg_hdr.msg_name = (void*)scanner;
+            datagrams[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            datagrams[i].msg_hdr.msg_iov = &payloads[i];
+            datagrams[i].msg_hdr.msg_iovlen = 1;
+            datagrams[i].msg_hdr.msg_control = controls[i];
+            datagrams[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+
+            struct cmsghdr* control = CMSG_FIRSTHDR(&datagrams[i].msg_hdr);
+            control->cmsg_level = IPPROTO_IP;
+            control->cmsg_type = IP_PKTINFO;
+            control->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+            ((struct in_pktinfo*)CMSG_DATA(control))->ipi_spec_dst.s_addr = host_address(host);
+        }
+
+        int sent = sendmmsg(advertisers.send_socket, datagrams, n_datagrams, 0);
+        if(sent <= 0){
+            if(sent < 0 && errno != EAGAIN && errno != ENOBUFS){
+                perror("sendmmsg");
+            }
+            sent = n_datagrams;     /* the datagrams not sent are lost, as on a busy LAN */
+        }
+        else{
+            advertisers.datagrams_sent += sent;
+        }
+        first += sent;
+    }
+}
+
+/* Answers a probe: a multicast probe is answered by every host, a ping by the host it was sent to */
+static void answer_probes(){
+    discoveryMesssage probe;
+    struct sockaddr_in scanner;
+    char control[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    struct iovec payload = {&probe, sizeof(probe)};
+    struct msghdr datagram;
+    int n_byte_read;
+
+    while(1){
+        memset(&datagram, 0, sizeof(datagram));
+        datagram.msg_name = &scanner;
+        datagram.msg_namelen = sizeof(scanner);
+        datagram.msg_iov = &payload;
+        datagram.msg_iovlen = 1;
+        datagram.msg_control = control;
+        datagram.msg_controllen = sizeof(control);
+
+        n_byte_read = recvmsg(advertisers.probe_socket, &datagram, MSG_DONTWAIT);
+        if(n_byte_read < 0){
+            return;
+        }
+        if((n_byte_read != sizeof(discoveryMesssage) && n_byte_read != DISCOVERY_LEGACY_SIZE) || probe.tcp_port != 0){
+            continue;
+        }
+
+        in_addr_t destination = 0;
+        for(struct cmsghdr* c = CMSG_FIRSTHDR(&datagram); c != NULL; c = CMSG_NXTHDR(&datagram, c)){
+            if(c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO){
+                destination = ((struct in_pktinfo*)CMSG_DATA(c))->ipi_addr.s_addr;
+            }
+        }
+
+        if(IN_MULTICAST(ntohl(destination))){
+            advertise(0, advertisers.n_hosts, &scanner, n_byte_read);
+        }
+        else{
+            int host = address_host(destination);
+            if(host >= 0){
+                advertise(host, host + 1, &scanner, n_byte_read);
+            }
+        }
+    }
+}
+
+/* The thread of the simulated hosts: the beacons are spread evenly over DISCOVERY_KEEPALIVE_INTERVAL */
+static void* run_advertisers(void* arg){
+    struct sockaddr_in scanner;
+    struct pollfd probe = {advertisers.probe_socket, POLLIN, 0};
+    struct timespec start, now;
+    long long next_beacon = 0;          /* beacons sent since the start */
+    (void)arg;
+
+    memset(&scanner, 0, sizeof(scanner));
+    scanner.sin_family = AF_INET;
+    scanner.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    scanner.sin_port = htons(DISCOVERY_PORT);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while(!advertisers.stop){
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* the beacon i is due at i * interval / n_hosts ms: it is the beacon of the host i % n_hosts */
+        long long due = (long long)(ms_between(&start, &now) * advertisers.n_hosts / DISCOVERY_KEEPALIVE_INTERVAL) + 1;
+        while(next_beacon < due){
+            int first = next_beacon % advertisers.n_hosts;
+            int last = due - next_beacon < advertisers.n_hosts - first ? first + (int)(due - next_beacon) : advertisers.n_hosts;
+
+            advertise(first, last, &scanner, DISCOVERY_LEGACY_SIZE);
+            next_beacon += last - first;
+        }
+
+        int timeout = advertisers.n_hosts >= DISCOVERY_KEEPALIVE_INTERVAL ? 1 : DISCOVERY_KEEPALIVE_INTERVAL / advertisers.n_hosts;
+        if(poll(&probe, 1, timeout) > 0){
+            answer_probes();
+        }
+    }
+    return NULL;
+}
+
+static bool start_advertisers(int n_hosts){
+    int enable = 1;
+    struct sockaddr_in address;
+    struct ip_mreq membership;
+
+    memset(&advertisers, 0, sizeof(advertisers));
+    advertisers.n_hosts = n_hosts;
+
+    advertisers.probe_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    advertisers.send_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(advertisers.probe_socket < 0 || advertisers.send_socket < 0){
+        return false;
+    }
+
+    setsockopt(advertisers.probe_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(advertisers.probe_socket, IPPROTO_IP, IP_PKTINFO, &enable, sizeof(enable));
+
+    /*  the pings of the scanner reach one socket here instead of one on each host: without a larger buffer the
+        lost pings would be counted against the scanner (SO_RCVBUFFORCE goes over rmem_max, when allowed) */
+    int buffer_size = 8 << 20;
+    if(setsockopt(advertisers.probe_socket, SOL_SOCKET, SO_RCVBUFFORCE, &buffer_size, sizeof(buffer_size)) < 0){
+        setsockopt(advertisers.probe_socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(DISCOVERY_PROBE_PORT);
+    if(bind(advertisers.probe_socket, (struct sockaddr*)&address, sizeof(address)) < 0){
+        return false;
+    }
+
+    /* the same membership as the hosts (create_probe_socket): the probe leaves from the interface of the route */
+    membership.imr_multiaddr.s_addr = inet_addr(DISCOVERY_MULTICAST_GROUP);
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if(setsockopt(advertisers.probe_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0){
+        fprintf(stderr, "unable to join the multicast group: the hosts only answer the pings and beacon\n");
+    }
+
+    return pthread_create(&advertisers.tid, NULL, run_advertisers, NULL) == 0;
+}
+
+static void stop_advertisers(){
+    advertisers.stop = true;
+    pthread_join(advertisers.tid, NULL);
+    close(advertisers.probe_socket);
+    close(advertisers.send_socket);
+}
+
+/* The datagrams dropped by the socket bound to port, as counted by the kernel, -1 if they cannot be read */
+static long long socket_drops(int port){
+    FILE* udp = fopen("/proc/net/udp", "r");
+    char line[512];
+    long long drops = -1;
+
+    if(udp == NULL){
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), udp) != NULL){
+        unsigned int local_port;
+        long long line_drops;
+
+        /* sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode ref pointer drops */
+        if(sscanf(line, " %*d: %*x:%x %*x:%*x %*x %*x:%*x %*x:%*x %*x %*u %*d %*u %*d %*x %lld", &local_port, &line_drops) == 2 && (int)local_port == port){
+            drops = line_drops;
+        }
+    }
+
+    fclose(udp);
+    return drops;
+}
+
+/* Scans for n_hosts simulated hosts and prints the measures as a JSON object. Returns false if it cannot run */
+static bool bench_scan(int n_hosts, bool last){
+    struct host_table table;
+    struct timespec start, now, arrival, scan_end, first_host = {0, 0}, all_hosts = {0, 0};
+    int scanner_socket;
+    int found_in_scan = -1;
+    bool second_probe = false;
+    long long cpu_us;
+
+    if(!host_table_init(&table)){
+        return false;
+    }
+    if((scanner_socket = create_scanner_socket()) < 0){
+        fprintf(stderr, "unable to bind the scanner port %d: is another TrisLAN process running?\n", DISCOVERY_PORT);
+        host_table_destroy(&table);
+        return false;
+    }
+    if(!start_advertisers(n_hosts)){
+        fprintf(stderr, "unable to start the simulated hosts: is another TrisLAN process running?\n");
+        close(scanner_socket);
+        host_table_destroy(&table);
+        return false;
+    }
+
+    cpu_us = thread_cpu_us();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    now = start;
+
+    /* the first scan of the discovery leader: a probe, a second one after half the scan, the pings at its end */
+    send_discovery_probe(scanner_socket);
+
+    do{
+        struct pollfd scanner = {scanner_socket, POLLIN, 0};
+        double elapsed = ms_between(&start, &now);
+        double next = found_in_scan < 0 ? DISCOVERY_SCAN_TIME : DISCOVERY_SCAN_TIME + DISCOVERY_PING_TIME;
+
+        if(!second_probe){
+            next = DISCOVERY_SCAN_TIME / 2;
+        }
+        else if(found_in_scan >= 0 && ms_between(&scan_end, &now) >= DISCOVERY_PING_TIME){
+            next = BENCH_TIMEOUT;
+        }
+        poll(&scanner, 1, next > elapsed ? (int)(next - elapsed) + 1 : 0);
+        clock_gettime(CLOCK_MONOTONIC, &arrival);   /* of the first datagram waiting: the socket is drained after */
+        if(scanner.revents != 0 && receive_advertisements(scanner_socket, &table) > 0){
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if(first_host.tv_sec == 0){
+                first_host = arrival;
+            }
+            if(table.n_hosts == n_hosts){
+                all_hosts = now;
+            }
+            if(found_in_scan >= 0){
+                ping_hosts(scanner_socket, &table);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(!second_probe && ms_between(&start, &now) >= DISCOVERY_SCAN_TIME / 2){
+            send_discovery_probe(scanner_socket);
+            second_probe = true;
+        }
+        if(found_in_scan < 0 && ms_between(&start, &now) >= DISCOVERY_SCAN_TIME){
+            found_in_scan = table.n_hosts;
+            scan_end = now;
+            ping_hosts(scanner_socket, &table);
+        }
+    }while((table.n_hosts < n_hosts || found_in_scan < 0 || ms_between(&scan_end, &now) < DISCOVERY_PING_TIME) && ms_between(&start, &now) < BENCH_TIMEOUT);
+
+    cpu_us = thread_cpu_us() - cpu_us;
+    stop_advertisers();
+
+    int n_answered = 0;
+    for(int i=0; i < table.n_hosts; ++i){
+        if(table.hosts[i].rtt >= 0){
+            ++n_answered;
+        }
+    }
+    long long drops = socket_drops(DISCOVERY_PORT);
+
+    printf("    {\"hosts\": %d, \"found\": %d, \"found_in_scan\": %d, \"pings_answered\": %d, ", n_hosts, table.n_hosts, found_in_scan, n_answered);
+    printf("\"first_host_ms\": %.3f, \"all_hosts_ms\": %.3f, ", first_host.tv_sec != 0 ? ms_between(&start, &first_host) : -1.0,
+        all_hosts.tv_sec != 0 ? ms_between(&start, &all_hosts) : -1.0);
+    printf("\"datagrams_sent\": %lld, \"datagrams_dropped\": %lld, \"loss\": %.4f, \"scanner_cpu_ms\": %.3f}%s\n",
+        advertisers.datagrams_sent, drops, drops >= 0 && advertisers.datagrams_sent > 0 ? (double)drops / advertisers.datagrams_sent : 0.0,
+        cpu_us / 1000.0, last ? "" : ",");
+    fflush(stdout);
+
+    close(scanner_socket);
+    host_table_destroy(&table);
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    static const int default_hosts[] = {1, 10, 100, 1000, 10000};
+    int n_runs = argc > 1 ? argc - 1 : (int)(sizeof(default_hosts) / sizeof(default_hosts[0]));
+    int hosts[n_runs];
+
+    for(int i=0; i < n_runs; ++i){
+        hosts[i] = argc > 1 ? atoi(argv[i + 1]) : default_hosts[i];
+        if(hosts[i] < 1 || hosts[i] > BENCH_MAX_HOSTS){
+            fprintf(stderr, "Usage: %s [hosts ...]   (from 1 to %d hosts, default 1 10 100 1000 10000)\n", argv[0], BENCH_MAX_HOSTS);
+            return 2;
+        }
+    }
+
+    printf("{\n  \"scan_time_ms\": %d,\n  \"runs\": [\n", DISCOVERY_SCAN_TIME);
+    for(int i=0; i < n_runs; ++i){
+        if(!bench_scan(hosts[i], i == n_runs - 1)){
+            return 1;
+        }
+    }
+    printf("  ]\n}\n");
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include "eventLoop.h"
+#include "clock.h"
+#include "minilogger.h"
+#include "common.h"
+
+/* Bytes read from the terminal that do not form a complete line yet */
+static char input_buffer[4 * INPUT_LINE_SIZE];
+static int input_buffer_size = 0;
+static bool input_closed = false;
+
+/* If the input buffer contains a full line, moves it (without the '\n') in line and returns true */
+static bool extract_line(char* line, int line_size){
+    char* newline = memchr(input_buffer, '\n', input_buffer_size);
+    int line_length, consumed;
+
+    if(newline != NULL){
+        line_length = newline - input_buffer;
+    }
+    else if(input_buffer_size == (int)sizeof(input_buffer)){
+        /* the buffer is full but there is no newline: the line is too long, cut it at the end of the buffer */
+        line_length = input_buffer_size;
+    }
+    else{
+        return false;
+    }
+
+    int copied = line_length < line_size - 1 ? line_length : line_size - 1;
+
+    memcpy(line, input_buffer, copied);
+    line[copied] = '\0';
+
+    /* a line cut without newline only consumes the bytes returned, the rest begins the next line */
+    consumed = newline != NULL ? line_length + 1 : (copied > 0 ? copied : line_length);
+    input_buffer_size -= consumed;
+    memmove(input_buffer, &input_buffer[consumed], input_buffer_size);
+
+    return true;
+}
+
+/* Reads whatever is available on the terminal without blocking (the caller knows it is readable) */
+static void read_terminal(){
+    int n_byte_read = read(STDIN_FILENO, &input_buffer[input_buffer_size], sizeof(input_buffer) - input_buffer_size);
+
+    if(n_byte_read > 0){
+        input_buffer_size += n_byte_read;
+    }
+    else if(n_byte_read == 0 || (errno != EINTR && errno != EAGAIN)){
+        input_closed = true;
+    }
+}
+
+/*  Waits until the terminal has a full line, fd (if >= 0) becomes readable or timeout_ms milliseconds
+    have passed (a negative timeout means no timeout). If line is NULL the terminal is not watched.
+    The line is returned without the trailing '\n'. */
+enum event wait_for_event(int fd, int timeout_ms, char* line, int line_size){
+    struct pollfd fds[2];
+    int n_fds = 0;
+    int input_index = -1;
+    int fd_index = -1;
+
+    if(line != NULL && line_size > 0){
+        if(extract_line(line, line_size)){
+            return EVENT_INPUT;
+        }
+        if(input_closed){
+            return EVENT_INPUT_CLOSED;
+        }
+
+        fds[n_fds].fd = STDIN_FILENO;
+        fds[n_fds].events = POLLIN;
+        input_index = n_fds++;
+    }
+
+    if(fd >= 0){
+        fds[n_fds].fd = fd;
+        fds[n_fds].events = POLLIN;
+        fd_index = n_fds++;
+    }
+
+    struct timespec deadline;
+    if(timeout_ms >= 0){
+        get_absolute_time_with_offset(timeout_ms, &deadline);
+    }
+
+    while(1){
+        int ready = clock_poll(fds, n_fds, timeout_ms);
+        if(ready < 0){
+            if(errno == EINTR){
+                return EVENT_INTERRUPTED;
+            }
+            mini_log(ERROR, "wait_for_event", -1, "poll returned -1");
+            return EVENT_ERROR;
+        }
+        else if(ready == 0){
+            return EVENT_TIMEOUT;
+        }
+
+        /* network events are served first, a peer disconnection must not wait for the user */
+        if(fd_index >= 0 && fds[fd_index].revents != 0){
+            return EVENT_READABLE;
+        }
+
+        if(input_index >= 0 && fds[input_index].revents != 0){
+            read_terminal();
+
+            if(extract_line(line, line_size)){
+                return EVENT_INPUT;
+            }
+            if(input_closed){
+                return EVENT_INPUT_CLOSED;
+            }
+        }
+
+        /* only a part of a line was typed, keep waiting for the rest until the deadline */
+        if(timeout_ms >= 0){
+            timeout_ms = ms_until(&deadline);
+        }
+    }
+}
+
+/* Blocks until the user writes a full line. Returns false if the terminal input was closed */
+bool read_input_line(char* line, int line_size){
+    enum event event;
+
+    do{
+        event = wait_for_event(-1, -1, line, line_size);
+    }while(event == EVENT_INTERRUPTED);
+
+    return event == EVENT_INPUT;
+}
+
+/* Returns true if line contains only an integer (surrounding spaces are allowed) */
+bool parse_int(const char* line, int* value){
+    if(line == NULL || value == NULL){
+        return false;
+    }
+
+    char* end;
+    long result = strtol(line, &end, 10);
+
+    if(end == line){
+        return false;
+    }
+    while(*end == ' ' || *end == '\t' || *end == '\r'){
+        ++end;
+    }
+    if(*end != '\0'){
+        return false;
+    }
+
+    *value = (int)result;
+    return true;
+}
+
+/* Creates a non blocking pipe used only to wake up a thread waiting in wait_for_event */
+bool create_event_pipe(int event_pipe[2]){
+    if(pipe2(event_pipe, O_NONBLOCK | O_CLOEXEC) < 0){
+        mini_log(ERROR, "create_event_pipe", -1, "Unable to create the pipe");
+        event_pipe[0] = -1;
+        event_pipe[1] = -1;
+        return false;
+    }
+
+    return true;
+}
+
+void close_event_pipe(int event_pipe[2]){
+    if(event_pipe[0] >= 0){
+        close(event_pipe[0]);
+        close(event_pipe[1]);
+    }
+    event_pipe[0] = -1;
+    event_pipe[1] = -1;
+}
+
+/* Wakes up whoever is waiting on the read end of the pipe whose write end is fd */
+void notify_event(int fd){
+    char event = 1;
+
+    if(fd >= 0 && write(fd, &event, 1) < 0 && errno != EAGAIN){
+        mini_log(ERROR, "notify_event", -1, "Unable to write on the event pipe");
+    }
+}
+
+/* Consumes every pending notification on the (non blocking) read end of an event pipe */
+void drain_events(int fd){
+    char events[64];
+
+    while(read(fd, events, sizeof(events)) > 0);
+}
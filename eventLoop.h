@@ -0,0 +1,34 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+/* maximum length of a line typed by the user (longer lines are truncated) */
+#define INPUT_LINE_SIZE 64
+
+#include <stdbool.h>
+
+#include "common.h"
+
+enum event{
+    EVENT_TIMEOUT,          /* nothing happened before the timeout expired */
+    EVENT_INPUT,            /* a full line was read from the terminal */
+    EVENT_READABLE,         /* the watched file descriptor can be read without blocking */
+    EVENT_INTERRUPTED,      /* the wait was interrupted by a signal */
+    EVENT_INPUT_CLOSED,     /* the terminal input reached EOF */
+    EVENT_ERROR
+};
+
+enum event wait_for_event(int fd, int timeout_ms, char* line, int line_size);
+
+bool read_input_line(char* line, int line_size);
+
+bool parse_int(const char* line, int* value);
+
+bool create_event_pipe(int event_pipe[2]);
+
+void close_event_pipe(int event_pipe[2]);
+
+void notify_event(int fd);
+
+void drain_events(int fd);
+
+#endif /* EVENTLOOP_H */
@@ -0,0 +1,21 @@
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stdbool.h>
+
+#include "stateMachine.h"
+
+/*  The local player of game(): the user at the terminal or a headless player (see headless.c). game() sends
+    the messages and keeps the turn deadlines, the frontend shows the game and chooses the moves. */
+struct game_frontend{
+    struct session_ops ops;                                     /* send is not used, draw_offered is optional */
+    void (*start)(struct session* session);                     /* the connection is ready: the host has to call session_open */
+    void (*input)(struct session* session, const char* line);   /* a line read from stdin, NULL if stdin is not read */
+    void (*timeout)(struct session* session);                   /* the turn deadline has expired, NULL to leave the game */
+    void (*disconnected)(struct session* session);              /* the connection broke and the game cannot go on */
+    bool resumable;                                             /* the game can be resumed after a disconnection */
+};
+
+extern const struct game_frontend terminal_frontend;
+
+#endif /* FRONTEND_H */
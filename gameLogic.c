@@ -1,65 +1,104 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 #include "minilogger.h"
+#include "capture.h"
 #include "common.h"
 #include "gameLogic.h"
 #include "protocol.h"
 #include "communication.h"
+#include "eventLoop.h"
+#include "stateMachine.h"
+#include "resume.h"
+#include "server.h"
+#include "tablebase.h"
+#include "render.h"
+#include "frontend.h"
 
 struct conn_status conn_status;
 pthread_mutex_t conn_status_mutex;
 
-struct message message_queue_in[MESSAGE_QUEUE_SIZE];
-int message_queue_in_curr_size;
-pthread_mutex_t message_queue_in_mutex;
+struct message_queue message_queue_in;
+struct message_queue message_queue_out;
 
-struct message message_queue_out[MESSAGE_QUEUE_SIZE];
-int message_queue_out_curr_size;
-pthread_mutex_t message_queue_out_mutex;
+extern int connection_manager_socket;
+
+/* what the game is waiting for from the local player */
+enum awaited_input{
+    AWAIT_NOTHING,
+    AWAIT_FIRST_TURN_CHOICE,
+    AWAIT_MOVE,
+    AWAIT_DRAW_ANSWER,
+    AWAIT_REMATCH
+};
+
+static enum awaited_input awaited_input;
+static const struct game_frontend* frontend;
+static struct timespec turn_deadline;
 
-static int game_field[9];
 static char game_symbols[2] = {'x', 'o'};
-static const int check_victory_patterns[8][3] = 
+/* the lines through each cell (0-2 are the rows, 3-5 the columns, 6 and 7 the diagonals), -1 ends the list */
+static const int cell_lines[9][5] =
 {
-    {0, 1, 2},
-    {3, 4, 5},
-    {6, 7, 8},
-    {0, 3, 6},
-    {1, 4, 7},
-    {2, 5 ,8},
-    {0, 4, 8},
-    {2, 4, 6}
+    {0, 3, 6, -1},
+    {0, 4, -1},
+    {0, 5, 7, -1},
+    {1, 3, -1},
+    {1, 4, 6, 7, -1},
+    {1, 5, -1},
+    {2, 3, 7, -1},
+    {2, 4, -1},
+    {2, 5, 6, -1}
 };
 
-/* Returns the number of the winner (1=HOST 2=GUEST) or 0 if no one has won */
-int check_victory(){
-    int aux;
+void clear_board(struct board* board){
+    memset(board, 0, sizeof(struct board));
 
-    for(int i=0; i < 8; ++i){
-        aux = game_field[check_victory_patterns[i][0]];
-    
-        if(aux == game_field[check_victory_patterns[i][1]] && aux == game_field[check_victory_patterns[i][2]]){
-            return aux;
-        }
-    }
+    board->open_lines[0][0] = 8;
+    board->open_lines[1][0] = 8;
+}
 
-    return 0;
+/* Returns the number of the winner (1=HOST 2=GUEST) or 0 if no one has won */
+int check_victory(const struct board* board){
+    return board->winner;
 }
 
 /* Return true if there are no free cells remaining */
-bool check_field_full(){
-    for(int i=0; i < 9; ++i){
-        if(game_field[i] == 0)
-            return false;
+bool check_field_full(const struct board* board){
+    return board->n_symbols[0] + board->n_symbols[1] == 9;
+}
+
+/* Returns true if the player (0 or 1) can still complete a line with the moves left to it */
+static bool can_still_win(const struct board* board, int player){
+    int n_free = 9 - board->n_symbols[0] - board->n_symbols[1];
+    int n_moves = (n_free + 1) / 2;
+    int most = 3;
+
+    /*  the player with fewer symbols moves next. With as many symbols as the other one it may move next
+        or not, it depends on who moved first: it is given the move, so a game that is not over is never ended */
+    if(board->n_symbols[player] > board->n_symbols[1 - player]){
+        n_moves = n_free / 2;
     }
-    
-    return true;
+
+    while(most >= 0 && board->open_lines[player][most] == 0){
+        --most;
+    }
+    return most >= 0 && 3 - most <= n_moves;
+}
+
+/*  Returns true if the game can only end in a draw: no one has won and neither player can complete a line anymore,
+    whatever it plays (a full game field is the last case) */
+bool check_draw(const struct board* board){
+    return board->winner == 0 && !can_still_win(board, 0) && !can_still_win(board, 1);
 }
 
-void print_game_field(){
+void print_game_field(const struct board* board){
     printf("\n");
     
     for(int offset=0; offset < 3; ++offset){
@@ -67,11 +106,11 @@ void print_game_field(){
 
         printf("\t\t");
         for(int i=0; i < 3; ++i){
-            if(game_field[(offset * 3) + i] == 0){
+            if(board->cells[(offset * 3) + i] == 0){
                 printf("|   ");
             }
             else{
-                printf("| %c ", game_symbols[game_field[(offset * 3) + i]-1]);
+                printf("| %c ", game_symbols[board->cells[(offset * 3) + i]-1]);
             }
         }
         printf("|\n");
@@ -80,18 +119,39 @@ void print_game_field(){
     printf("\t\t+---+---+---+\n");
 }
 
-bool can_place_symbol(int pos){
+bool can_place_symbol(const struct board* board, int pos){
     if (pos < 0 || pos > 8){
         return false;
     }
     else{
-        return game_field[pos] == 0;
+        return board->cells[pos] == 0;
     }
 }
 
-bool place_symbol(int pos, int symbol){
-    if(can_place_symbol(pos) && symbol >= 1 && symbol <= 2){
-        game_field[pos] = symbol;
+bool place_symbol(struct board* board, int pos, int symbol){
+    if(can_place_symbol(board, pos) && symbol >= 1 && symbol <= 2){
+        int player = symbol - 1;
+        int other = 1 - player;
+
+        board->cells[pos] = symbol;
+        ++board->n_symbols[player];
+
+        for(const int* line = cell_lines[pos]; *line >= 0; ++line){
+            int own = board->line_symbols[player][*line]++;
+
+            if(board->line_symbols[other][*line] == 0){
+                --board->open_lines[player][own];
+                ++board->open_lines[player][own + 1];
+
+                if(own + 1 == 3 && board->winner == 0){
+                    board->winner = symbol;
+                }
+            }
+            if(own == 0){
+                /* the line had no symbol of this player: the other one cannot complete it anymore */
+                --board->open_lines[other][board->line_symbols[other][*line]];
+            }
+        }
         return true;
     }
     else{
@@ -99,65 +159,82 @@ bool place_symbol(int pos, int symbol){
     }
 }
 
-/* Pops the first message from the incoming messages queue and puts the message in msg */
-bool get_incoming_message(struct message* msg){
-    if(msg == NULL){
-        mini_log(ERROR, "get_incoming_message", -1, "Incorrect parameter");
-        return false;
+/* The game field as a base 3 number: cell i is the digit of weight 3^i */
+int board_to_index(const struct board* board){
+    int index = 0;
+
+    for(int pos=8; pos >= 0; --pos){
+        index = index * 3 + board->cells[pos];
     }
+    return index;
+}
 
-    pthread_mutex_lock(&message_queue_in_mutex);
-    
-    if(message_queue_in_curr_size > 0){
-        copy_message(msg, &message_queue_in[0]);
-        
-        --message_queue_in_curr_size;
+/* Rebuilds the game field from board_to_index. Returns false if index is not valid */
+bool board_from_index(struct board* board, int index){
+    if(index < 0 || index >= BOARD_INDEX_COUNT){
+        return false;
+    }
 
-        if(message_queue_out_curr_size == 1){
-            copy_message(&message_queue_in[0], &message_queue_in[1]);
+    clear_board(board);
+    for(int pos=0; pos < 9; ++pos){
+        if(index % 3 != 0){
+            place_symbol(board, pos, index % 3);
         }
+        index /= 3;
+    }
+    return true;
+}
 
-        pthread_mutex_unlock(&message_queue_in_mutex);    
-        return true;
+/* The result of the game for the player with symbol, who has to move, if both players play perfectly from here */
+enum tablebase_value position_value(const struct board* board, int symbol){
+    if(symbol != HOST && symbol != GUEST){
+        return TABLEBASE_ILLEGAL;
+    }
+    return TABLEBASE_VALUE(tablebase[symbol - 1][board_to_index(board)]);
+}
+
+/* The best moves of the player with symbol (bit i set for cell i, from 0 to 8), 0 if the game is over */
+int best_moves(const struct board* board, int symbol){
+    if(symbol != HOST && symbol != GUEST){
+        return 0;
+    }
+    return TABLEBASE_MOVES(tablebase[symbol - 1][board_to_index(board)]);
+}
+
+/*  Chooses the move of a computer player with symbol: a perfect player, that reads its move from the
+    tablebase (among the best moves it prefers the center, then the corners). If the game field cannot be
+    reached in a game, the first free cell in the same order is chosen. Returns a cell from 1 to 9, or -1 if the board is full. */
+int choose_bot_move(const struct board* board, int symbol){
+    static const int preferred_cells[9] = {4, 0, 2, 6, 8, 1, 3, 5, 7};
+    int moves = best_moves(board, symbol);
+
+    for(int i=0; i < 9; ++i){
+        if(moves & (1 << preferred_cells[i])){
+            return preferred_cells[i] + 1;
+        }
     }
 
-    pthread_mutex_unlock(&message_queue_in_mutex);
-    return false;
+    for(int i=0; i < 9; ++i){
+        if(can_place_symbol(board, preferred_cells[i])){
+            return preferred_cells[i] + 1;
+        }
+    }
+    return -1;
 }
 
-/* Inserts msg at the of the outgoing messages queue */
+/* Inserts msg at the end of the outgoing messages queue */
 bool send_message(struct message* msg){
     if(msg == NULL){
         mini_log(ERROR, "send_message", -1, "Incorrect parameter");
         return false;
     }
 
-    pthread_mutex_lock(&message_queue_out_mutex);
-
-    if(message_queue_out_curr_size >= MESSAGE_QUEUE_SIZE){
+    if(!queue_push(&message_queue_out, msg)){
         mini_log(ERROR, "send_message", -1, "The message queue is full!");
-        pthread_mutex_unlock(&message_queue_out_mutex);
         return false;
     }
-    else{
-        copy_message(&message_queue_out[message_queue_out_curr_size], msg);
-        ++message_queue_out_curr_size;
-        pthread_mutex_unlock(&message_queue_out_mutex);
-        return true;
-    }
-}
-
-/* Puts the specified values in the msg pointed by msg */
-void prepare_message(struct message* msg, enum comm comm, int n_args, int arg1, int arg2){
-    if(msg == NULL){
-        mini_log(ERROR, "prepare_message", -1, "Invalid parameter!");
-        return;
-    }
 
-    msg->communication = comm;
-    msg->n_args = n_args;
-    msg->arg1 = arg1;
-    msg->arg2 = arg2;
+    return true;
 }
 
 void reset_conn_status(){   // doesn't need synchronization
@@ -177,443 +254,603 @@ bool should_terminate(){
     return res;
 }
 
-/* Main gameloop function */
-void game(struct gameState* game_state){
+/* Asks the connection manager to deliver the pending messages and close the connection */
+void request_termination(){
+    pthread_mutex_lock(&conn_status_mutex);
+    conn_status.terminated_by_game = true;
+    pthread_mutex_unlock(&conn_status_mutex);
 
-    /* set up */
-    reset_conn_status();
+    queue_notify(&message_queue_out);
+}
 
-    message_queue_in_curr_size = 0;
-    message_queue_out_curr_size = 0;
+void print_move_prompt(const struct session* session){
+    printf("\n\tWrite a number from 1 to 9 to place your symbol on the corresponding cell\n");
+    if(session_can_offer_draw(session)){
+        printf("\tWith perfect play this game can only end in a draw: insert d to offer a draw to the other player\n");
+    }
+    printf("\tYou can also insert h for a hint, or 0 to leave the game (%d seconds left):", ms_until(&turn_deadline) / 1000);
+    fflush(stdout);
+}
 
-    for(int i=0; i < 9; ++i){
-        game_field[i] = 0;
+/* Shows the best moves of the local player and how the game ends if both players play perfectly */
+void print_hint(const struct session* session){
+    static const char* const results[] = {
+        [TABLEBASE_WIN] = "you can win",
+        [TABLEBASE_DRAW] = "the game ends in a draw",
+        [TABLEBASE_LOSS] = "you lose"
+    };
+    enum tablebase_value value = position_value(&session->board, session->state.role);
+    int moves = best_moves(&session->board, session->state.role);
+
+    if(value == TABLEBASE_ILLEGAL || moves == 0){
+        printf("\n\tNo hint is available for this game field.\n");
+        return;
     }
 
-    struct message rcv_msg;
-    struct message snd_msg;
+    printf("\n\tHint: the best cells are");
+    for(int pos=0; pos < 9; ++pos){
+        if(moves & (1 << pos)){
+            printf(" %d", pos + 1);
+        }
+    }
+    printf(" (with perfect play %s).\n", results[value]);
+}
 
-    pthread_t communication_thread_tid;
-    pthread_attr_t communication_thread_attr;
+void print_first_turn_question(){
+    printf("\n\tChoose the player that will play first:\n");
+    printf("\t1. You\n");
+    printf("\t2. Your opponent\n");
+    fflush(stdout);
+}
 
-    pthread_attr_init(&communication_thread_attr);
-    pthread_attr_setdetachstate(&communication_thread_attr, PTHREAD_CREATE_JOINABLE);
+/* --- session callbacks of game(): messages go to the connection manager, the rest goes to the frontend --- */
 
-    if(pthread_create(&communication_thread_tid, NULL, connection_manager, NULL) < 0){
-        mini_log(ERROR, "game", -1, "Unable to create the connection manager thread");
-        pthread_attr_destroy(&communication_thread_attr);
+static void network_send(struct session* session, struct message* msg){
+    (void)session;
+    send_message(msg);
+}
 
+/* The local player has TURN_TIMEOUT ms to move */
+static void game_local_turn(struct session* session){
+    get_absolute_time_with_offset(TURN_TIMEOUT, &turn_deadline);
+    frontend->ops.local_turn(session);
+}
+
+/*  The local player has to wait for the other peer, who has TURN_TIMEOUT ms to answer
+    (HANDSHAKE_TIMEOUT for the answer to the WELCOME, so a connection that is not a guest does not hold the host) */
+static void game_remote_turn(struct session* session){
+    if(session->state.phase == OPEN_CONNECTION){
+        get_absolute_time_with_offset(HANDSHAKE_TIMEOUT, &turn_deadline);
+    }
+    else{
+        get_absolute_time_with_offset(TURN_TIMEOUT + TURN_TIMEOUT_MARGIN, &turn_deadline);
+    }
+    frontend->ops.remote_turn(session);
+}
+
+/* The other player offers a draw: the local player has TURN_TIMEOUT ms to answer (a frontend that does not ask accepts) */
+static void game_draw_offered(struct session* session){
+    get_absolute_time_with_offset(TURN_TIMEOUT, &turn_deadline);
+
+    if(frontend->ops.draw_offered != NULL){
+        frontend->ops.draw_offered(session);
+    }
+    else{
+        session_answer_draw(session, true);
+    }
+}
+
+/*  The frontend shows the result, then the connection is closed (the last OK has already been queued, if needed).
+    After a game with a result the connection stays open for REMATCH_TIMEOUT ms if the frontend can play again. */
+static void game_finished(struct session* session, enum outcome outcome){
+    frontend->ops.finished(session, outcome);
+
+    if(outcome == OUTCOME_PEER_LEFT){
         pthread_mutex_lock(&conn_status_mutex);
-        conn_status.terminated_by_game = true;
-        pthread_mutex_lock(&conn_status_mutex);
+        conn_status.terminated_by_other_peer = true;
+        pthread_mutex_unlock(&conn_status_mutex);
+        queue_notify(&message_queue_out);
+    }
+    else if(frontend->ops.rematch != NULL && session_can_rematch(session)){
+        get_absolute_time_with_offset(REMATCH_TIMEOUT, &turn_deadline);
+    }
+    else{
+        request_termination();
+    }
+}
 
-        return;
+/* The other player asked for a rematch or declined it */
+static void game_rematch(struct session* session){
+    if(frontend->ops.rematch != NULL){
+        frontend->ops.rematch(session);
     }
     else{
-        mini_log(LOG, "game", -1, "Connection manager thread created successfully");
+        session_leave(session);
     }
-    
-    bool message_available = false;
-    
-    int first_turn = HOST;
+}
 
-    if(game_state->role == HOST){
-        do{
-            printf("\n\tChoose the player that will play first:\n");
-            printf("\t1. You\n");
-            printf("\t2. Your opponent\n");
+/* A rematch begins on the same connection: the deadline is set again by the first turn */
+static void game_restarted(struct session* session){
+    if(frontend->ops.restarted != NULL){
+        frontend->ops.restarted(session);
+    }
+}
+
+static const struct session_ops game_session_ops = {
+    .send = network_send,
+    .local_turn = game_local_turn,
+    .remote_turn = game_remote_turn,
+    .finished = game_finished,
+    .draw_offered = game_draw_offered,
+    .rematch = game_rematch,
+    .restarted = game_restarted
+};
 
-            scanf("%d", &first_turn);
+/* --- the terminal frontend: the moves come from the user --- */
 
-            clean_console();
-            
-            if(first_turn != 1 && first_turn != 2){
-                printf("\n\tPlease, choose again\n");
-            }
-        }while(first_turn != 1 && first_turn != 2);
+/* The host chooses who plays first, the guest waits for the choice */
+static void terminal_start(struct session* session){
+    if(session->state.role == HOST){
+        print_first_turn_question();
+        awaited_input = AWAIT_FIRST_TURN_CHOICE;
     }
     else{
         printf("\n\tWaiting for the host's choice...\n");
+        fflush(stdout);
+        awaited_input = AWAIT_NOTHING;
     }
+}
 
-    /* Starting the game protocol */
-    if(game_state->role == HOST){
-        prepare_message(&snd_msg, WELCOME, 1, first_turn, 0);
-        send_message(&snd_msg);
+static void terminal_local_turn(struct session* session){
+    awaited_input = AWAIT_MOVE;
 
-        mini_log(LOG, "game", -1, "Host: sent WELCOME message");
+    render_game_field(&session->board);
+    if(session->draw_offer == DRAW_OFFER_REFUSED){
+        printf("\n\tThe other player has refused the draw.\n");
+    }
+    print_move_prompt(session);
+}
 
-        game_state->phase = OPEN_CONNECTION;
-        game_state->last_comm = WELCOME;
+static void terminal_remote_turn(struct session* session){
+    awaited_input = AWAIT_NOTHING;
 
-        do{
-            pthread_mutex_lock(&message_queue_in_mutex);
-            if(message_queue_in_curr_size > 0){
-                message_available = true;
-            }
-            pthread_mutex_unlock(&message_queue_in_mutex);
-            ms_sleep(500);
-        }while(message_available == false && should_terminate() == false);
+    if(session->draw_offer == DRAW_OFFER_SENT){
+        printf("\n\tWaiting for the other player to answer the draw offer...\n");
+    }
+    else if(session->state.phase == GAME_TURN_HOST || session->state.phase == GAME_TURN_GUEST){
+        render_game_field(&session->board);
+        printf("\n\tWaiting for the other player's move...\n");
+    }
+}
+
+/* The other player offers a draw: if the user does not answer in time, the offer is refused */
+static void terminal_draw_offered(struct session* session){
+    (void)session;
+    awaited_input = AWAIT_DRAW_ANSWER;
 
-        if(!should_terminate()){
+    printf("\n\tThe other player offers a draw: with perfect play this game can only end in a draw.\n");
+    printf("\tInsert y to accept or n to refuse:");
+    fflush(stdout);
+}
 
-            get_incoming_message(&rcv_msg);
-            mini_log(LOG, "game", -1, "Host: received first message");
+/* Shows the result */
+static void terminal_finished(struct session* session, enum outcome outcome){
+    awaited_input = AWAIT_NOTHING;
 
-            if(rcv_msg.communication != OK){
-                mini_log(ERROR, "game", __LINE__, "HOST OPENING SEQUENCE FAILED");
+    switch(outcome){
+        case OUTCOME_HOST_WON:
+        case OUTCOME_GUEST_WON:
+        case OUTCOME_DRAW:
+            render_game_field(&session->board);
 
-                pthread_mutex_lock(&conn_status_mutex);
-                conn_status.terminated_by_game = true;
-                pthread_mutex_unlock(&conn_status_mutex);
+            if(outcome == OUTCOME_DRAW){
+                printf("\n\n\tIt's a draw!\n");
+            }
+            else if((int)outcome == (int)session->state.role){
+                printf("\n\n\tY O U  H A V E  W O N  !!\n");
             }
             else{
-                if(first_turn == HOST)
-                    game_state->phase = GAME_TURN_HOST;
-                else
-                    game_state->phase = GAME_TURN_GUEST;
-                game_state->last_comm = WELCOME;
+                printf("\n\n\tYou have LOST.\n");
             }
-        }
-        else{
-            mini_log(ERROR, "game", __LINE__, "HOST OPENING SEQUENCE FAILED (connection_manager terminated)");
-        }
+
+            if(!session_can_rematch(session)){
+                /* an older peer cannot play again on the same connection */
+                printf("\n\tPress ENTER to continue...\n");
+                wait_for_any_key_press();
+                session_leave(session);
+                break;
+            }
+
+            printf("\n\tInsert r to play again with the same player, or press ENTER to go back to the menu:");
+            awaited_input = AWAIT_REMATCH;
+        break;
+        case OUTCOME_PEER_LEFT:
+            printf("\n\n\tThe other player has left the game.\n");
+        break;
+        case OUTCOME_PROTOCOL_ERROR:
+            printf("\n\n\tThe game was interrupted: the two players are not synchronized.\n");
+        break;
+        default:
+        break;
     }
-    else{
-        mini_log(LOG, "game", -1, "Guest: waiting for WELCOME");
+}
+
+/* The other player wants to play again, or has left */
+static void terminal_rematch(struct session* session){
+    if(session->rematch == REMATCH_RECEIVED){
+        printf("\n\n\tThe other player wants to play again: insert r to accept, or press ENTER to go back to the menu:");
+        fflush(stdout);
+        return;
+    }
+
+    awaited_input = AWAIT_NOTHING;
+    printf("\n\n\tThe other player does not want to play again.\n");
+    printf("\n\tPress ENTER to continue...\n");
+    wait_for_any_key_press();
+}
+
+static void terminal_restarted(struct session* session){
+    (void)session;
+    awaited_input = AWAIT_NOTHING;
+    printf("\n\n\tA new game begins!\n");
+    fflush(stdout);
+}
 
-        do{
-            pthread_mutex_lock(&message_queue_in_mutex);
-            if(message_queue_in_curr_size > 0){
-                message_available = true;
+/* Reacts to a line written by the local player */
+static void terminal_input(struct session* session, const char* line){
+    int choice;
+
+    switch(awaited_input){
+        case AWAIT_FIRST_TURN_CHOICE:
+            clean_console();
+
+            if(!parse_int(line, &choice) || (choice != 1 && choice != 2)){
+                printf("\n\tPlease, choose again\n");
+                print_first_turn_question();
+                return;
             }
-            pthread_mutex_unlock(&message_queue_in_mutex);
-            ms_sleep(500);
-        }while(message_available == false && should_terminate() == false);
 
-        if(!should_terminate()){
+            mini_log(LOG, "game", -1, "Host: sending WELCOME message");
+            awaited_input = AWAIT_NOTHING;
+            session_open(session, choice);
+        break;
+        case AWAIT_MOVE:
+            if(strcmp(line, "h") == 0){
+                print_hint(session);
+                print_move_prompt(session);
+                return;
+            }
+            if(strcmp(line, "d") == 0){
+                if(!session_offer_draw(session)){
+                    printf("\n\tYou can't offer a draw now.\n");
+                    print_move_prompt(session);
+                }
+                return;
+            }
 
-            get_incoming_message(&rcv_msg);
-            mini_log(LOG, "game", -1, "Guest: received first message");
+            if(!parse_int(line, &choice) || (choice != 0 && can_place_symbol(&session->board, choice-1) == false)){
+                printf("\n\tYou can't choose that cell.\n");
+                print_move_prompt(session);
+                return;
+            }
 
-            if(rcv_msg.communication != WELCOME){
-                mini_log(ERROR, "game", __LINE__, "GUEST OPENING SEQUENCE FAILED");
+            printf("\n");
 
-                pthread_mutex_lock(&conn_status_mutex);
-                conn_status.terminated_by_game = true;
-                pthread_mutex_unlock(&conn_status_mutex);
+            if(choice == 0){
+                session_leave(session);
             }
             else{
-                first_turn = rcv_msg.arg1;
-                if(first_turn == GUEST)
-                    game_state->phase = GAME_TURN_GUEST;
-                else
-                    game_state->phase = GAME_TURN_HOST;
-                game_state->last_comm = WELCOME;
-
-                prepare_message(&snd_msg, OK, 0, 0, 0);
-                send_message(&snd_msg);
-                mini_log(LOG, "game", -1, "Guest: OK sent");
+                session_play_move(session, choice);
             }
-        }
-        else{
-            mini_log(ERROR, "game", __LINE__, "GUEST OPENING SEQUENCE FAILED (connection_manager terminated)");
-        }
+        break;
+        case AWAIT_DRAW_ANSWER:
+            if(strcmp(line, "y") != 0 && strcmp(line, "n") != 0){
+                printf("\n\tInsert y to accept the draw or n to refuse it:");
+                return;
+            }
+
+            awaited_input = AWAIT_NOTHING;
+            session_answer_draw(session, strcmp(line, "y") == 0);
+        break;
+        case AWAIT_REMATCH:
+            if(strcmp(line, "r") != 0){
+                awaited_input = AWAIT_NOTHING;
+                session_leave(session);
+            }
+            else if(session_request_rematch(session) && session->rematch == REMATCH_SENT){
+                printf("\n\tWaiting for the other player to accept...\n");
+            }
+        break;
+        default:
+            printf("\n\tPlease, wait for the other player.\n");
+        break;
+    }
+}
+
+/* The turn deadline has expired */
+static void terminal_timeout(struct session* session){
+    if(awaited_input == AWAIT_REMATCH){
+        printf("\n\n\tTime is up, no new game.\n");
+        awaited_input = AWAIT_NOTHING;
+        session_leave(session);
+        return;
     }
 
-    if(!should_terminate())
-        mini_log(LOG, "game", -1, "Opening sequence completed");
+    if(awaited_input == AWAIT_DRAW_ANSWER){
+        printf("\n\n\tTime is up, the draw has been refused.\n");
+        awaited_input = AWAIT_NOTHING;
+        session_answer_draw(session, false);
+        return;
+    }
 
-    if(first_turn != game_state->role){
-        printf("\n\tWaiting for the other player's move...\n");
+    if(awaited_input != AWAIT_NOTHING){
+        printf("\n\n\tTime is up, you have left the game.\n");
+    }
+    else{
+        printf("\n\n\tThe other player did not answer in time.\n");
     }
 
+    session_leave(session);
+}
+
+static void terminal_disconnected(struct session* session){
+    if(session->outcome == OUTCOME_NONE){
+        printf("\n\n\tThe connection with the other player was lost.\n");
+        return;
+    }
+
+    /* the game was over, the other player closed the connection instead of answering the rematch */
+    awaited_input = AWAIT_NOTHING;
+    printf("\n\n\tThe other player has left.\n");
+    printf("\n\tPress ENTER to continue...\n");
+    wait_for_any_key_press();
+}
+
+const struct game_frontend terminal_frontend = {
+    .ops = {
+        .local_turn = terminal_local_turn,
+        .remote_turn = terminal_remote_turn,
+        .finished = terminal_finished,
+        .draw_offered = terminal_draw_offered,
+        .rematch = terminal_rematch,
+        .restarted = terminal_restarted
+    },
+    .start = terminal_start,
+    .input = terminal_input,
+    .timeout = terminal_timeout,
+    .disconnected = terminal_disconnected,
+    .resumable = true
+};
+
+/* Starts the connection manager thread on connection_manager_socket, with new message queues */
+static bool start_connection_manager(pthread_t* communication_thread_tid){
+    reset_conn_status();
+
+    if(!queue_init(&message_queue_in) || !queue_init(&message_queue_out)){
+        mini_log(ERROR, "game", -1, "Unable to create the message queues");
+        queue_destroy(&message_queue_in);
+        queue_destroy(&message_queue_out);
+        return false;
+    }
+
+    if(pthread_create(communication_thread_tid, NULL, connection_manager, NULL) != 0){
+        mini_log(ERROR, "game", -1, "Unable to create the connection manager thread");
+        queue_destroy(&message_queue_in);
+        queue_destroy(&message_queue_out);
+        return false;
+    }
+
+    mini_log(LOG, "game", -1, "Connection manager thread created successfully");
+    return true;
+}
+
+static void stop_connection_manager(pthread_t communication_thread_tid){
+    mini_log(LOG, "game", -1, "Waiting for the communication thread to terminate");
+    pthread_join(communication_thread_tid, NULL);
+    mini_log(LOG, "game", -1, "Communication thread closed");
+
+    queue_destroy(&message_queue_in);
+    queue_destroy(&message_queue_out);
+}
+
+/* Returns true if the connection broke while the game was still going on */
+static bool connection_lost(){
+    bool res;
+
+    pthread_mutex_lock(&conn_status_mutex);
+    res = conn_status.terminated_by_conn_manager && !conn_status.terminated_by_game && !conn_status.terminated_by_other_peer;
+    pthread_mutex_unlock(&conn_status_mutex);
+
+    return res;
+}
+
+/* Waits at the same time for the local player and for the other peer, until the connection is closed */
+static void play(struct session* session){
+    struct message rcv_msg;
+    char line[INPUT_LINE_SIZE];
+    int incoming_event_fd = queue_event_fd(&message_queue_in);
+
     while(!should_terminate()){
 
-        if(first_turn == game_state->role && first_turn != 0){
-            goto FIRST_TURN_START;              /* sad but necessary, only used if it's the first turn */
-            mini_log(LOG, "game", -1, "First turn!");
+        switch(wait_for_event(incoming_event_fd, ms_until(&turn_deadline), frontend->input != NULL ? line : NULL, sizeof(line))){
+            case EVENT_READABLE:
+                drain_events(incoming_event_fd);
+
+                while(!should_terminate() && queue_pop(&message_queue_in, &rcv_msg)){
+                    session_handle_message(session, &rcv_msg);
+                }
+            break;
+            case EVENT_INPUT:
+                frontend->input(session, line);
+            break;
+            case EVENT_TIMEOUT:
+                if(frontend->timeout != NULL){
+                    frontend->timeout(session);
+                }
+                else{
+                    session_leave(session);
+                }
+            break;
+            case EVENT_INPUT_CLOSED:
+            case EVENT_ERROR:
+                session_leave(session);
+            break;
+            default:
+            break;
         }
+        fflush(stdout);
 
-        /* Wait for a message from the other peer */
-        message_available = false;
+        /* after a game with a result the connection stays open until one of the players declines the rematch */
+        if(session->rematch == REMATCH_DECLINED){
+            request_termination();
+        }
+    }
 
-        do{
-            pthread_mutex_lock(&message_queue_in_mutex);
-            if(message_queue_in_curr_size > 0){
-                message_available = true;
-            }
-            pthread_mutex_unlock(&message_queue_in_mutex);
-            ms_sleep(500);
-        }while(should_terminate() == false && message_available == false);
+    /* what arrived before the other peer closed the connection is still part of the game (e.g. the last OK) */
+    while(session->outcome == OUTCOME_NONE && queue_pop(&message_queue_in, &rcv_msg)){
+        session_handle_message(session, &rcv_msg);
+    }
+}
 
-        if(!should_terminate()){
-                
-            get_incoming_message(&rcv_msg);
+/*  The connection broke during the game: the host waits for the guest to connect again, the guest calls
+    the host, then both restart from the host's game field. The old connection manager is always stopped,
+    returns true if a new one is running on the new connection. */
+static bool resume_game(struct session* session, const struct sockaddr_in* host_address, pthread_t* communication_thread_tid){
+    struct message rcv_msg;
+    int connection_socket;
+    int board_index;
+    enum role turn;
 
-            /* Filter the message and act accordingly */
+    /* the messages received before the connection broke are still part of the game */
+    while(session_can_resume(session) && queue_pop(&message_queue_in, &rcv_msg)){
+        session_handle_message(session, &rcv_msg);
+    }
+    stop_connection_manager(*communication_thread_tid);
 
-            if(rcv_msg.communication == NO_UNEXPECTED || rcv_msg.communication == DISCONNECT){
-                pthread_mutex_lock(&conn_status_mutex);
-                conn_status.terminated_by_other_peer = true;
-                pthread_mutex_unlock(&conn_status_mutex);
+    if(!session_can_resume(session)){
+        return false;
+    }
 
-                game_state->phase = GAME_INTERRUPTED;
-            }
+    awaited_input = AWAIT_NOTHING;
 
+    if(session->state.role == HOST){
+        board_index = board_to_index(&session->board);
+        turn = session_turn(session);
 
-            clean_console();
+        /* the connection manager may have already accepted the guest on the new connection */
+        connection_socket = resumed_socket >= 0 ? resumed_socket : wait_for_resume(resume_listen_socket, session->token);
+        resumed_socket = -1;
 
-            if(!should_terminate()){
-
-                switch(game_state->phase){
-                    case GAME_TURN_HOST:
-                    case GAME_TURN_GUEST:
-                        /* the phase where each player chooses where to place a x or o */
-
-                        switch(rcv_msg.communication){
-                            case PLACE:
-
-                                if(can_place_symbol(rcv_msg.arg1-1)){
-                                    if(game_state->role == HOST){
-                                        place_symbol(rcv_msg.arg1-1, GUEST);
-                                    }
-                                    else{
-                                        place_symbol(rcv_msg.arg1-1, HOST);
-                                    }
-
-    FIRST_TURN_START:
-                                    first_turn = 0;
-
-                                    int victory = check_victory();
-                                    if(victory != 0){
-                                        /* this section signals the other peer's victory*/
-                                        prepare_message(&snd_msg, WIN, 1, victory, 0);
-                                        send_message(&snd_msg);
-
-                                        game_state->phase = GAME_END;
-                                        game_state->last_comm = WIN;
-                                    }
-                                    else{
-                                        if(victory == 0 && check_field_full() == true){
-                                            /* draw expected, the value 3 represents draw */
-                                            prepare_message(&snd_msg, WIN, 1, 3, 0);
-                                            send_message(&snd_msg);
-
-                                            game_state->phase = GAME_END;
-                                            game_state->last_comm = WIN;
-                                        }
-                                        else{
-                                            int choice;
-
-                                            print_game_field();
-
-                                            do{
-                                                printf("\n\tWrite a number from 1 to 9 to place your symbol on the corresponding cell\n");
-                                                printf("\tYou can also insert 0 to leave the game:");
-
-                                                scanf("%d", &choice);
-
-                                                if(choice != 0 && can_place_symbol(choice-1) == false)
-                                                    printf("\n\tYou can't choose that cell.\n");
-                
-                                            }while(choice != 0 && can_place_symbol(choice-1) == false);
-
-                                            printf("\n");
-
-                                            if(choice == 0){
-                                                prepare_message(&snd_msg, DISCONNECT, 0, 0, 0);
-                                                send_message(&snd_msg);
-
-                                                pthread_mutex_lock(&conn_status_mutex);
-                                                conn_status.terminated_by_game = true;
-                                                pthread_mutex_unlock(&conn_status_mutex);
-
-                                                game_state->phase = GAME_INTERRUPTED;
-                                                game_state->last_comm = DISCONNECT;
-                                            }
-                                            else{
-                                                place_symbol(choice-1, game_state->role);
-                                                print_game_field();
-
-                                                prepare_message(&snd_msg, PLACE, 1, choice, 0);
-                                                send_message(&snd_msg);
-
-                                                if(game_state->role == HOST)
-                                                    game_state->phase = GAME_TURN_GUEST;
-                                                else
-                                                    game_state->phase = GAME_TURN_HOST;
-                                                game_state->last_comm = PLACE;
-
-                                                printf("\n\tWaiting for the other player's move...\n");
-                                            }
-                                        }
-                                    }
-
-                                }
-                                else{
-                                    prepare_message(&snd_msg, NO_RESYNC, 0, 0, 0);
-                                    send_message(&snd_msg);
-
-                                    if(game_state->role == HOST){
-                                        prepare_message(&snd_msg, SYNC_START, 0, 0, 0);
-                                        send_message(&snd_msg);
-
-                                        game_state->phase = RESYNC;
-                                        game_state->last_comm = SYNC_START;
-                                    }
-                                    else{
-                                        game_state->phase = RESYNC;
-                                        game_state->last_comm = NO_RESYNC;
-                                    }
-                                }
-                            break;
-                            case NO_RESYNC:
-                                mini_log(ERROR, "game", __LINE__, "RESYNC NOT YET SUPPORTED");
-
-                                pthread_mutex_lock(&conn_status_mutex);
-                                conn_status.terminated_by_game = true;
-                                pthread_mutex_unlock(&conn_status_mutex);
-                            break;
-                            case WIN:
-                                /* In this case this peer has received a victory message */
-                                int victory = check_victory();
-
-                                if(victory == rcv_msg.arg1){
-                                    if(victory == game_state->role){
-                                        printf("\n\n\tY O U  H A V E  W O N  !!\n");
-                                    }
-                                    else{
-                                        /* draw not implemented*/
-                                        printf("\n\n\tYou have LOST.\n");
-                                    }
-                                    
-                                    prepare_message(&snd_msg, OK, 0, 0, 0);
-                                    send_message(&snd_msg);
-
-                                    printf("\n\n\tPress ENTER to continue...\n");
-                                    wait_for_any_key_press();
-
-                                    pthread_mutex_lock(&conn_status_mutex);
-                                    conn_status.terminated_by_game = true;
-                                    pthread_mutex_unlock(&conn_status_mutex);
-
-                                    game_state->phase = GAME_END;
-                                    game_state->last_comm = OK;
-                                }
-                                else{
-                                    if(victory == 0 && rcv_msg.arg1 == 3 && check_field_full() == true){
-                                        printf("\n\n\tIt's a draw!\n");
-                                        prepare_message(&snd_msg, OK, 0, 0, 0);
-                                        send_message(&snd_msg);
-
-                                        pthread_mutex_lock(&conn_status_mutex);
-                                        conn_status.terminated_by_game = true;
-                                        pthread_mutex_unlock(&conn_status_mutex);
-
-                                        game_state->phase = GAME_END;
-                                        game_state->last_comm = OK;
-                                    }
-                                    else{
-                                        prepare_message(&snd_msg, NO_RESYNC, 0, 0, 0);
-                                        send_message(&snd_msg);
-
-                                        if(game_state->role == HOST){
-                                            prepare_message(&snd_msg, SYNC_START, 0, 0, 0);
-                                            send_message(&snd_msg);
-
-                                            game_state->phase = RESYNC;
-                                            game_state->last_comm = SYNC_START;
-                                        }
-                                        else{
-                                            game_state->phase = RESYNC;
-                                            game_state->last_comm = NO_RESYNC;
-                                        }
-                                    }
-                                }
-                            break;
-                            default:
-                                mini_log(ERROR, "game", __LINE__, "INVALID MESSAGE RECEIVED (STATE: GAME_TURN)");
-
-                                pthread_mutex_lock(&conn_status_mutex);
-                                conn_status.terminated_by_game = true;
-                                pthread_mutex_unlock(&conn_status_mutex);
-                            break;
-                        }
-                    break;
-                    case GAME_END:
-                        /* This peer knows the game is over and waits for confirmation */
-                        switch(rcv_msg.communication){
-                            case OK:
-
-                                int victory = check_victory();
-                                if(victory != 0){
-                                    if(victory == game_state->role){
-                                        printf("\n\n\tY O U  H A V E  W O N  !!\n");
-                                    }
-                                    else{
-                                        printf("\n\n\tYou have LOST.\n");
-                                    }
-
-                                    printf("\n\n\tPress ENTER to continue...\n");
-                                    wait_for_any_key_press();
-
-                                    pthread_mutex_lock(&conn_status_mutex);
-                                    conn_status.terminated_by_game = true;
-                                    pthread_mutex_unlock(&conn_status_mutex);
-
-                                    game_state->phase = GAME_END;
-                                    game_state->last_comm = OK;
-                                }
-                                else{
-                                    prepare_message(&snd_msg, NO_RESYNC, 0, 0, 0);
-                                    send_message(&snd_msg);
-
-                                    if(game_state->role == HOST){
-                                        prepare_message(&snd_msg, SYNC_START, 0, 0, 0);
-                                        send_message(&snd_msg);
-
-                                        game_state->phase = RESYNC;
-                                        game_state->last_comm = SYNC_START;
-                                    }
-                                    else{
-                                        game_state->phase = RESYNC;
-                                        game_state->last_comm = NO_RESYNC;
-                                    }
-                                }
-                            break;
-                            case NO_RESYNC:
-                                mini_log(ERROR, "game", __LINE__, "RESYNC NOT YET SUPPORTED");
-
-                                pthread_mutex_lock(&conn_status_mutex);
-                                conn_status.terminated_by_game = true;
-                                pthread_mutex_unlock(&conn_status_mutex);
-                            break;
-                            default:
-                                mini_log(ERROR, "game", __LINE__, "INVALID MESSAGE RECEIVED (STATE: GAME_END)");
-
-                                pthread_mutex_lock(&conn_status_mutex);
-                                conn_status.terminated_by_game = true;
-                                pthread_mutex_unlock(&conn_status_mutex);
-                            break;
-                        }
-                    break;
-                    default:
-                        mini_log(ERROR, "game", __LINE__, "GAME_STATE NOT YET SUPPORTED");
-
-                        pthread_mutex_lock(&conn_status_mutex);
-                        conn_status.terminated_by_game = true;
-                        pthread_mutex_unlock(&conn_status_mutex);
-                    break;
-                }
-            }
+        if(connection_socket >= 0 && !send_resume_state(connection_socket, board_index, turn)){
+            close(connection_socket);
+            connection_socket = -1;
         }
     }
+    else{
+        connection_socket = resume_as_guest(host_address, session->token, &board_index, &turn);
+    }
 
+    if(connection_socket < 0){
+        printf("\n\n\tThe game could not be resumed.\n");
+        fflush(stdout);
+        return false;
+    }
 
-    mini_log(LOG, "game", -1, "Waiting for the communication thread to terminate");
-    pthread_join(communication_thread_tid, NULL);
-    mini_log(LOG, "game", -1, "Communication thread closed");
+    connection_manager_socket = connection_socket;
+    capture_resumed(message_capture, board_index, turn);
+    if(!start_connection_manager(communication_thread_tid)){
+        close(connection_socket);
+        return false;
+    }
 
-    pthread_attr_destroy(&communication_thread_attr);
+    mini_log(INFO, "game", -1, "Game resumed");
+    if(!session_resume(session, board_index, turn)){
+        session_leave(session);
+    }
+    return true;
+}
+
+/* Main gameloop function: plays one game on connection_manager_socket, the local player is game_frontend */
+void game(struct gameState* game_state, const struct game_frontend* game_frontend){
+    struct session session;
+    pthread_t communication_thread_tid;
+    struct sockaddr_in local_address, peer_address;
+    socklen_t address_size = sizeof(struct sockaddr_in);
+
+    /* where the game can be resumed if the connection breaks: the host listens again on its port, the guest calls the host */
+    getsockname(connection_manager_socket, (struct sockaddr*)&local_address, &address_size);
+    address_size = sizeof(struct sockaddr_in);
+    getpeername(connection_manager_socket, (struct sockaddr*)&peer_address, &address_size);
+
+    frontend = game_frontend;
+    session_init(&session, game_state->role, &game_session_ops, NULL);
+
+    if(game_state->role == HOST && frontend->resumable){
+        resume_listen_socket = create_listening_socket(ntohs(local_address.sin_port), false);
+        if(resume_listen_socket >= 0){
+            session.token = new_session_token();
+            resume_token = session.token;
+        }
+    }
+
+    capture_connection(message_capture, game_state->role);
+    if(!start_connection_manager(&communication_thread_tid)){
+        close_socket(connection_manager_socket);
+        if(resume_listen_socket >= 0){
+            close(resume_listen_socket);
+            resume_listen_socket = -1;
+        }
+        return;
+    }
+
+    if(game_state->role == HOST){
+        get_absolute_time_with_offset(TURN_TIMEOUT, &turn_deadline);
+    }
+    else{
+        mini_log(LOG, "game", -1, "Guest: waiting for WELCOME");
+        get_absolute_time_with_offset(TURN_TIMEOUT + TURN_TIMEOUT_MARGIN, &turn_deadline);
+    }
+    frontend->start(&session);
+
+    play(&session);
+
+    bool manager_running = true;
+    while(frontend->resumable && connection_lost() && session_can_resume(&session)){
+        manager_running = resume_game(&session, &peer_address, &communication_thread_tid);
+        if(!manager_running){
+            break;
+        }
+        play(&session);
+    }
+    if(manager_running){
+        stop_connection_manager(communication_thread_tid);
+    }
+
+    /*  if the game could not be resumed, the user has already been told; a connection closed while a rematch
+        was still possible is told too */
+    bool interrupted = session.outcome == OUTCOME_NONE && !(frontend->resumable && session_can_resume(&session));
+    bool rematch_pending = frontend->ops.rematch != NULL && session_can_rematch(&session);
+
+    if(interrupted || rematch_pending){
+        pthread_mutex_lock(&conn_status_mutex);
+        bool lost = conn_status.terminated_by_conn_manager;
+        pthread_mutex_unlock(&conn_status_mutex);
+
+        if(lost){
+            frontend->disconnected(&session);
+        }
+    }
+    fflush(stdout);
+
+    render_release();
+    *game_state = session.state;
+
+    if(resume_listen_socket >= 0){
+        close(resume_listen_socket);
+        resume_listen_socket = -1;
+    }
+    if(resumed_socket >= 0){
+        close(resumed_socket);
+        resumed_socket = -1;
+    }
 }
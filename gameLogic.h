@@ -1,9 +1,58 @@
 #ifndef GAMELOGIC_H
 #define GAMELOGIC_H
 
+/* milliseconds a player has to make a move before leaving the game */
+#define TURN_TIMEOUT 60000
+/* extra milliseconds granted to the other peer to cover the network delay */
+#define TURN_TIMEOUT_MARGIN 5000
+/* milliseconds a guest has to answer the WELCOME: the answer needs no player, only the network */
+#define HANDSHAKE_TIMEOUT 3000
+/* milliseconds the players have to ask for a rematch after a game */
+#define REMATCH_TIMEOUT 30000
+
+#include <stdbool.h>
+
 #include "protocol.h"
 #include "common.h"
+#include "tablebase.h"
+
+/*  cells contain 0 if free, otherwise the role (HOST or GUEST) of the player that placed the symbol.
+    The other fields are updated by place_symbol on the lines through the cell, so the end of the game
+    is known without looking at the whole game field (index 0 is HOST, 1 is GUEST). */
+struct board{
+    int cells[9];
+    unsigned char line_symbols[2][8];   /* symbols of each player on each line */
+    unsigned char open_lines[2][4];     /* lines with no symbol of the other player, by symbols of the player */
+    unsigned char n_symbols[2];
+    unsigned char winner;               /* the first player that completed a line, 0 if none */
+};
+
+void clear_board(struct board* board);
+
+int check_victory(const struct board* board);
+
+bool check_field_full(const struct board* board);
+
+bool check_draw(const struct board* board);
+
+bool can_place_symbol(const struct board* board, int pos);
+
+bool place_symbol(struct board* board, int pos, int symbol);
+
+enum tablebase_value position_value(const struct board* board, int symbol);
+
+int best_moves(const struct board* board, int symbol);
+
+int choose_bot_move(const struct board* board, int symbol);
+
+int board_to_index(const struct board* board);
+
+bool board_from_index(struct board* board, int index);
+
+void print_game_field(const struct board* board);
+
+struct game_frontend;
 
-void game(struct gameState* gs);
+void game(struct gameState* gs, const struct game_frontend* frontend);
 
 #endif /* GAMELOGIC_H */
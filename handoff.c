@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+#include "minilogger.h"
+#include "gameLogic.h"
+
+/*  A new server process takes the place of the old one on the same port without closing a game: the old one
+    waits on an abstract UNIX socket (nothing is left in the file system), the new one connects to it and
+    receives the listening sockets and every connected socket with SCM_RIGHTS, each one with the snapshot of
+    its session. The packets keep their boundaries (SOCK_SEQPACKET), so a packet is a header and its sockets:
+        the listening sockets, with the totals of the server: port (4), accepted, finished, rejected (8 each)
+        the connected sockets, HANDOFF_BATCH at most, each one with the snapshot of its session
+        the end, with no sockets; the new process answers with the same packet when it has taken everything
+    Every packet begins with HANDOFF_MAGIC and the number of sockets (4). Snapshot of a session, little endian:
+        ip (4), token (4), ms left to the guest (4), game field (2, base 3), phase, role, last_comm, first_turn,
+        outcome, draw_offer, rematch (1 each), bytes of the partial message (1), bytes not sent yet (2), peer_version (1),
+        then the partial message and the bytes not sent yet */
+
+static void write_le(unsigned char* buffer, unsigned long long value, int size){
+    for(int i=0; i < size; ++i){
+        buffer[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static unsigned long long read_le(const unsigned char* buffer, int size){
+    unsigned long long value = 0;
+
+    for(int i=0; i < size; ++i){
+        value |= (unsigned long long)buffer[i] << (8 * i);
+    }
+    return value;
+}
+
+static socklen_t handoff_address(int port, struct sockaddr_un* address){
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    /* sun_path[0] stays 0: the name is in the abstract namespace */
+    int length = snprintf(&address->sun_path[1], sizeof(address->sun_path) - 1, HANDOFF_SOCKET_NAME "%d", port);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+/* Neither process waits forever for the other one */
+static void set_handoff_timeouts(int channel){
+    struct timeval timeout = {HANDOFF_TIMEOUT / 1000, (HANDOFF_TIMEOUT % 1000) * 1000};
+
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/*  Creates the socket where the server on port waits for the process that takes its place.
+    Returns the socket, or -1 if it cannot be created (another server already waits for the same port) */
+int handoff_listen(int port){
+    struct sockaddr_un address;
+    socklen_t address_size = handoff_address(port, &address);
+    int listen_socket;
+
+    if((listen_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+        mini_log(ERROR, "handoff_listen", -1, "Unable to create the handoff socket");
+        return -1;
+    }
+
+    if(bind(listen_socket, (struct sockaddr*)&address, address_size) < 0 || listen(listen_socket, 1) < 0){
+        mini_log(ERROR, "handoff_listen", -1, "Unable to bind the handoff socket");
+        close(listen_socket);
+        return -1;
+    }
+
+    return listen_socket;
+}
+
+/*  Accepts the process that takes the place of the server. Only a process of the same user can have its
+    sockets: any other is closed. Returns the channel, or -1 */
+int handoff_accept(int listen_socket){
+    struct ucred peer;
+    socklen_t peer_size = sizeof(peer);
+    int channel = accept4(listen_socket, NULL, NULL, SOCK_CLOEXEC);
+
+    if(channel < 0){
+        return -1;
+    }
+
+    if(getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) < 0 || peer.uid != getuid()){
+        mini_log(WARNING, "handoff_accept", -1, "A process of another user asked for the sessions");
+        close(channel);
+        return -1;
+    }
+
+    set_handoff_timeouts(channel);
+    return channel;
+}
+
+/* Connects to the server running on port, to take its place. Returns the channel, or -1 */
+int handoff_connect(int port){
+    struct sockaddr_un address;
+    socklen_t address_size = handoff_address(port, &address);
+    int channel;
+
+    if((channel = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0){
+        mini_log(ERROR, "handoff_connect", -1, "Unable to create the handoff socket");
+        return -1;
+    }
+
+    if(connect(channel, (struct sockaddr*)&address, address_size) < 0){
+        mini_log(ERROR, "handoff_connect", -1, "No server to take the place of on this port");
+        close(channel);
+        return -1;
+    }
+
+    set_handoff_timeouts(channel);
+    return channel;
+}
+
+/* Sends a packet of size bytes with n_fds sockets (at most HANDOFF_BATCH). Returns false if it was not sent */
+bool handoff_send(int channel, const unsigned char* data, int size, const int* fds, int n_fds){
+    union{
+        char buffer[CMSG_SPACE(HANDOFF_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {(void*)data, size};
+    struct msghdr msg;
+    int n_byte_sent;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if(n_fds > 0){
+        struct cmsghdr* cmsg;
+
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+    }
+
+    do{
+        n_byte_sent = sendmsg(channel, &msg, MSG_NOSIGNAL);
+    }while(n_byte_sent < 0 && errno == EINTR);
+
+    if(n_byte_sent != size){
+        mini_log(ERROR, "handoff_send", -1, "Unable to send the handoff packet");
+        return false;
+    }
+    return true;
+}
+
+/*  Receives a packet in data (size bytes at most) and its sockets in fds (max_fds at most), their number in
+    *n_fds. Returns the bytes received, 0 if the other process closed the channel, -1 on errors
+    (a packet cut because it was too long is an error: its sockets are closed) */
+int handoff_receive(int channel, unsigned char* data, int size, int* fds, int max_fds, int* n_fds){
+    union{
+        char buffer[CMSG_SPACE(HANDOFF_BATCH * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {data, size};
+    struct msghdr msg;
+    int n_byte_read;
+
+    *n_fds = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    do{
+        n_byte_read = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    }while(n_byte_read < 0 && errno == EINTR);
+
+    if(n_byte_read < 0){
+        mini_log(ERROR, "handoff_receive", -1, "Unable to receive the handoff packet");
+        return -1;
+    }
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            int n_received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int received[HANDOFF_BATCH];
+
+            memcpy(received, CMSG_DATA(cmsg), n_received * sizeof(int));
+            for(int i=0; i < n_received; ++i){
+                if(*n_fds < max_fds){
+                    fds[(*n_fds)++] = received[i];
+                }
+                else{
+                    close(received[i]);
+                }
+            }
+        }
+    }
+
+    if(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)){
+        mini_log(ERROR, "handoff_receive", -1, "The handoff packet is too long");
+        for(int i=0; i < *n_fds; ++i){
+            close(fds[i]);
+        }
+        *n_fds = 0;
+        return -1;
+    }
+
+    return n_byte_read;
+}
+
+/* Writes the header of a packet with count sockets. Returns its bytes */
+int handoff_begin_packet(unsigned char* packet, int count){
+    memcpy(packet, HANDOFF_MAGIC, HANDOFF_MAGIC_SIZE);
+    write_le(&packet[HANDOFF_MAGIC_SIZE], (unsigned int)count, 4);
+    return HANDOFF_PACKET_HEADER_SIZE;
+}
+
+/* The number of sockets of the packet of size bytes, -1 if it is not a packet of the handoff */
+int handoff_packet_count(const unsigned char* packet, int size){
+    if(size < HANDOFF_PACKET_HEADER_SIZE || memcmp(packet, HANDOFF_MAGIC, HANDOFF_MAGIC_SIZE) != 0){
+        return -1;
+    }
+    return (int)(read_le(&packet[HANDOFF_MAGIC_SIZE], 4) & 0x7fffffff);
+}
+
+int handoff_encode_server(const struct handoff_server* server, unsigned char* buffer){
+    write_le(&buffer[0], (unsigned int)server->port, 4);
+    write_le(&buffer[4], server->accepted, 8);
+    write_le(&buffer[12], server->finished, 8);
+    write_le(&buffer[20], server->rejected, 8);
+    return HANDOFF_SERVER_SIZE;
+}
+
+/* Returns the bytes read, or -1 if size is too short */
+int handoff_decode_server(struct handoff_server* server, const unsigned char* buffer, int size){
+    if(size < HANDOFF_SERVER_SIZE){
+        return -1;
+    }
+
+    server->port = (int)read_le(&buffer[0], 4);
+    server->accepted = (long long)read_le(&buffer[4], 8);
+    server->finished = (long long)read_le(&buffer[12], 8);
+    server->rejected = (long long)read_le(&buffer[20], 8);
+    return HANDOFF_SERVER_SIZE;
+}
+
+/* Writes the snapshot in buffer (room for its header, a message and HANDOFF_MAX_OUTPUT bytes). Returns its bytes */
+int handoff_encode_session(const struct handoff_session* snapshot, unsigned char* buffer){
+    const struct session* session = &snapshot->session;
+    int output_size = snapshot->output_size < HANDOFF_MAX_OUTPUT ? snapshot->output_size : HANDOFF_MAX_OUTPUT;
+
+    write_le(&buffer[0], snapshot->ip, 4);
+    write_le(&buffer[4], (unsigned int)session->token, 4);
+    write_le(&buffer[8], (unsigned int)(snapshot->deadline_in > 0 ? snapshot->deadline_in : 0), 4);
+    write_le(&buffer[12], board_to_index(&session->board), 2);
+    buffer[14] = session->state.phase;
+    buffer[15] = session->state.role;
+    buffer[16] = session->state.last_comm;
+    buffer[17] = session->first_turn;
+    buffer[18] = session->outcome;
+    buffer[19] = session->draw_offer;
+    buffer[20] = session->rematch;
+    buffer[21] = snapshot->parser.size;
+    write_le(&buffer[22], output_size, 2);
+    buffer[24] = session->peer_version;
+
+    memcpy(&buffer[HANDOFF_SESSION_HEADER_SIZE], snapshot->parser.buffer, snapshot->parser.size);
+    memcpy(&buffer[HANDOFF_SESSION_HEADER_SIZE + snapshot->parser.size], snapshot->output, output_size);
+
+    return HANDOFF_SESSION_HEADER_SIZE + snapshot->parser.size + output_size;
+}
+
+/*  Reads a snapshot from the size bytes of buffer: snapshot->output points into buffer, the callbacks of the
+    session are not set. Returns the bytes read, or -1 if the snapshot is not valid */
+int handoff_decode_session(struct handoff_session* snapshot, const unsigned char* buffer, int size){
+    struct session* session = &snapshot->session;
+    int parser_size, output_size;
+
+    if(size < HANDOFF_SESSION_HEADER_SIZE){
+        return -1;
+    }
+
+    parser_size = buffer[21];
+    output_size = (int)read_le(&buffer[22], 2);
+
+    if(parser_size >= MESSAGE_WIRE_SIZE || output_size > HANDOFF_MAX_OUTPUT || HANDOFF_SESSION_HEADER_SIZE + parser_size + output_size > size
+        || buffer[14] >= PHASE_COUNT || (buffer[15] != HOST && buffer[15] != GUEST) || buffer[16] >= COMM_COUNT
+        || buffer[18] > OUTCOME_PROTOCOL_ERROR || buffer[19] > DRAW_OFFER_REFUSED || buffer[20] > REMATCH_DECLINED
+        || read_le(&buffer[12], 2) >= BOARD_INDEX_COUNT){
+        return -1;
+    }
+
+    memset(session, 0, sizeof(struct session));
+    board_from_index(&session->board, (int)read_le(&buffer[12], 2));
+    session->token = (int)(unsigned int)read_le(&buffer[4], 4);
+    session->state.phase = buffer[14];
+    session->state.role = buffer[15];
+    session->state.last_comm = buffer[16];
+    session->first_turn = buffer[17];
+    session->outcome = buffer[18];
+    session->draw_offer = buffer[19];
+    session->rematch = buffer[20];
+    session->peer_version = buffer[24] > 0 ? buffer[24] : 1;
+
+    snapshot->ip = (in_addr_t)read_le(&buffer[0], 4);
+    snapshot->deadline_in = (int)(unsigned int)read_le(&buffer[8], 4);
+    snapshot->parser.size = parser_size;
+    memcpy(snapshot->parser.buffer, &buffer[HANDOFF_SESSION_HEADER_SIZE], parser_size);
+    snapshot->output = &buffer[HANDOFF_SESSION_HEADER_SIZE + parser_size];
+    snapshot->output_size = output_size;
+
+    return HANDOFF_SESSION_HEADER_SIZE + parser_size + output_size;
+}
@@ -0,0 +1,79 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/* the server on a port waits for its successor on the abstract UNIX socket named HANDOFF_SOCKET_NAME and the port */
+#define HANDOFF_SOCKET_NAME "tris-handoff-"
+
+/* first bytes of every packet of the handoff, the version is the last character */
+#define HANDOFF_MAGIC "TRISHOF2"
+#define HANDOFF_MAGIC_SIZE 8
+
+/* sessions (and sockets) sent with one packet, below the SCM_MAX_FD of the kernel */
+#define HANDOFF_BATCH 64
+
+/* bytes at the beginning of every packet: the magic and the number of sockets (or sessions) that follow */
+#define HANDOFF_PACKET_HEADER_SIZE (HANDOFF_MAGIC_SIZE + 4)
+
+/* bytes of the server totals, sent with the listening sockets */
+#define HANDOFF_SERVER_SIZE 28
+
+/* bytes of a session snapshot before the partial message received and the messages not sent yet */
+#define HANDOFF_SESSION_HEADER_SIZE 25
+
+/* bytes of messages not sent yet that a snapshot can carry */
+#define HANDOFF_MAX_OUTPUT 1024
+
+/* bytes of the largest packet: the magic, the count and a full batch of the largest sessions */
+#define HANDOFF_PACKET_SIZE (HANDOFF_PACKET_HEADER_SIZE + HANDOFF_BATCH * (HANDOFF_SESSION_HEADER_SIZE + MESSAGE_WIRE_SIZE + HANDOFF_MAX_OUTPUT))
+
+/* milliseconds each process waits for the other one during the handoff */
+#define HANDOFF_TIMEOUT 5000
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "communication.h"
+#include "stateMachine.h"
+
+/* What the new server carries on from the old one, besides the sessions */
+struct handoff_server{
+    int port;
+    long long accepted;
+    long long finished;
+    long long rejected;
+};
+
+/*  What a process needs to go on with a session of another one: the socket travels in the same packet.
+    The game itself (board, phase, last_comm...) is the session, the callbacks are set again by the receiver. */
+struct handoff_session{
+    in_addr_t ip;
+    int deadline_in;                    /* ms left to the guest to answer */
+    struct session session;
+    struct frame_parser parser;         /* bytes received that do not form a message yet */
+    const unsigned char* output;        /* messages queued and not sent yet */
+    int output_size;
+};
+
+int handoff_listen(int port);
+
+int handoff_accept(int listen_socket);
+
+int handoff_connect(int port);
+
+bool handoff_send(int channel, const unsigned char* data, int size, const int* fds, int n_fds);
+
+int handoff_receive(int channel, unsigned char* data, int size, int* fds, int max_fds, int* n_fds);
+
+int handoff_begin_packet(unsigned char* packet, int count);
+
+int handoff_packet_count(const unsigned char* packet, int size);
+
+int handoff_encode_server(const struct handoff_server* server, unsigned char* buffer);
+
+int handoff_decode_server(struct handoff_server* server, const unsigned char* buffer, int size);
+
+int handoff_encode_session(const struct handoff_session* snapshot, unsigned char* buffer);
+
+int handoff_decode_session(struct handoff_session* snapshot, const unsigned char* buffer, int size);
+
+#endif /* HANDOFF_H */
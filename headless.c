@@ -0,0 +1,362 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "headless.h"
+#include "common.h"
+#include "eventLoop.h"
+#include "frontend.h"
+#include "gameLogic.h"
+#include "mux.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+/*  The headless player: nothing is asked to a user and every event of the game is written on stdout as a
+    line of JSON, so many processes can be driven and checked by a script. */
+
+struct headless_config headless_config = {
+    .moves = MOVES_BOT,
+    .script = NULL,
+    .first_turn = HOST,
+    .games = 1,
+    .streams = 0
+};
+
+/* the game being played */
+static struct board last_board;         /* the game field of the last event, to report the moves of the other player */
+static const char* script_next;         /* the next cell of headless_config.script */
+static const char* local_move_source;   /* how the last local move was chosen */
+static int n_moves;
+static struct timespec start_time;
+static bool completed;
+static int games_played;                /* on this connection, with a result */
+
+/* Writes {"event": "<event>", <the fields written with format>} on a line of stdout */
+void print_event(const char* event, const char* format, ...){
+    va_list args;
+
+    printf("{\"event\": \"%s\"", event);
+    if(format != NULL){
+        printf(", ");
+
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+/* Copies text into escaped as the content of a JSON string (truncated if escaped is too small) */
+void json_escape(const char* text, char* escaped, int escaped_size){
+    int size = 0;
+
+    for(; *text != '\0' && size < escaped_size - 7; ++text){
+        unsigned char c = *text;
+
+        if(c == '"' || c == '\\'){
+            escaped[size++] = '\\';
+            escaped[size++] = c;
+        }
+        else if(c < 0x20){
+            size += snprintf(&escaped[size], escaped_size - size, "\\u%04x", c);
+        }
+        else{
+            escaped[size++] = c;
+        }
+    }
+    escaped[size] = '\0';
+}
+
+/* true if the last game played ended with a result (won, lost or draw) */
+bool headless_game_completed(){
+    return completed;
+}
+
+static const char* role_name(enum role role){
+    return role == HOST ? "host" : "guest";
+}
+
+/* The game field as 9 characters, row by row: x for the host, o for the guest, . for a free cell */
+static void board_string(const struct board* board, char text[10]){
+    static const char symbols[3] = {'.', 'x', 'o'};
+
+    for(int pos=0; pos < 9; ++pos){
+        text[pos] = symbols[board->cells[pos]];
+    }
+    text[9] = '\0';
+}
+
+static int elapsed_ms(){
+    struct timespec now;
+
+    get_current_time_in_timespec(&now);
+    return (now.tv_sec - start_time.tv_sec) * 1000 + (now.tv_nsec - start_time.tv_nsec) / 1000000;
+}
+
+/* Reports the moves made since the last event (the session calls back the frontend after every move) */
+static void report_moves(const struct session* session){
+    for(int pos=0; pos < 9; ++pos){
+        if(last_board.cells[pos] != 0 || session->board.cells[pos] == 0){
+            continue;
+        }
+
+        if(session->board.cells[pos] == (int)session->state.role){
+            print_event("move", "\"player\": \"local\", \"cell\": %d, \"source\": \"%s\"", pos + 1, local_move_source);
+        }
+        else{
+            print_event("move", "\"player\": \"remote\", \"cell\": %d", pos + 1);
+        }
+        ++n_moves;
+    }
+    last_board = session->board;
+}
+
+static bool play_move(struct session* session, int cell, const char* source){
+    local_move_source = source;
+    return session_play_move(session, cell);
+}
+
+/* The next cell of the script, or -1 if it is over */
+static int next_script_move(){
+    char* end;
+    long cell;
+
+    if(script_next == NULL || *script_next == '\0'){
+        return -1;
+    }
+
+    cell = strtol(script_next, &end, 10);
+    if(end == script_next || cell < 1 || cell > 9){
+        script_next = NULL;     /* not a cell: the rest of the script is ignored */
+        return -1;
+    }
+
+    script_next = *end == ',' ? end + 1 : end;
+    return cell;
+}
+
+/* A game begins on the connection: the first one or a rematch */
+static void begin_game(struct session* session){
+    clear_board(&last_board);
+    script_next = headless_config.script;
+    n_moves = 0;
+    completed = false;
+    get_current_time_in_timespec(&start_time);
+
+    print_event("start", "\"role\": \"%s\", \"game\": %d", role_name(session->state.role), games_played + 1);
+}
+
+static void headless_start(struct session* session){
+    games_played = 0;
+    begin_game(session);
+
+    if(session->state.role == HOST){
+        session_open(session, headless_config.first_turn);
+    }
+}
+
+/* The host opens the rematch by itself, the first turn alternates */
+static void headless_restarted(struct session* session){
+    begin_game(session);
+}
+
+static void headless_local_turn(struct session* session){
+    char board[10];
+    int cell;
+
+    report_moves(session);
+
+    switch(headless_config.moves){
+        case MOVES_STDIN:
+            board_string(&session->board, board);
+            print_event("turn", "\"board\": \"%s\", \"draw_offer\": %s", board,
+                session->draw_offer == DRAW_OFFER_REFUSED ? "\"refused\"" : (session_can_offer_draw(session) ? "\"allowed\"" : "null"));
+        break;
+        case MOVES_SCRIPT:
+            /* when the script is over or names a taken cell, the bot moves */
+            cell = next_script_move();
+            if(cell > 0 && play_move(session, cell, "script")){
+                break;
+            }
+            /* fall through */
+        case MOVES_BOT:
+            play_move(session, choose_bot_move(&session->board, session->state.role), "bot");
+        break;
+    }
+}
+
+static void headless_remote_turn(struct session* session){
+    report_moves(session);
+}
+
+/* Only the stdin player is asked, the others accept */
+static void headless_draw_offered(struct session* session){
+    if(headless_config.moves != MOVES_STDIN){
+        session_answer_draw(session, true);
+        return;
+    }
+
+    print_event("draw_offered", NULL);
+}
+
+static void headless_finished(struct session* session, enum outcome outcome){
+    const char* result;
+
+    report_moves(session);
+
+    switch(outcome){
+        case OUTCOME_HOST_WON:
+        case OUTCOME_GUEST_WON:
+            result = (int)outcome == (int)session->state.role ? "won" : "lost";
+            completed = true;
+        break;
+        case OUTCOME_DRAW:
+            result = "draw";
+            completed = true;
+        break;
+        case OUTCOME_LEFT:
+            result = "left";
+        break;
+        case OUTCOME_PEER_LEFT:
+            result = "peer_left";
+        break;
+        default:
+            result = "protocol_error";
+        break;
+    }
+
+    print_event("result", "\"result\": \"%s\", \"moves\": %d, \"duration_ms\": %d", result, n_moves, elapsed_ms());
+
+    /* the stdin player decides about the rematch, the others play the number of games asked (an older peer cannot play again) */
+    if(completed && headless_config.moves != MOVES_STDIN){
+        if(++games_played >= headless_config.games || !session_request_rematch(session)){
+            session_leave(session);
+        }
+    }
+    else if(completed && !session_can_rematch(session)){
+        session_leave(session);
+    }
+}
+
+static void headless_rematch(struct session* session){
+    if(session->rematch == REMATCH_DECLINED){
+        print_event("rematch_declined", NULL);
+    }
+    else if(headless_config.moves == MOVES_STDIN){
+        print_event("rematch_offered", NULL);
+    }
+    else if(games_played < headless_config.games){
+        session_request_rematch(session);
+    }
+    else{
+        session_leave(session);
+    }
+}
+
+/*  The stdin line protocol: during the turn a cell from 1 to 9, d to offer a draw or 0 to leave;
+    after a draw_offered event y or n; after a result r to play again or 0 to leave.
+    Anything else is reported as invalid_input. */
+static void headless_input(struct session* session, const char* line){
+    char escaped[INPUT_LINE_SIZE * 6];
+    int cell;
+
+    if(session->draw_offer == DRAW_OFFER_RECEIVED && (strcmp(line, "y") == 0 || strcmp(line, "n") == 0)){
+        session_answer_draw(session, strcmp(line, "y") == 0);
+        return;
+    }
+
+    if(session_can_rematch(session)){
+        if(strcmp(line, "0") == 0){
+            session_leave(session);
+            return;
+        }
+        if(strcmp(line, "r") == 0 && session_request_rematch(session)){
+            if(session->rematch == REMATCH_SENT){
+                print_event("rematch_sent", NULL);
+            }
+            return;
+        }
+    }
+
+    if(session_is_local_turn(session)){
+        if(strcmp(line, "0") == 0){
+            session_leave(session);
+            return;
+        }
+        if(strcmp(line, "d") == 0 && session_offer_draw(session)){
+            print_event("draw_offer_sent", NULL);
+            return;
+        }
+        if(parse_int(line, &cell) && cell >= 1 && cell <= 9 && play_move(session, cell, "stdin")){
+            return;
+        }
+    }
+
+    json_escape(line, escaped, sizeof(escaped));
+    print_event("invalid_input", "\"line\": \"%s\"", escaped);
+}
+
+/* A draw offer without answer is refused, otherwise the game is left */
+static void headless_timeout(struct session* session){
+    if(session->draw_offer == DRAW_OFFER_RECEIVED){
+        session_answer_draw(session, false);
+        return;
+    }
+    session_leave(session);
+}
+
+static void headless_disconnected(struct session* session){
+    if(session->outcome != OUTCOME_NONE){
+        print_event("rematch_declined", NULL);     /* the connection was closed after the result */
+        return;
+    }
+
+    report_moves(session);
+    print_event("result", "\"result\": \"disconnected\", \"moves\": %d, \"duration_ms\": %d", n_moves, elapsed_ms());
+}
+
+/* stdin is read only by the stdin player; the game is not resumed, a broken connection ends it */
+const struct game_frontend* get_headless_frontend(){
+    static struct game_frontend frontend = {
+        .ops = {
+            .local_turn = headless_local_turn,
+            .remote_turn = headless_remote_turn,
+            .finished = headless_finished,
+            .draw_offered = headless_draw_offered,
+            .rematch = headless_rematch,
+            .restarted = headless_restarted
+        },
+        .start = headless_start,
+        .timeout = headless_timeout,
+        .disconnected = headless_disconnected,
+        .resumable = false
+    };
+
+    frontend.input = headless_config.moves == MOVES_STDIN ? headless_input : NULL;
+    return &frontend;
+}
+
+/*  --streams: the bot plays headless_config.games games on connection_socket, headless_config.streams at a time
+    (the host opens them, the guest plays until the host closes the connection). Only the total is reported */
+void play_headless_streams(int connection_socket, enum role role){
+    long long games;
+    int enable = 1;
+
+    /* the mux writes the messages of the streams together: the last ones of a game are not held back to be merged */
+    setsockopt(connection_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    get_current_time_in_timespec(&start_time);
+    games = mux_play_bot_games(connection_socket, role, role == HOST ? headless_config.games : -1, headless_config.streams);
+    close(connection_socket);
+
+    completed = role == HOST ? games == headless_config.games : games > 0;
+    print_event("games", "\"streams\": %d, \"games\": %lld, \"duration_ms\": %d", headless_config.streams, games, elapsed_ms());
+}
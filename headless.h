@@ -0,0 +1,35 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdbool.h>
+
+#include "frontend.h"
+
+/* where the moves of a headless player come from */
+enum move_source{
+    MOVES_BOT,          /* the computer player (perfect play) */
+    MOVES_SCRIPT,       /* a list of cells, the bot moves when it is over or names a taken cell */
+    MOVES_STDIN         /* one line for each move: see the README */
+};
+
+struct headless_config{
+    enum move_source moves;
+    const char* script;         /* cells separated by commas, for MOVES_SCRIPT */
+    int first_turn;             /* host: who moves first, HOST or GUEST */
+    int games;                  /* games played on the same connection by the bot and script players */
+    int streams;                /* games played at the same time on one connection by the bot (see mux.c), 0 for one at a time */
+};
+
+extern struct headless_config headless_config;
+
+const struct game_frontend* get_headless_frontend();
+
+void print_event(const char* event, const char* format, ...);
+
+void json_escape(const char* text, char* escaped, int escaped_size);
+
+bool headless_game_completed();
+
+void play_headless_streams(int connection_socket, enum role role);
+
+#endif /* HEADLESS_H */
@@ -0,0 +1,238 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "hostTable.h"
+#include "minilogger.h"
+
+#define HOST_TABLE_INITIAL_SLOTS 64
+
+static unsigned int hash_endpoint(in_addr_t ip, int port){
+    uint64_t key = ((uint64_t)ip << 16) ^ (uint64_t)(port & 0xffff);
+
+    /* 64 bit finalizer of MurmurHash3 */
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+
+    return (unsigned int)key;
+}
+
+/* Returns the slot that contains (ip, port) or the empty slot where it should be inserted */
+static int find_slot(const struct host_table* table, in_addr_t ip, int port){
+    unsigned int mask = table->n_slots - 1;
+    unsigned int slot = hash_endpoint(ip, port) & mask;
+
+    while(table->slots[slot] != 0){
+        const struct host* host = &table->hosts[table->slots[slot] - 1];
+
+        if(host->ip == ip && host->port == port){
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/* Rebuilds the hash set with n_slots slots (hosts is not modified) */
+static bool rebuild_slots(struct host_table* table, int n_slots){
+    int* slots = calloc(n_slots, sizeof(int));
+    if(slots == NULL){
+        mini_log(ERROR, "host_table", -1, "Unable to allocate the hash set");
+        return false;
+    }
+
+    free(table->slots);
+    table->slots = slots;
+    table->n_slots = n_slots;
+
+    for(int i=0; i < table->n_hosts; ++i){
+        table->slots[find_slot(table, table->hosts[i].ip, table->hosts[i].port)] = i + 1;
+    }
+
+    return true;
+}
+
+bool host_table_init(struct host_table* table){
+    table->hosts = NULL;
+    table->n_hosts = 0;
+    table->hosts_capacity = 0;
+    table->slots = NULL;
+    table->n_slots = 0;
+
+    return rebuild_slots(table, HOST_TABLE_INITIAL_SLOTS);
+}
+
+void host_table_destroy(struct host_table* table){
+    free(table->hosts);
+    free(table->slots);
+
+    table->hosts = NULL;
+    table->slots = NULL;
+    table->n_hosts = 0;
+    table->hosts_capacity = 0;
+    table->n_slots = 0;
+}
+
+/*  Adds the host (ip, port) if it is not in the table yet. *added (if not NULL) tells if it was new.
+    Returns the index of the host in table->hosts, or -1 if the memory is over. */
+int host_table_add(struct host_table* table, in_addr_t ip, int port, int version, bool* added){
+    if(added != NULL){
+        *added = false;
+    }
+
+    int slot = find_slot(table, ip, port);
+    if(table->slots[slot] != 0){
+        return table->slots[slot] - 1;
+    }
+
+    if(table->n_hosts == table->hosts_capacity){
+        int capacity = table->hosts_capacity == 0 ? HOST_TABLE_INITIAL_SLOTS / 2 : table->hosts_capacity * 2;
+        struct host* hosts = realloc(table->hosts, capacity * sizeof(struct host));
+
+        if(hosts == NULL){
+            mini_log(ERROR, "host_table_add", -1, "Unable to grow the host list");
+            return -1;
+        }
+        table->hosts = hosts;
+        table->hosts_capacity = capacity;
+    }
+
+    /* the load factor of the hash set is kept at most 1/2 */
+    if((table->n_hosts + 1) * 2 > table->n_slots){
+        if(!rebuild_slots(table, table->n_slots * 2)){
+            return -1;
+        }
+        slot = find_slot(table, ip, port);
+    }
+
+    struct host* host = &table->hosts[table->n_hosts];
+    memset(host, 0, sizeof(struct host));
+    host->ip = ip;
+    host->port = port;
+    host->version = version;
+    host->rtt = -1;
+    host->load.free_slots = -1;
+    host->load.active_games = -1;
+    host->load.move_latency_p99 = -1;
+    host->load.cpu_load = -1;
+
+    table->slots[slot] = ++table->n_hosts;
+
+    if(added != NULL){
+        *added = true;
+    }
+    return table->n_hosts - 1;
+}
+
+/* Returns the index of (ip, port) in table->hosts or -1 */
+int host_table_find(const struct host_table* table, in_addr_t ip, int port){
+    return table->slots[find_slot(table, ip, port)] - 1;
+}
+
+/*  Removes the hosts whose last advertisement arrived before the given time, keeping the order of the others.
+    Returns the number of hosts removed */
+int host_table_expire(struct host_table* table, const struct timespec* before){
+    int n_kept = 0;
+    int n_removed;
+
+    for(int i=0; i < table->n_hosts; ++i){
+        const struct timespec* seen = &table->hosts[i].last_seen;
+
+        if(seen->tv_sec > before->tv_sec || (seen->tv_sec == before->tv_sec && seen->tv_nsec >= before->tv_nsec)){
+            table->hosts[n_kept++] = table->hosts[i];
+        }
+    }
+
+    n_removed = table->n_hosts - n_kept;
+    if(n_removed > 0){
+        table->n_hosts = n_kept;
+        rebuild_slots(table, table->n_slots);
+    }
+    return n_removed;
+}
+
+static int (*current_compare)(const struct host* h1, const struct host* h2);
+
+static int qsort_compare(const void* h1, const void* h2){
+    return current_compare(h1, h2);
+}
+
+/* Sorts the result list; the hash set is rebuilt since the indexes change */
+void host_table_sort(struct host_table* table, int (*compare)(const struct host* h1, const struct host* h2)){
+    if(table->n_hosts < 2){
+        return;
+    }
+
+    current_compare = compare;
+    qsort(table->hosts, table->n_hosts, sizeof(struct host), qsort_compare);
+
+    rebuild_slots(table, table->n_slots);
+}
+
+/* Orders the hosts by ip address, then by port */
+int compare_host_address(const struct host* h1, const struct host* h2){
+    uint32_t ip1 = ntohl(h1->ip);
+    uint32_t ip2 = ntohl(h2->ip);
+
+    if(ip1 != ip2){
+        return ip1 < ip2 ? -1 : 1;
+    }
+    return h1->port - h2->port;
+}
+
+/* Orders the hosts by round trip time, the ones that did not answer the ping go last */
+int compare_host_rtt(const struct host* h1, const struct host* h2){
+    if(h1->rtt != h2->rtt){
+        if(h1->rtt < 0 || h2->rtt < 0){
+            return h1->rtt < 0 ? 1 : -1;
+        }
+        return h1->rtt < h2->rtt ? -1 : 1;
+    }
+    return compare_host_address(h1, h2);
+}
+
+/*  How busy a host is, in steps of 10%: the busiest of its sessions and of its cores. A host that does not
+    advertise its load (an older version) counts as half busy. */
+static int busy_level(const struct host* host){
+    const struct host_load* load = &host->load;
+    int busy = -1;
+
+    if(load->free_slots >= 0 && load->active_games >= 0 && load->free_slots + load->active_games > 0){
+        busy = (int)(100LL * load->active_games / (load->free_slots + load->active_games));
+    }
+    if(load->cpu_load > busy){
+        busy = load->cpu_load;
+    }
+    if(busy < 0){
+        busy = 50;
+    }
+
+    return busy / 10;
+}
+
+/*  Orders the hosts from the least busy, so the guests spread over them: the full ones go last, then the
+    hosts are compared by busy_level, by the p99 latency of the moves (in steps of a millisecond) and at
+    last by round trip time */
+int compare_host_load(const struct host* h1, const struct host* h2){
+    bool full1 = h1->load.free_slots == 0;
+    bool full2 = h2->load.free_slots == 0;
+    int latency1 = h1->load.move_latency_p99 > 0 ? h1->load.move_latency_p99 / 1000 : 0;
+    int latency2 = h2->load.move_latency_p99 > 0 ? h2->load.move_latency_p99 / 1000 : 0;
+
+    if(full1 != full2){
+        return full1 ? 1 : -1;
+    }
+    if(busy_level(h1) != busy_level(h2)){
+        return busy_level(h1) < busy_level(h2) ? -1 : 1;
+    }
+    if(latency1 != latency2){
+        return latency1 < latency2 ? -1 : 1;
+    }
+    return compare_host_rtt(h1, h2);
+}
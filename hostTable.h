@@ -0,0 +1,58 @@
+#ifndef HOSTTABLE_H
+#define HOSTTABLE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "common.h"
+
+/* how busy a host is, as it advertises it (from version 3 of the advertisements): -1 if not known */
+struct host_load{
+    int free_slots;             /* games the host can still accept */
+    int active_games;
+    int move_latency_p99;       /* microseconds the host took to answer a move, in the last seconds */
+    int cpu_load;               /* percent of the capacity of all its cores */
+};
+
+/* a game found on the LAN */
+struct host{
+    in_addr_t ip;       /* network byte order */
+    int port;
+    int version;
+    int rtt;                    /* microseconds, -1 if the host did not answer the ping */
+    struct timespec ping_time;  /* when the ping was sent, tv_sec is 0 before */
+    struct timespec last_seen;  /* when its last advertisement arrived */
+    struct host_load load;      /* updated by every advertisement */
+};
+
+/*  Hosts found by the scanner. hosts is the result list (in discovery order until it is sorted),
+    slots is an open addressing hash set over (ip, port) pointing into hosts, so a duplicated
+    advertisement costs one lookup whatever the number of hosts. */
+struct host_table{
+    struct host* hosts;
+    int n_hosts;
+    int hosts_capacity;
+    int* slots;         /* index in hosts + 1, 0 means empty */
+    int n_slots;        /* always a power of 2 */
+};
+
+bool host_table_init(struct host_table* table);
+
+void host_table_destroy(struct host_table* table);
+
+int host_table_add(struct host_table* table, in_addr_t ip, int port, int version, bool* added);
+
+int host_table_find(const struct host_table* table, in_addr_t ip, int port);
+
+int host_table_expire(struct host_table* table, const struct timespec* before);
+
+void host_table_sort(struct host_table* table, int (*compare)(const struct host* h1, const struct host* h2));
+
+int compare_host_address(const struct host* h1, const struct host* h2);
+
+int compare_host_rtt(const struct host* h1, const struct host* h2);
+
+int compare_host_load(const struct host* h1, const struct host* h2);
+
+#endif /* HOSTTABLE_H */
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "localDiscovery.h"
+#include "common.h"
+#include "minilogger.h"
+
+/*  Only one process of the machine scans the LAN: the first one that looks for games becomes the leader,
+    binds the scanner socket (DISCOVERY_PORT) and keeps a table of the hosts in a thread of its own, updated
+    by the advertisements, by a probe every LOCAL_DISCOVERY_PROBE_INTERVAL ms and by removing the hosts that
+    are not heard anymore. The other processes ask the leader for the table on the abstract UNIX socket
+    LOCAL_DISCOVERY_NAME and have it at once: any user can bind the name, so both ends check that the other one
+    belongs to the same user (SO_PEERCRED). When the leader exits, the next process that asks takes its place.
+    The packets keep their boundaries (SOCK_SEQPACKET): the question is LOCAL_DISCOVERY_MAGIC, each packet of
+    the answer is the magic, the number of hosts (4) and the hosts, as struct local_host. */
+
+/* a host as the leader sends it: the two processes are on the same machine, the numbers are in host order */
+struct local_host{
+    in_addr_t ip;
+    int port;
+    int version;
+    int rtt;
+    struct host_load load;
+};
+
+#define LOCAL_DISCOVERY_HEADER_SIZE (LOCAL_DISCOVERY_MAGIC_SIZE + 4)
+#define LOCAL_DISCOVERY_PACKET_SIZE (LOCAL_DISCOVERY_HEADER_SIZE + LOCAL_DISCOVERY_BATCH * sizeof(struct local_host))
+
+struct leader{
+    int listen_socket;
+    int scanner_socket;
+    int clients[LOCAL_DISCOVERY_MAX_CLIENTS];
+    bool waiting[LOCAL_DISCOVERY_MAX_CLIENTS];      /* the client asked before the first scan was over */
+    int n_clients;
+    struct host_table table;
+    struct timespec scan_end;           /* of the first scan, then the hosts are pinged (tv_sec is 0 after) */
+    struct timespec ready_time;         /* the first answers are sent when the pings are answered or then */
+    bool ready;
+    struct timespec next_probe;
+};
+
+static struct leader leader;
+
+/* the thread of the leader runs in this process (it clears the flag when it stops) */
+static bool leading = false;
+
+static socklen_t leader_address(struct sockaddr_un* address){
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+
+    /* sun_path[0] stays 0: the name is in the abstract namespace */
+    memcpy(&address->sun_path[1], LOCAL_DISCOVERY_NAME, strlen(LOCAL_DISCOVERY_NAME));
+    return offsetof(struct sockaddr_un, sun_path) + 1 + strlen(LOCAL_DISCOVERY_NAME);
+}
+
+/* Sends the whole table to the client. Returns false if it cannot take it (it is closed) */
+static bool answer_client(int client){
+    unsigned char packet[LOCAL_DISCOVERY_PACKET_SIZE];
+    int first = 0;
+    int count;
+
+    do{
+        count = leader.table.n_hosts - first < LOCAL_DISCOVERY_BATCH ? leader.table.n_hosts - first : LOCAL_DISCOVERY_BATCH;
+
+        memcpy(packet, LOCAL_DISCOVERY_MAGIC, LOCAL_DISCOVERY_MAGIC_SIZE);
+        memcpy(&packet[LOCAL_DISCOVERY_MAGIC_SIZE], &count, 4);
+        for(int i=0; i < count; ++i){
+            const struct host* host = &leader.table.hosts[first + i];
+            struct local_host record = {host->ip, host->port, host->version, host->rtt, host->load};
+
+            memcpy(&packet[LOCAL_DISCOVERY_HEADER_SIZE + i * sizeof(struct local_host)], &record, sizeof(record));
+        }
+
+        /* the leader never waits for a client: one that does not read is dropped */
+        if(send(client, packet, LOCAL_DISCOVERY_HEADER_SIZE + count * sizeof(struct local_host), MSG_DONTWAIT | MSG_NOSIGNAL) < 0){
+            return false;
+        }
+        first += count;
+    }while(count == LOCAL_DISCOVERY_BATCH);
+
+    return true;
+}
+
+/* True if the process at the other end of channel belongs to the same user */
+static bool same_user(int channel){
+    struct ucred peer;
+    socklen_t peer_size = sizeof(peer);
+
+    return getsockopt(channel, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) == 0 && peer.uid == getuid();
+}
+
+static void remove_client(int index){
+    close(leader.clients[index]);
+    --leader.n_clients;
+    leader.clients[index] = leader.clients[leader.n_clients];
+    leader.waiting[index] = leader.waiting[leader.n_clients];
+}
+
+static void accept_clients(){
+    int client;
+
+    while((client = accept4(leader.listen_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+        if(leader.n_clients == LOCAL_DISCOVERY_MAX_CLIENTS){
+            close(client);
+            continue;
+        }
+        if(!same_user(client)){
+            mini_log(WARNING, "accept_clients", -1, "A process of another user asked for the hosts");
+            close(client);
+            continue;
+        }
+        leader.clients[leader.n_clients] = client;
+        leader.waiting[leader.n_clients] = false;
+        ++leader.n_clients;
+    }
+}
+
+/* Reads the question of a client. Returns false if it closed its end, or did not send a question */
+static bool serve_client(int index){
+    unsigned char question[LOCAL_DISCOVERY_MAGIC_SIZE];
+    int n_byte_read = recv(leader.clients[index], question, sizeof(question), MSG_DONTWAIT);
+
+    if(n_byte_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return true;
+    }
+    if(n_byte_read != LOCAL_DISCOVERY_MAGIC_SIZE || memcmp(question, LOCAL_DISCOVERY_MAGIC, LOCAL_DISCOVERY_MAGIC_SIZE) != 0){
+        return false;
+    }
+
+    if(!leader.ready){
+        leader.waiting[index] = true;
+        return true;
+    }
+    return answer_client(leader.clients[index]);
+}
+
+/* The first scan is over when every host found answered its ping, or at ready_time */
+static void check_first_scan(){
+    int n_answers = 0;
+
+    if(leader.scan_end.tv_sec != 0 && ms_until(&leader.scan_end) == 0){
+        ping_hosts(leader.scanner_socket, &leader.table);
+        get_absolute_time_with_offset(DISCOVERY_PING_TIME, &leader.ready_time);
+        leader.scan_end.tv_sec = 0;
+    }
+    if(leader.scan_end.tv_sec != 0){
+        return;
+    }
+
+    for(int i=0; i < leader.table.n_hosts; ++i){
+        if(leader.table.hosts[i].rtt >= 0){
+            ++n_answers;
+        }
+    }
+    if(n_answers < leader.table.n_hosts && ms_until(&leader.ready_time) > 0){
+        return;
+    }
+
+    leader.ready = true;
+    get_absolute_time_with_offset(LOCAL_DISCOVERY_PROBE_INTERVAL, &leader.next_probe);
+
+    for(int i=leader.n_clients - 1; i >= 0; --i){
+        if(leader.waiting[i] && !answer_client(leader.clients[i])){
+            remove_client(i);
+        }
+        else{
+            leader.waiting[i] = false;
+        }
+    }
+}
+
+/* A new probe keeps the load of the hosts updated, the hosts not heard since LOCAL_DISCOVERY_EXPIRY are removed */
+static void refresh_table(){
+    struct timespec oldest;
+
+    send_discovery_probe(leader.scanner_socket);
+
+    get_current_time_in_timespec(&oldest);
+    oldest.tv_sec -= LOCAL_DISCOVERY_EXPIRY / 1000;
+    oldest.tv_nsec -= (LOCAL_DISCOVERY_EXPIRY % 1000) * 1000000;
+    if(oldest.tv_nsec < 0){
+        oldest.tv_nsec += 1000000000;
+        oldest.tv_sec -= 1;
+    }
+    host_table_expire(&leader.table, &oldest);
+
+    get_absolute_time_with_offset(LOCAL_DISCOVERY_PROBE_INTERVAL, &leader.next_probe);
+}
+
+/* The leader stops: the next process that asks takes its place */
+static void stop_leading(){
+    for(int i=0; i < leader.n_clients; ++i){
+        close(leader.clients[i]);
+    }
+    leader.n_clients = 0;
+
+    close(leader.scanner_socket);
+    close(leader.listen_socket);
+    host_table_destroy(&leader.table);
+
+    __atomic_store_n(&leading, false, __ATOMIC_RELEASE);
+}
+
+/* The thread of the leader: it lasts as long as the process, unless poll fails */
+static void* lead_discovery(void* arg){
+    struct pollfd fds[2 + LOCAL_DISCOVERY_MAX_CLIENTS];
+    (void)arg;
+
+    /* the hosts answer the probe at once, the second probe covers a lost datagram (the same as a scan) */
+    send_discovery_probe(leader.scanner_socket);
+    get_absolute_time_with_offset(DISCOVERY_SCAN_TIME / 2, &leader.next_probe);
+    get_absolute_time_with_offset(DISCOVERY_SCAN_TIME, &leader.scan_end);
+
+    while(1){
+        int timeout = ms_until(&leader.next_probe);
+
+        if(!leader.ready){
+            int until_ready = leader.scan_end.tv_sec != 0 ? ms_until(&leader.scan_end) : ms_until(&leader.ready_time);
+            if(until_ready < timeout){
+                timeout = until_ready;
+            }
+        }
+
+        fds[0].fd = leader.listen_socket;
+        fds[0].events = POLLIN;
+        fds[1].fd = leader.scanner_socket;
+        fds[1].events = POLLIN;
+        for(int i=0; i < leader.n_clients; ++i){
+            fds[2 + i].fd = leader.clients[i];
+            fds[2 + i].events = POLLIN;
+        }
+
+        int n_clients = leader.n_clients;
+        if(poll(fds, 2 + n_clients, timeout) < 0 && errno != EINTR){
+            mini_log(ERROR, "lead_discovery", -1, "poll returned -1");
+            stop_leading();
+            return NULL;
+        }
+
+        if(fds[1].revents != 0 && receive_advertisements(leader.scanner_socket, &leader.table) > 0){
+            /* the late hosts are pinged as they come */
+            ping_hosts(leader.scanner_socket, &leader.table);
+        }
+
+        /* from the last one, since a client removed is replaced by the last one */
+        for(int i=n_clients - 1; i >= 0; --i){
+            if(fds[2 + i].revents != 0 && !serve_client(i)){
+                remove_client(i);
+            }
+        }
+
+        if(fds[0].revents != 0){
+            accept_clients();
+        }
+
+        if(!leader.ready){
+            check_first_scan();
+            if(!leader.ready && ms_until(&leader.next_probe) == 0){
+                send_discovery_probe(leader.scanner_socket);
+                leader.next_probe = leader.scan_end;
+            }
+        }
+        else if(ms_until(&leader.next_probe) == 0){
+            refresh_table();
+        }
+    }
+}
+
+/*  Becomes the leader of the machine: binds the name, then the scanner socket. Returns false if another process
+    took the name first (errno is EADDRINUSE) or if the LAN cannot be scanned */
+static bool become_leader(){
+    struct sockaddr_un address;
+    socklen_t address_size = leader_address(&address);
+    pthread_t leader_tid;
+
+    if(__atomic_load_n(&leading, __ATOMIC_ACQUIRE)){
+        return false;
+    }
+
+    if((leader.listen_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+        mini_log(ERROR, "become_leader", -1, "Unable to create the socket of the leader");
+        return false;
+    }
+    if(bind(leader.listen_socket, (struct sockaddr*)&address, address_size) < 0 || listen(leader.listen_socket, LOCAL_DISCOVERY_MAX_CLIENTS) < 0){
+        int error = errno;
+
+        close(leader.listen_socket);
+        errno = error;
+        return false;
+    }
+
+    /* an older version of the program scanning on this machine holds the port */
+    if((leader.scanner_socket = create_scanner_socket()) < 0){
+        close(leader.listen_socket);
+        errno = EIO;
+        return false;
+    }
+
+    if(!host_table_init(&leader.table)){
+        close(leader.scanner_socket);
+        close(leader.listen_socket);
+        errno = ENOMEM;
+        return false;
+    }
+    leader.n_clients = 0;
+    leader.ready = false;
+    __atomic_store_n(&leading, true, __ATOMIC_RELEASE);
+
+    if(pthread_create(&leader_tid, NULL, lead_discovery, NULL) != 0){
+        mini_log(ERROR, "become_leader", -1, "Unable to create the thread of the leader");
+        stop_leading();
+        errno = EAGAIN;
+        return false;
+    }
+    pthread_detach(leader_tid);
+
+    mini_log(LOG, "become_leader", -1, "This process scans the LAN for the whole machine");
+    return true;
+}
+
+/*  Connects to the discovery leader of the machine, becoming the leader if there is none.
+    Returns the channel to ask it the hosts with, or -1 if the LAN cannot be scanned
+    (errno is EACCES if the leader is a process of another user) */
+int local_discovery_connect(){
+    struct sockaddr_un address;
+    socklen_t address_size = leader_address(&address);
+    struct timeval timeout = {LOCAL_DISCOVERY_TIMEOUT / 1000, (LOCAL_DISCOVERY_TIMEOUT % 1000) * 1000};
+    int channel;
+
+    /* two processes may look for a leader at the same time: the one that cannot bind the name connects again */
+    for(int attempt=0; attempt < 3; ++attempt){
+        if((channel = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0){
+            mini_log(ERROR, "local_discovery_connect", -1, "Unable to create the socket");
+            return -1;
+        }
+
+        if(connect(channel, (struct sockaddr*)&address, address_size) == 0){
+            if(!same_user(channel)){
+                /* its answers could not be trusted, and the scanner port is taken by its process */
+                mini_log(ERROR, "local_discovery_connect", -1, "Another user is looking for games on this computer: its process holds the discovery port");
+                close(channel);
+                errno = EACCES;
+                return -1;
+            }
+            setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return channel;
+        }
+        close(channel);
+
+        if(!become_leader() && errno != EADDRINUSE){
+            mini_log(ERROR, "local_discovery_connect", -1, "Unable to scan the LAN");
+            return -1;
+        }
+    }
+
+    return -1;
+}
+
+/* Asks the leader for its hosts: the answer can be read when the channel becomes readable */
+bool local_discovery_ask(int channel){
+    if(send(channel, LOCAL_DISCOVERY_MAGIC, LOCAL_DISCOVERY_MAGIC_SIZE, MSG_NOSIGNAL) != LOCAL_DISCOVERY_MAGIC_SIZE){
+        mini_log(WARNING, "local_discovery_ask", -1, "The discovery leader is gone");
+        return false;
+    }
+    return true;
+}
+
+/*  Reads the answer of the leader: the hosts that are not in table are added, the others have their round trip
+    time and load updated. Returns the number of new hosts, or -1 if the leader is gone */
+int local_discovery_read(int channel, struct host_table* table){
+    unsigned char packet[LOCAL_DISCOVERY_PACKET_SIZE];
+    int n_new_hosts = 0;
+    int n_byte_read, count;
+    bool added;
+
+    do{
+        n_byte_read = recv(channel, packet, sizeof(packet), 0);
+        if(n_byte_read < LOCAL_DISCOVERY_HEADER_SIZE || memcmp(packet, LOCAL_DISCOVERY_MAGIC, LOCAL_DISCOVERY_MAGIC_SIZE) != 0){
+            return -1;
+        }
+
+        memcpy(&count, &packet[LOCAL_DISCOVERY_MAGIC_SIZE], 4);
+        if(count < 0 || count > LOCAL_DISCOVERY_BATCH || n_byte_read != LOCAL_DISCOVERY_HEADER_SIZE + count * (int)sizeof(struct local_host)){
+            return -1;
+        }
+
+        for(int i=0; i < count; ++i){
+            struct local_host record;
+            int index;
+
+            memcpy(&record, &packet[LOCAL_DISCOVERY_HEADER_SIZE + i * sizeof(struct local_host)], sizeof(record));
+
+            index = host_table_add(table, record.ip, record.port, record.version, &added);
+            if(index < 0){
+                continue;
+            }
+            if(added){
+                ++n_new_hosts;
+            }
+            table->hosts[index].rtt = record.rtt;
+            table->hosts[index].load = record.load;
+        }
+    }while(count == LOCAL_DISCOVERY_BATCH);
+
+    return n_new_hosts;
+}
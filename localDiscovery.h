@@ -0,0 +1,37 @@
+#ifndef LOCALDISCOVERY_H
+#define LOCALDISCOVERY_H
+
+/* abstract UNIX socket where the discovery leader of the machine answers the other processes */
+#define LOCAL_DISCOVERY_NAME "tris-discovery"
+
+/* first bytes of every packet between the leader and the other processes, the version is the last character */
+#define LOCAL_DISCOVERY_MAGIC "TRISLDQ1"
+#define LOCAL_DISCOVERY_MAGIC_SIZE 8
+
+/* hosts sent with one packet of the answer: a shorter packet is the last one */
+#define LOCAL_DISCOVERY_BATCH 128
+
+/* processes the leader serves at the same time */
+#define LOCAL_DISCOVERY_MAX_CLIENTS 64
+
+/* milliseconds between two probes of the leader, that keep the load of the hosts updated */
+#define LOCAL_DISCOVERY_PROBE_INTERVAL 5000
+
+/* a host that has not been heard (probe answers or beacons) for this many milliseconds is removed */
+#define LOCAL_DISCOVERY_EXPIRY (3 * DISCOVERY_KEEPALIVE_INTERVAL + 1000)
+
+/* milliseconds a process waits for the answer of the leader (a new leader scans the LAN first) */
+#define LOCAL_DISCOVERY_TIMEOUT (DISCOVERY_SCAN_TIME + DISCOVERY_PING_TIME + 1000)
+
+#include <stdbool.h>
+
+#include "discovery.h"
+#include "hostTable.h"
+
+int local_discovery_connect();
+
+bool local_discovery_ask(int channel);
+
+int local_discovery_read(int channel, struct host_table* table);
+
+#endif /* LOCALDISCOVERY_H */
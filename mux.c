@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "mux.h"
+#include "minilogger.h"
+#include "common.h"
+#include "communication.h"
+#include "gameLogic.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+static void mark_ready(struct mux* mux, struct mux_stream* stream){
+    if(!stream->ready){
+        mux->ready[(mux->ready_head + mux->ready_size) % mux->n_streams] = stream->id;
+        ++mux->ready_size;
+        stream->ready = true;
+    }
+}
+
+/* --- session_ops of a stream: the messages wait in the queue of the stream, the rest goes to the player --- */
+
+static void mux_send(struct session* session, struct message* msg){
+    struct mux_stream* stream = session->context;
+
+    if(stream->queue_size == MUX_STREAM_QUEUE_SIZE){
+        mini_log(ERROR, "mux_send", -1, "The message queue of the stream is full!");
+        stream->mux->failed = true;
+        return;
+    }
+
+    struct message* queued = &stream->queue[(stream->queue_head + stream->queue_size) % MUX_STREAM_QUEUE_SIZE];
+    copy_message(queued, msg);
+    queued->stream = stream->id;
+    ++stream->queue_size;
+
+    mark_ready(stream->mux, stream);
+}
+
+static void mux_local_turn(struct session* session){
+    struct mux_stream* stream = session->context;
+
+    stream->mux->player->local_turn(session);
+}
+
+static void mux_remote_turn(struct session* session){
+    struct mux_stream* stream = session->context;
+
+    if(stream->mux->player->remote_turn != NULL){
+        stream->mux->player->remote_turn(session);
+    }
+}
+
+static void mux_finished(struct session* session, enum outcome outcome){
+    struct mux_stream* stream = session->context;
+    struct mux* mux = stream->mux;
+
+    ++mux->games_finished;
+    if(!stream->just_finished){
+        stream->just_finished = true;
+        mux->finished[mux->n_finished++] = stream->id;
+    }
+
+    if(mux->player->finished != NULL){
+        mux->player->finished(session, outcome);
+    }
+}
+
+static void mux_draw_offered(struct session* session){
+    struct mux_stream* stream = session->context;
+
+    if(stream->mux->player->draw_offered != NULL){
+        stream->mux->player->draw_offered(session);
+    }
+    else{
+        session_answer_draw(session, true);
+    }
+}
+
+static const struct session_ops mux_session_ops = {
+    .send = mux_send,
+    .local_turn = mux_local_turn,
+    .remote_turn = mux_remote_turn,
+    .finished = mux_finished,
+    .draw_offered = mux_draw_offered
+};
+
+/* message_handler of the mux: every message goes to the session of its stream */
+static bool dispatch_to_stream(struct message* msg, void* context){
+    struct mux* mux = context;
+
+    if(msg->stream < 1 || msg->stream > mux->n_streams){
+        mini_log(ERROR, "mux", -1, "Message for a stream that does not exist");
+        return false;
+    }
+
+    struct mux_stream* stream = &mux->streams[msg->stream - 1];
+
+    /* the host starts a game on the stream (again, if the previous game is over) */
+    if(mux->role == GUEST && msg->communication == WELCOME && (!stream->open || stream->session.outcome != OUTCOME_NONE)){
+        session_init(&stream->session, GUEST, &mux_session_ops, stream);
+        stream->open = true;
+    }
+
+    if(!stream->open){
+        mini_log(ERROR, "mux", -1, "Message for a stream that is not open");
+        return false;
+    }
+
+    session_handle_message(&stream->session, msg);
+    return true;
+}
+
+/* The games are played on socket, that becomes non-blocking. n_streams is at most MUX_MAX_STREAMS */
+bool mux_init(struct mux* mux, int socket, enum role role, int n_streams, const struct session_ops* player){
+    if(n_streams < 1 || n_streams > MUX_MAX_STREAMS || player == NULL || player->local_turn == NULL){
+        mini_log(ERROR, "mux_init", -1, "Invalid parameters");
+        return false;
+    }
+
+    memset(mux, 0, sizeof(struct mux));
+    mux->socket = socket;
+    mux->role = role;
+    mux->player = player;
+    mux->n_streams = n_streams;
+    frame_parser_init(&mux->parser);
+
+    mux->streams = calloc(n_streams, sizeof(struct mux_stream));
+    mux->ready = calloc(n_streams, sizeof(int));
+    mux->finished = calloc(n_streams, sizeof(int));
+    if(mux->streams == NULL || mux->ready == NULL || mux->finished == NULL){
+        mini_log(ERROR, "mux_init", -1, "Unable to allocate the streams");
+        mux_destroy(mux);
+        return false;
+    }
+
+    for(int i=0; i < n_streams; ++i){
+        mux->streams[i].id = i + 1;
+        mux->streams[i].mux = mux;
+    }
+
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+
+    return true;
+}
+
+/* Frees the streams (the socket is not closed) */
+void mux_destroy(struct mux* mux){
+    free(mux->streams);
+    free(mux->ready);
+    free(mux->finished);
+
+    mux->streams = NULL;
+    mux->ready = NULL;
+    mux->finished = NULL;
+    mux->n_streams = 0;
+}
+
+/* Host only: starts a new game on the stream id (a stream can be opened again when its game is over) */
+bool mux_open_stream(struct mux* mux, int id, int first_turn){
+    if(mux->role != HOST || id < 1 || id > mux->n_streams){
+        mini_log(ERROR, "mux_open_stream", -1, "Invalid parameters");
+        return false;
+    }
+
+    struct mux_stream* stream = &mux->streams[id - 1];
+
+    if(stream->open && stream->session.outcome == OUTCOME_NONE){
+        mini_log(ERROR, "mux_open_stream", -1, "The game on the stream is not over");
+        return false;
+    }
+
+    session_init(&stream->session, HOST, &mux_session_ops, stream);
+    stream->open = true;
+    session_open(&stream->session, first_turn);
+
+    return true;
+}
+
+/*  Reads what is available on the socket and delivers it to the streams. mux->finished lists the streams
+    whose game ended. Returns the number of messages delivered, or -1 if the connection is closed or broken. */
+int mux_receive(struct mux* mux){
+    unsigned char receive_buffer[MUX_WRITE_BATCH * MESSAGE_WIRE_SIZE];
+    int n_byte_read;
+    int delivered;
+
+    for(int i=0; i < mux->n_finished; ++i){
+        mux->streams[mux->finished[i] - 1].just_finished = false;
+    }
+    mux->n_finished = 0;
+
+    n_byte_read = recv(mux->socket, receive_buffer, sizeof(receive_buffer), 0);
+    if(n_byte_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return 0;
+    }
+    if(n_byte_read <= 0){
+        return -1;
+    }
+
+    delivered = parse_frames(&mux->parser, receive_buffer, n_byte_read, dispatch_to_stream, mux);
+    if(delivered < 0 || mux->failed){
+        mini_log(ERROR, "mux_receive", -1, "The message received is not correct!");
+        return -1;
+    }
+
+    return delivered;
+}
+
+/*  Writes the queued messages to the socket, one message of each ready stream at a time, so a stream with
+    many messages does not delay the others. What the socket does not take now is kept for the next call.
+    Returns false if the connection is broken. */
+bool mux_flush(struct mux* mux){
+    while(true){
+        if(mux->output_sent == mux->output_size){
+            mux->output_size = 0;
+            mux->output_sent = 0;
+
+            while(mux->output_size < (int)sizeof(mux->output) && mux->ready_size > 0){
+                struct mux_stream* stream = &mux->streams[mux->ready[mux->ready_head] - 1];
+
+                mux->ready_head = (mux->ready_head + 1) % mux->n_streams;
+                --mux->ready_size;
+
+                encode_message(&stream->queue[stream->queue_head], &mux->output[mux->output_size]);
+                mux->output_size += MESSAGE_WIRE_SIZE;
+                stream->queue_head = (stream->queue_head + 1) % MUX_STREAM_QUEUE_SIZE;
+                --stream->queue_size;
+
+                /* a stream with more messages goes back at the end of the list */
+                stream->ready = false;
+                if(stream->queue_size > 0){
+                    mark_ready(mux, stream);
+                }
+            }
+
+            if(mux->output_size == 0){
+                return true;
+            }
+        }
+
+        int n_byte_sent = send(mux->socket, &mux->output[mux->output_sent], mux->output_size - mux->output_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(n_byte_sent < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                return true;
+            }
+            if(errno == EINTR){
+                continue;
+            }
+            mini_log(ERROR, "mux_flush", -1, "Unable to send messages!");
+            return false;
+        }
+        mux->output_sent += n_byte_sent;
+    }
+}
+
+bool mux_has_output(const struct mux* mux){
+    return mux->output_sent < mux->output_size || mux->ready_size > 0;
+}
+
+static void bot_local_turn(struct session* session){
+    session_play_move(session, choose_bot_move(&session->board, session->state.role));
+}
+
+static const struct session_ops bot_player = {
+    .send = NULL,
+    .local_turn = bot_local_turn,
+    .remote_turn = NULL,
+    .finished = NULL
+};
+
+/*  Bot farm: two computer players play n_games over socket, n_streams games at a time. The host starts a new
+    game on every stream that becomes free and closes the connection at the end, the guest plays until then.
+    Returns the number of games played. */
+long long mux_play_bot_games(int socket, enum role role, long long n_games, int n_streams){
+    struct mux mux;
+    struct pollfd pfd;
+    long long games_started = 0;
+
+    if(!mux_init(&mux, socket, role, n_streams, &bot_player)){
+        return 0;
+    }
+
+    if(role == HOST){
+        for(int id=1; id <= n_streams && games_started < n_games; ++id){
+            mux_open_stream(&mux, id, (games_started % 2) + 1);
+            ++games_started;
+        }
+    }
+
+    pfd.fd = socket;
+
+    while(mux_flush(&mux)){
+        if(role == HOST && mux.games_finished >= n_games && !mux_has_output(&mux)){
+            break;
+        }
+
+        pfd.events = POLLIN | (mux_has_output(&mux) ? POLLOUT : 0);
+        if(poll(&pfd, 1, -1) < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+
+        if(pfd.revents & (POLLIN | POLLHUP | POLLERR)){
+            if(mux_receive(&mux) < 0){
+                break;
+            }
+
+            /* the streams that became free start the next games, alternating who moves first */
+            for(int i=0; role == HOST && i < mux.n_finished && games_started < n_games; ++i){
+                mux_open_stream(&mux, mux.finished[i], (games_started % 2) + 1);
+                ++games_started;
+            }
+        }
+    }
+
+    long long games_played = mux.games_finished;
+    mux_destroy(&mux);
+
+    return games_played;
+}
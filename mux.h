@@ -0,0 +1,71 @@
+#ifndef MUX_H
+#define MUX_H
+
+/* games that one connection can carry at the same time (stream ids from 1 to MUX_MAX_STREAMS) */
+#define MUX_MAX_STREAMS 4096
+
+/* messages a stream can have waiting to be sent */
+#define MUX_STREAM_QUEUE_SIZE 4
+
+/* messages written to the socket with one send */
+#define MUX_WRITE_BATCH 256
+
+#include <stdbool.h>
+
+#include "common.h"
+#include "communication.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+struct mux;
+
+/* One game carried by the connection */
+struct mux_stream{
+    int id;
+    bool open;
+    struct session session;
+    struct mux* mux;
+    struct message queue[MUX_STREAM_QUEUE_SIZE];
+    int queue_head;
+    int queue_size;
+    bool ready;                 /* the stream is in the ready list */
+    bool just_finished;         /* the game ended during the last mux_receive */
+};
+
+/*  Many games between the same two peers over one connection. The host opens the streams (the WELCOME of
+    an unknown stream opens it on the guest), every stream has its own session and its own outgoing queue,
+    and the output is scheduled round robin: one message of each ready stream at a time. */
+struct mux{
+    int socket;
+    enum role role;
+    const struct session_ops* player;       /* callbacks of every game; send is not used */
+    struct mux_stream* streams;             /* streams[id - 1] */
+    int n_streams;
+    int* ready;                             /* circular list of the streams with messages to send */
+    int ready_head;
+    int ready_size;
+    unsigned char output[MUX_WRITE_BATCH * MESSAGE_WIRE_SIZE];
+    int output_size;
+    int output_sent;
+    struct frame_parser parser;
+    int* finished;                          /* streams whose game ended during the last mux_receive */
+    int n_finished;
+    long long games_finished;
+    bool failed;
+};
+
+bool mux_init(struct mux* mux, int socket, enum role role, int n_streams, const struct session_ops* player);
+
+void mux_destroy(struct mux* mux);
+
+bool mux_open_stream(struct mux* mux, int id, int first_turn);
+
+int mux_receive(struct mux* mux);
+
+bool mux_flush(struct mux* mux);
+
+bool mux_has_output(const struct mux* mux);
+
+long long mux_play_bot_games(int socket, enum role role, long long n_games, int n_streams);
+
+#endif /* MUX_H */
@@ -3,6 +3,13 @@
 
 #include <stdbool.h>
 
+/* number of possible game fields: a field is sent as a base 3 number, one digit for each cell */
+#define BOARD_INDEX_COUNT 19683
+
+/*  version of the protocol announced in the opening sequence (the host in arg2 of WELCOME, the guest in arg1 of
+    its OK): the first version announced nothing, so a peer that sends 0 there is version 1 */
+#define PROTOCOL_VERSION 2
+
 enum comm{
     OK = 0,
     NO_RESYNC = 1,
@@ -14,7 +21,12 @@ enum comm{
     PLACE = 7,
     WIN = 8,
     SYNC_START = 9,
-    SYNC_FINISCHED = 10
+    SYNC_FINISCHED = 10,
+    RESUME = 11,
+    DRAW_OFFER = 12,
+    REMATCH = 13,
+    TOKEN = 14,
+    COMM_COUNT          /* not a message: number of enum comm values */
 };
 
 enum role{
@@ -29,7 +41,8 @@ enum phase{
     GAME_TURN_GUEST,
     GAME_TURN_HOST,
     GAME_END,
-    GAME_INTERRUPTED
+    GAME_INTERRUPTED,
+    PHASE_COUNT         /* not a phase: number of enum phase values */
 };
 
 struct gameState{
@@ -38,7 +51,12 @@ struct gameState{
     enum comm last_comm;
 };
 
+/*  Games carried by the same connection are told apart by the stream id (see mux.c).
+    Stream 0 is the only game of a connection that is not multiplexed. */
+#define MAX_STREAM_ID 0xffff
+
 struct message{
+    int stream;
     enum comm communication;
     int n_args;
     int arg1;
@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "render.h"
+#include "common.h"
+#include "gameLogic.h"
+
+/*  Drawing of the game on an ANSI terminal without spawning clear: the game field stays at the top of the
+    screen (the text below it scrolls in its own region), so a new frame only moves the cursor to the cells
+    that changed. Every frame is written with a single write. Without a terminal (or with TERM=dumb) the game
+    field is printed as plain text. */
+
+/* position of the game field (rows and columns from 1): an empty line, then 7 lines after two tabs */
+#define FIELD_FIRST_ROW 2
+#define FIELD_FIRST_COLUMN 17
+#define TEXT_FIRST_ROW (FIELD_FIRST_ROW + 7)
+
+#define RENDER_BUFFER_SIZE 512
+
+static char game_symbols[3] = {' ', 'x', 'o'};
+
+/* what is on the screen now */
+struct frame{
+    bool on_screen;         /* the game field is at the top, the scroll region starts below it */
+    int cells[9];
+};
+
+static struct frame frame;
+
+struct render_buffer{
+    char data[RENDER_BUFFER_SIZE];
+    int size;
+};
+
+static bool ansi_terminal(){
+    static int ansi = -1;
+
+    #ifdef DEBUG
+    return false;       /* the logs are not erased */
+    #endif
+
+    if(ansi < 0){
+        const char* term = getenv("TERM");
+        ansi = isatty(STDOUT_FILENO) && term != NULL && strcmp(term, "dumb") != 0;
+    }
+    return ansi;
+}
+
+static void append(struct render_buffer* buffer, const char* text){
+    int length = strlen(text);
+
+    if(buffer->size + length <= RENDER_BUFFER_SIZE){
+        memcpy(&buffer->data[buffer->size], text, length);
+        buffer->size += length;
+    }
+}
+
+static void append_cursor_move(struct render_buffer* buffer, int row, int column){
+    char sequence[16];
+
+    snprintf(sequence, sizeof(sequence), "\033[%d;%dH", row, column);
+    append(buffer, sequence);
+}
+
+/* Writes the frame after what stdio still holds, so the order on the screen is the same of the calls */
+static void flush_frame(const struct render_buffer* buffer){
+    int written = 0;
+
+    fflush(stdout);
+
+    while(written < buffer->size){
+        int n_byte_written = write(STDOUT_FILENO, &buffer->data[written], buffer->size - written);
+        if(n_byte_written < 0 && errno == EINTR){
+            continue;
+        }
+        if(n_byte_written <= 0){
+            return;
+        }
+        written += n_byte_written;
+    }
+}
+
+void render_clear_screen(){
+    if(ansi_terminal()){
+        struct render_buffer buffer = {.size = 0};
+
+        /* also the scroll region of the game is reset */
+        append(&buffer, "\033[r\033[H\033[2J\033[3J");
+        flush_frame(&buffer);
+    }
+
+    frame.on_screen = false;
+}
+
+/*  Shows the game field at the top of a clean screen, with the cursor on the line below it: only the
+    cells that changed since the last frame are drawn again */
+void render_game_field(const struct board* board){
+    struct render_buffer buffer = {.size = 0};
+    char text[64];
+
+    if(!ansi_terminal()){
+        print_game_field(board);
+        return;
+    }
+
+    if(frame.on_screen){
+        for(int pos=0; pos < 9; ++pos){
+            if(frame.cells[pos] != board->cells[pos]){
+                append_cursor_move(&buffer, FIELD_FIRST_ROW + 1 + (pos / 3) * 2, FIELD_FIRST_COLUMN + 2 + (pos % 3) * 4);
+                text[0] = game_symbols[board->cells[pos]];
+                text[1] = '\0';
+                append(&buffer, text);
+            }
+        }
+
+        /* the text of the last turn is erased */
+        append_cursor_move(&buffer, TEXT_FIRST_ROW, 1);
+        append(&buffer, "\033[J");
+    }
+    else{
+        append(&buffer, "\033[r\033[H\033[2J\033[3J\n");
+
+        for(int row=0; row < 3; ++row){
+            append(&buffer, "\t\t+---+---+---+\n");
+
+            snprintf(text, sizeof(text), "\t\t| %c | %c | %c |\n", game_symbols[board->cells[row * 3]],
+                game_symbols[board->cells[row * 3 + 1]], game_symbols[board->cells[row * 3 + 2]]);
+            append(&buffer, text);
+        }
+        append(&buffer, "\t\t+---+---+---+\n");
+
+        /* from now on only the lines below the game field scroll (setting the region moves the cursor) */
+        snprintf(text, sizeof(text), "\033[%dr", TEXT_FIRST_ROW);
+        append(&buffer, text);
+        append_cursor_move(&buffer, TEXT_FIRST_ROW, 1);
+
+        frame.on_screen = true;
+    }
+
+    memcpy(frame.cells, board->cells, sizeof(frame.cells));
+    flush_frame(&buffer);
+}
+
+/* The game is over: the whole screen scrolls again, the text on it is kept */
+void render_release(){
+    if(frame.on_screen){
+        struct render_buffer buffer = {.size = 0};
+
+        append(&buffer, "\0337\033[r\0338");
+        flush_frame(&buffer);
+
+        frame.on_screen = false;
+    }
+}
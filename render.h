@@ -0,0 +1,14 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+
+struct board;
+
+void render_clear_screen();
+
+void render_game_field(const struct board* board);
+
+void render_release();
+
+#endif /* RENDER_H */
@@ -0,0 +1,321 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "clock.h"
+#include "common.h"
+#include "communication.h"
+#include "gameLogic.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+/*  Plays a capture written with --capture again through the protocol engine, without a network. Every
+    connection of the capture gets a new session: the received messages are validated and handled as the
+    connection manager and the game thread do, the messages the local player sent (moves, draw offers,
+    rematches, leaving) are its decisions, and every message the engine sends must be the next one sent in
+    the capture. A message that is not correct, or an engine that does not send what was captured, is reported
+    with the number of its record. By default the capture is replayed as fast as possible (--repeat N replays it
+    N times, to measure the engine), with --paced it takes the time it took when it was captured.
+    Usage: tris_replay [--paced] [--repeat N] FILE */
+
+/* the problems reported in detail, the others are only counted */
+#define REPLAY_MAX_REPORTS 16
+
+struct replay{
+    const struct capture_entry* entries;
+    int n_entries;
+    int next_sent;                  /* the next record sent that the engine has not sent again yet */
+    int end;                        /* the first record of the next connection */
+    bool stopped;                   /* the connection manager would have closed the connection */
+    bool report;                    /* the problems of this pass are printed */
+};
+
+struct replay_stats{
+    long long connections;
+    long long messages;
+    long long invalid;
+    long long divergences;
+    long long results;
+    long long left;
+    long long protocol_errors;
+};
+
+static struct replay_stats stats;
+static int n_reports;
+
+static const char* const kind_names[] = {
+    [CAPTURE_SENT] = "sent",
+    [CAPTURE_RECEIVED] = "received",
+    [CAPTURE_CONNECTION] = "connection",
+    [CAPTURE_RESUMED] = "resumed"
+};
+
+static void report(struct replay* replay, int index, const char* problem){
+    struct message msg;
+
+    if(!replay->report || n_reports++ >= REPLAY_MAX_REPORTS){
+        return;
+    }
+
+    decode_message(replay->entries[index].frame, &msg);
+    printf("{\"record\": %d, \"kind\": \"%s\", \"time_us\": %lld, \"problem\": \"%s\", \"stream\": %d, \"comm\": %d, \"n_args\": %d, \"arg1\": %d, \"arg2\": %d}\n",
+        index, kind_names[replay->entries[index].kind], replay->entries[index].time_us, problem, msg.stream, (int)msg.communication, msg.n_args, msg.arg1, msg.arg2);
+}
+
+/* Moves next_sent to the next record sent by the connection being replayed (or to its end) */
+static void find_next_sent(struct replay* replay, int from){
+    replay->next_sent = from;
+    while(replay->next_sent < replay->end && replay->entries[replay->next_sent].kind != CAPTURE_SENT){
+        ++replay->next_sent;
+    }
+}
+
+/* --- the session callbacks: the engine only has to send the same messages --- */
+
+static void replay_send(struct session* session, struct message* msg){
+    struct replay* replay = session->context;
+    unsigned char frame[MESSAGE_WIRE_SIZE];
+
+    if(replay->stopped){
+        return;
+    }
+
+    encode_message(msg, frame);
+    if(replay->next_sent >= replay->end || memcmp(frame, replay->entries[replay->next_sent].frame, MESSAGE_WIRE_SIZE) != 0){
+        report(replay, replay->next_sent < replay->end ? replay->next_sent : replay->end - 1, "the engine sent another message");
+        ++stats.divergences;
+        replay->stopped = true;
+        return;
+    }
+
+    find_next_sent(replay, replay->next_sent + 1);
+}
+
+static void replay_turn(struct session* session){
+    (void)session;
+}
+
+static void replay_finished(struct session* session, enum outcome outcome){
+    (void)session;
+
+    if(outcome == OUTCOME_PROTOCOL_ERROR){
+        ++stats.protocol_errors;
+    }
+    else if(outcome == OUTCOME_LEFT || outcome == OUTCOME_PEER_LEFT){
+        ++stats.left;
+    }
+    else{
+        ++stats.results;
+    }
+}
+
+/* the answers to draw offers and rematches are sent messages of the capture */
+static void replay_decision(struct session* session){
+    (void)session;
+}
+
+static const struct session_ops replay_session_ops = {
+    .send = replay_send,
+    .local_turn = replay_turn,
+    .remote_turn = replay_turn,
+    .finished = replay_finished,
+    .draw_offered = replay_decision,
+    .rematch = replay_decision,
+    .restarted = replay_decision
+};
+
+/* The session token the host sent with TOKEN in the connection being replayed, 0 if it sent none */
+static int captured_token(const struct replay* replay){
+    struct message msg;
+
+    for(int i=replay->next_sent; i < replay->end; ++i){
+        if(replay->entries[i].kind == CAPTURE_SENT){
+            decode_message(replay->entries[i].frame, &msg);
+            if(msg.communication == TOKEN){
+                return msg.arg1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* The local player made the decision that sent msg: it is made again, so the engine sends msg again */
+static void replay_decision_of(struct session* session, const struct message* msg){
+    switch(msg->communication){
+        case WELCOME:
+            if(session_can_rematch(session)){
+                session_request_rematch(session);
+            }
+            else{
+                session->token = captured_token(session->context);
+                session_open(session, msg->arg1);
+            }
+        break;
+        case PLACE:
+            session_play_move(session, msg->arg1);
+        break;
+        case DRAW_OFFER:
+            session_offer_draw(session);
+        break;
+        case OK:
+        case DENIED:
+            session_answer_draw(session, msg->communication == OK);
+        break;
+        case REMATCH:
+            session_request_rematch(session);
+        break;
+        case DISCONNECT:
+            session_leave(session);
+        break;
+        default:
+        break;
+    }
+}
+
+/* Replays the connection that begins at record first. Returns the first record of the next one */
+static int replay_connection(struct replay* replay, int first, long long* paced_us){
+    struct session session;
+    struct message msg;
+    int role, turn, board_index;
+
+    replay->end = first + 1;
+    while(replay->end < replay->n_entries && replay->entries[replay->end].kind != CAPTURE_CONNECTION){
+        ++replay->end;
+    }
+
+    capture_marker_values(&replay->entries[first], &role, &turn);
+    session_init(&session, role == HOST ? HOST : GUEST, &replay_session_ops, replay);
+    replay->stopped = false;
+    find_next_sent(replay, first + 1);
+    ++stats.connections;
+
+    for(int i=first + 1; i < replay->end && !replay->stopped; ++i){
+        const struct capture_entry* entry = &replay->entries[i];
+
+        if(paced_us != NULL){
+            if(entry->time_us > *paced_us){
+                clock_sleep((int)((entry->time_us - *paced_us) / 1000));
+            }
+            *paced_us = entry->time_us;
+        }
+
+        switch(entry->kind){
+            case CAPTURE_RECEIVED:
+                ++stats.messages;
+                decode_message(entry->frame, &msg);
+
+                if(!validate_message(&msg) || msg.stream != 0){
+                    /* the connection manager closes the connection: "The message received is not correct!" */
+                    report(replay, i, "the message received is not correct");
+                    ++stats.invalid;
+                    replay->stopped = true;
+                }
+                else{
+                    session_handle_message(&session, &msg);
+                }
+            break;
+            case CAPTURE_SENT:
+                ++stats.messages;
+                if(i < replay->next_sent){
+                    break;      /* the engine has already sent it */
+                }
+
+                decode_message(entry->frame, &msg);
+                replay_decision_of(&session, &msg);
+
+                if(!replay->stopped && replay->next_sent == i){
+                    report(replay, i, "the engine did not send it");
+                    ++stats.divergences;
+                    replay->stopped = true;
+                }
+            break;
+            case CAPTURE_RESUMED:
+                capture_marker_values(entry, &board_index, &turn);
+                if(!session_resume(&session, board_index, turn == HOST ? HOST : GUEST)){
+                    report(replay, i, "the game field cannot be resumed");
+                    ++stats.divergences;
+                    replay->stopped = true;
+                }
+            break;
+            default:
+            break;
+        }
+    }
+
+    return replay->end;
+}
+
+static void replay_capture(struct replay* replay, bool paced){
+    long long paced_us = 0;
+    int i = 0;
+
+    /* the records before the first connection (none, if the capture is complete) are skipped */
+    while(i < replay->n_entries && replay->entries[i].kind != CAPTURE_CONNECTION){
+        ++i;
+    }
+
+    while(i < replay->n_entries){
+        i = replay_connection(replay, i, paced ? &paced_us : NULL);
+    }
+}
+
+int main(int argc, char* argv[]){
+    struct replay replay;
+    struct capture_entry* entries;
+    struct timespec start, end;
+    const char* path = NULL;
+    bool paced = false;
+    int repeat = 1;
+    int n_entries;
+    double seconds;
+
+    for(int i=1; i < argc; ++i){
+        if(strcmp(argv[i], "--paced") == 0){
+            paced = true;
+        }
+        else if(strcmp(argv[i], "--repeat") == 0 && i + 1 < argc){
+            repeat = atoi(argv[++i]);
+        }
+        else if(path == NULL && argv[i][0] != '-'){
+            path = argv[i];
+        }
+        else{
+            path = NULL;
+            break;
+        }
+    }
+
+    if(path == NULL || repeat < 1){
+        fprintf(stderr, "Usage: %s [--paced] [--repeat N] FILE\n", argv[0]);
+        return 2;
+    }
+
+    n_entries = capture_load(path, &entries);
+    if(n_entries < 0){
+        fprintf(stderr, "%s: %s is not a capture file that can be read\n", argv[0], path);
+        return 2;
+    }
+
+    replay.entries = entries;
+    replay.n_entries = n_entries;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(int pass=0; pass < repeat; ++pass){
+        replay.report = pass == 0;
+        replay_capture(&replay, paced);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("{\n  \"records\": %d,\n  \"passes\": %d,\n  \"connections\": %lld,\n  \"messages\": %lld,\n",
+        n_entries, repeat, stats.connections, stats.messages);
+    printf("  \"results\": %lld,\n  \"left\": %lld,\n  \"protocol_errors\": %lld,\n  \"invalid\": %lld,\n  \"divergences\": %lld,\n",
+        stats.results, stats.left, stats.protocol_errors, stats.invalid, stats.divergences);
+    printf("  \"seconds\": %.6f,\n  \"messages_per_second\": %.0f\n}\n", seconds, seconds > 0 ? stats.messages / seconds : 0);
+
+    free(entries);
+    return stats.invalid == 0 && stats.divergences == 0 ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "resume.h"
+#include "minilogger.h"
+#include "common.h"
+#include "communication.h"
+#include "eventLoop.h"
+#include "server.h"
+
+/*  Resumption of a game after the tcp connection is lost. The host gave a token to the guest with TOKEN (after the
+    OK to its WELCOME): the guest connects again to the same port and sends RESUME with the token, the host answers
+    with SYNC_FINISCHED carrying the game field and who moves, so both restart from the same turn. */
+
+/* host: the port of the game stays open while playing, so the guest can come back even if the host did not see the connection break */
+int resume_listen_socket = -1;
+int resume_token = 0;
+
+/* host: connection of the guest that came back, accepted by the connection manager */
+int resumed_socket = -1;
+
+/* A random token, never 0 (0 means that the game cannot be resumed) */
+int new_session_token(){
+    unsigned int token = 0;
+
+    while(token == 0){
+        if(getrandom(&token, sizeof(token), 0) != sizeof(token)){
+            struct timespec now;
+
+            get_current_time_in_timespec(&now);
+            token = (unsigned int)now.tv_nsec ^ (unsigned int)getpid();
+        }
+        token &= 0x7fffffff;
+    }
+
+    return (int)token;
+}
+
+static bool send_one_message(int socket, struct message* msg){
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+
+    encode_message(msg, buffer);
+    return send(socket, buffer, MESSAGE_WIRE_SIZE, MSG_NOSIGNAL) == MESSAGE_WIRE_SIZE;
+}
+
+/* Reads one valid message, waiting at most timeout_ms milliseconds */
+static bool receive_one_message(int socket, struct message* msg, int timeout_ms){
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+    int received = 0;
+    struct timespec deadline;
+
+    get_absolute_time_with_offset(timeout_ms, &deadline);
+
+    while(received < MESSAGE_WIRE_SIZE){
+        enum event event = wait_for_event(socket, ms_until(&deadline), NULL, 0);
+
+        if(event == EVENT_TIMEOUT || event == EVENT_ERROR){
+            return false;
+        }
+        if(event != EVENT_READABLE){
+            continue;
+        }
+
+        int n_byte_read = recv(socket, &buffer[received], MESSAGE_WIRE_SIZE - received, MSG_DONTWAIT);
+        if(n_byte_read == 0 || (n_byte_read < 0 && errno != EAGAIN && errno != EINTR)){
+            return false;
+        }
+        if(n_byte_read > 0){
+            received += n_byte_read;
+        }
+    }
+
+    decode_message(buffer, msg);
+    return msg->stream == 0 && validate_message(msg);
+}
+
+/*  Accepts a connection waiting on listen_socket without waiting for its RESUME, that is read by
+    continue_resume when the connection is readable. Returns false if there was nothing to accept. */
+bool start_resume(struct pending_resume* pending, int listen_socket){
+    pending->socket = accept(listen_socket, NULL, NULL);
+    pending->received = 0;
+    get_absolute_time_with_offset(RESUME_HANDSHAKE_TIMEOUT, &pending->deadline);
+
+    return pending->socket >= 0;
+}
+
+/* Refuses the pending connection with DENIED */
+void refuse_resume(struct pending_resume* pending){
+    struct message msg;
+
+    prepare_message(&msg, DENIED, 0, 0, 0);
+    send_one_message(pending->socket, &msg);
+    close(pending->socket);
+    pending->socket = -1;
+}
+
+/*  Reads what the pending connection sent, without blocking. Returns the connection if it is the guest coming back
+    with the token; otherwise -1, and pending->socket is -1 too if the connection was refused. */
+int continue_resume(struct pending_resume* pending, int token){
+    struct message msg;
+    int n_byte_read = recv(pending->socket, &pending->buffer[pending->received], MESSAGE_WIRE_SIZE - pending->received, MSG_DONTWAIT);
+
+    if(n_byte_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+        return -1;
+    }
+    if(n_byte_read <= 0){
+        close(pending->socket);
+        pending->socket = -1;
+        return -1;
+    }
+
+    pending->received += n_byte_read;
+    if(pending->received < MESSAGE_WIRE_SIZE){
+        return -1;
+    }
+
+    decode_message(pending->buffer, &msg);
+    if(msg.stream == 0 && validate_message(&msg) && msg.communication == RESUME && msg.arg1 == token){
+        int guest_socket = pending->socket;
+
+        pending->socket = -1;
+        return guest_socket;
+    }
+
+    refuse_resume(pending);
+    return -1;
+}
+
+/*  Accepts a connection waiting on listen_socket: if it is the guest coming back with the token returns it,
+    otherwise the connection is refused with DENIED and -1 is returned. */
+int accept_resume(int listen_socket, int token){
+    struct pending_resume pending;
+    int guest_socket = -1;
+
+    if(!start_resume(&pending, listen_socket)){
+        return -1;
+    }
+
+    while(guest_socket < 0 && pending.socket >= 0){
+        enum event event = wait_for_event(pending.socket, ms_until(&pending.deadline), NULL, 0);
+
+        if(event == EVENT_TIMEOUT || event == EVENT_ERROR){
+            refuse_resume(&pending);
+        }
+        else if(event == EVENT_READABLE){
+            guest_socket = continue_resume(&pending, token);
+        }
+    }
+
+    return guest_socket;
+}
+
+/*  Host: waits on listen_socket for the guest to come back with the token, for at most RESUME_GRACE_PERIOD
+    milliseconds (the user can give up by writing 0). Returns the new connection or -1. */
+int wait_for_resume(int listen_socket, int token){
+    int connection_socket = -1;
+    struct timespec deadline;
+    char line[INPUT_LINE_SIZE];
+    enum event event;
+
+    printf("\n\n\tThe connection with the other player was lost, waiting for them to come back... (input 0 to leave)\n");
+    fflush(stdout);
+
+    get_absolute_time_with_offset(RESUME_GRACE_PERIOD, &deadline);
+
+    while(connection_socket < 0 && ms_until(&deadline) > 0){
+        event = wait_for_event(listen_socket, ms_until(&deadline), line, sizeof(line));
+
+        if((event == EVENT_INPUT && strcmp(line, "0") == 0) || event == EVENT_INPUT_CLOSED || event == EVENT_ERROR){
+            break;
+        }
+        if(event == EVENT_READABLE){
+            connection_socket = accept_resume(listen_socket, token);
+        }
+    }
+
+    return connection_socket;
+}
+
+/* Host: tells the guest that came back the game field and who moves */
+bool send_resume_state(int connection_socket, int board_index, enum role turn){
+    struct message msg;
+
+    prepare_message(&msg, SYNC_FINISCHED, 2, board_index, turn);
+    return send_one_message(connection_socket, &msg);
+}
+
+/*  Guest: connects again to the host and asks to resume the game with the token, retrying every
+    RESUME_RETRY_INTERVAL milliseconds while the host keeps the game. On success returns the new connection
+    and writes the game field and who moves, otherwise returns -1. */
+int resume_as_guest(const struct sockaddr_in* host_address, int token, int* board_index, enum role* turn){
+    struct timespec deadline;
+    struct message msg;
+    char line[INPUT_LINE_SIZE];
+    enum event event;
+
+    printf("\n\n\tThe connection with the other player was lost, trying to resume the game... (input 0 to leave)\n");
+    fflush(stdout);
+
+    get_absolute_time_with_offset(RESUME_GRACE_PERIOD, &deadline);
+
+    while(ms_until(&deadline) > 0){
+        int connection_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if(connection_socket < 0){
+            mini_log(ERROR, "resume_as_guest", -1, "Unable to create the tcp socket");
+            return -1;
+        }
+
+        if(connect_with_timeout(connection_socket, host_address, RESUME_HANDSHAKE_TIMEOUT) < 0){
+            if(errno == ECONNREFUSED){
+                /* the host keeps its port open for the whole game: it has left */
+                close(connection_socket);
+                return -1;
+            }
+        }
+        else{
+            prepare_message(&msg, RESUME, 1, token, 0);
+
+            if(send_one_message(connection_socket, &msg) && receive_one_message(connection_socket, &msg, RESUME_HANDSHAKE_TIMEOUT)){
+                if(msg.communication == SYNC_FINISCHED){
+                    *board_index = msg.arg1;
+                    *turn = (enum role)msg.arg2;
+                    return connection_socket;
+                }
+                if(msg.communication == DENIED){
+                    close(connection_socket);
+                    return -1;      /* the host does not have the game anymore */
+                }
+            }
+        }
+        close(connection_socket);
+
+        /* wait before the next attempt, the user can give up meanwhile */
+        event = wait_for_event(-1, RESUME_RETRY_INTERVAL, line, sizeof(line));
+        if((event == EVENT_INPUT && strcmp(line, "0") == 0) || event == EVENT_INPUT_CLOSED || event == EVENT_ERROR){
+            return -1;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,48 @@
+#ifndef RESUME_H
+#define RESUME_H
+
+/* milliseconds the host keeps a game after the connection is lost, waiting for the guest to come back */
+#define RESUME_GRACE_PERIOD 30000
+
+/* milliseconds between two attempts of the guest to reconnect */
+#define RESUME_RETRY_INTERVAL 250
+
+/* milliseconds a peer waits for the other one during the resumption handshake */
+#define RESUME_HANDSHAKE_TIMEOUT 2000
+
+#include <stdbool.h>
+#include <netinet/in.h>
+
+#include "common.h"
+#include "communication.h"
+#include "protocol.h"
+
+/* host: a connection on the port of the game that has not sent its RESUME yet */
+struct pending_resume{
+    int socket;
+    int received;
+    unsigned char buffer[MESSAGE_WIRE_SIZE];
+    struct timespec deadline;
+};
+
+extern int resume_listen_socket;
+extern int resume_token;
+extern int resumed_socket;
+
+int new_session_token();
+
+int accept_resume(int listen_socket, int token);
+
+bool start_resume(struct pending_resume* pending, int listen_socket);
+
+int continue_resume(struct pending_resume* pending, int token);
+
+void refuse_resume(struct pending_resume* pending);
+
+int wait_for_resume(int listen_socket, int token);
+
+bool send_resume_state(int connection_socket, int board_index, enum role turn);
+
+int resume_as_guest(const struct sockaddr_in* host_address, int token, int* board_index, enum role* turn);
+
+#endif /* RESUME_H */
@@ -0,0 +1,362 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gameLogic.h"
+#include "protocol.h"
+#include "tablebase.h"
+
+/*  Generator of labelled games for tuning the bots: every core plays games against itself and writes every
+    position with the move played and the result of the game. The threads share nothing but the offset of the
+    file: each one has its own random generator and its own buffer, written with pwrite when it is full.
+    The end of the games is decided by check_victory and check_draw, as in a real game.
+    Usage: tris_selfplay [--policy random|epsilon|engine] [--epsilon E] [--games N] [--threads N] [--seed S] FILE
+
+    The file begins with a header of SELFPLAY_HEADER_SIZE bytes (SELFPLAY_MAGIC, then as 32 bit little endian
+    numbers the size of a record, the policy, epsilon in millionths and the threads, then the seed on 64 bits),
+    followed by a record of 4 bytes for each position:
+        bytes 0-1   the game field before the move, as a base 3 number (see board_to_index)
+        byte 2      the cell of the move (from 0 to 8) in the low 4 bits, the player (1 host, 2 guest) in the high ones
+        byte 3      the result of the game (1 host won, 2 guest won, 3 draw) in the low 4 bits, the move number
+                    (from 0) in the high ones
+    The records of a game are consecutive, the games of the threads are mixed a buffer at a time. */
+
+#define SELFPLAY_MAGIC "TRISSP1"
+#define SELFPLAY_HEADER_SIZE 32
+#define SELFPLAY_RECORD_SIZE 4
+
+/* records written by a thread at once */
+#define SELFPLAY_BUFFER_RECORDS (256 * 1024)
+
+#define SELFPLAY_MAX_THREADS 256
+
+enum policy{
+    POLICY_RANDOM,          /* any free cell */
+    POLICY_EPSILON,         /* a random cell with probability epsilon, otherwise one of the best moves */
+    POLICY_ENGINE           /* one of the best moves of the tablebase */
+};
+
+static const char* const policy_names[] = {
+    [POLICY_RANDOM] = "random",
+    [POLICY_EPSILON] = "epsilon",
+    [POLICY_ENGINE] = "engine"
+};
+
+struct selfplay_config{
+    enum policy policy;
+    unsigned int epsilon;               /* millionths */
+    long long games;
+    int n_threads;
+    unsigned long long seed;
+    int fd;
+};
+
+static struct selfplay_config config = {
+    .policy = POLICY_EPSILON,
+    .epsilon = 100000,
+    .games = 10000000,
+    .n_threads = 0,
+    .seed = 1,
+    .fd = -1
+};
+
+/* the only data shared by the threads: where the next buffer is written */
+static long long file_offset = SELFPLAY_HEADER_SIZE;
+
+struct worker{
+    pthread_t tid;
+    long long games;
+    unsigned long long random_state;
+    unsigned char* buffer;
+    int n_records;
+    bool failed;
+    /* what this thread played */
+    long long positions;
+    long long results[4];               /* indexed by the result of check_victory, 3 for a draw */
+};
+
+static unsigned long long splitmix64(unsigned long long x){
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* xorshift64*: 32 random bits */
+static unsigned int next_random(struct worker* worker){
+    unsigned long long x = worker->random_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    worker->random_state = x;
+
+    return (unsigned int)((x * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+/* One of the cells set in cells (bit i for cell i), chosen at random */
+static int random_cell(struct worker* worker, int cells){
+    int n_cells = __builtin_popcount(cells);
+    int chosen = (int)(((unsigned long long)next_random(worker) * n_cells) >> 32);
+
+    while(chosen-- > 0){
+        cells &= cells - 1;
+    }
+    return __builtin_ctz(cells);
+}
+
+static int free_cells(const struct board* board){
+    int cells = 0;
+
+    for(int pos=0; pos < 9; ++pos){
+        if(board->cells[pos] == 0){
+            cells |= 1 << pos;
+        }
+    }
+    return cells;
+}
+
+static int choose_move(struct worker* worker, const struct board* board, int symbol){
+    int cells = free_cells(board);
+    int best;
+
+    if(config.policy == POLICY_RANDOM ||
+        (config.policy == POLICY_EPSILON && (unsigned int)(((unsigned long long)next_random(worker) * 1000000) >> 32) < config.epsilon)){
+        return random_cell(worker, cells);
+    }
+
+    best = best_moves(board, symbol);
+    return random_cell(worker, best != 0 ? best : cells);
+}
+
+static bool flush_buffer(struct worker* worker){
+    long long size = (long long)worker->n_records * SELFPLAY_RECORD_SIZE;
+    long long offset = __atomic_fetch_add(&file_offset, size, __ATOMIC_RELAXED);
+    long long written = 0;
+
+    while(written < size){
+        ssize_t n_bytes = pwrite(config.fd, worker->buffer + written, size - written, offset + written);
+
+        if(n_bytes < 0 && errno == EINTR){
+            continue;
+        }
+        if(n_bytes <= 0){
+            return false;
+        }
+        written += n_bytes;
+    }
+
+    worker->n_records = 0;
+    return true;
+}
+
+/* Plays a game and appends its positions to the buffer of the thread */
+static bool play_game(struct worker* worker){
+    struct board board;
+    unsigned char* records;
+    int symbol = HOST;
+    int n_moves = 0;
+    int result = 0;
+
+    if(worker->n_records + 9 > SELFPLAY_BUFFER_RECORDS && !flush_buffer(worker)){
+        return false;
+    }
+    records = worker->buffer + (long long)worker->n_records * SELFPLAY_RECORD_SIZE;
+
+    clear_board(&board);
+
+    while(result == 0){
+        int index = board_to_index(&board);
+        int cell = choose_move(worker, &board, symbol);
+        unsigned char* record = &records[n_moves * SELFPLAY_RECORD_SIZE];
+
+        record[0] = index & 0xff;
+        record[1] = (index >> 8) & 0xff;
+        record[2] = (unsigned char)(cell | (symbol << 4));
+        record[3] = (unsigned char)(n_moves << 4);
+
+        place_symbol(&board, cell, symbol);
+        ++n_moves;
+
+        /* the same decision of a real game */
+        result = check_victory(&board);
+        if(result == 0 && check_draw(&board)){
+            result = 3;
+        }
+        symbol = symbol == HOST ? GUEST : HOST;
+    }
+
+    for(int i=0; i < n_moves; ++i){
+        records[i * SELFPLAY_RECORD_SIZE + 3] |= result;
+    }
+
+    worker->n_records += n_moves;
+    worker->positions += n_moves;
+    ++worker->results[result];
+    return true;
+}
+
+static void* run_worker(void* argument){
+    struct worker* worker = argument;
+
+    for(long long game=0; game < worker->games; ++game){
+        if(!play_game(worker)){
+            worker->failed = true;
+            return NULL;
+        }
+    }
+
+    if(worker->n_records > 0 && !flush_buffer(worker)){
+        worker->failed = true;
+    }
+    return NULL;
+}
+
+static void write_le(unsigned char* buffer, unsigned long long value, int size){
+    for(int i=0; i < size; ++i){
+        buffer[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static bool write_header(){
+    unsigned char header[SELFPLAY_HEADER_SIZE];
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, SELFPLAY_MAGIC, sizeof(SELFPLAY_MAGIC));
+    write_le(&header[8], SELFPLAY_RECORD_SIZE, 4);
+    write_le(&header[12], config.policy, 4);
+    write_le(&header[16], config.epsilon, 4);
+    write_le(&header[20], config.n_threads, 4);
+    write_le(&header[24], config.seed, 8);
+
+    return pwrite(config.fd, header, sizeof(header), 0) == sizeof(header);
+}
+
+static bool parse_options(int argc, char* argv[], const char** path){
+    *path = NULL;
+
+    for(int i=1; i < argc; ++i){
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if(strcmp(argv[i], "--policy") == 0 && value != NULL){
+            if(strcmp(value, "random") == 0){
+                config.policy = POLICY_RANDOM;
+            }
+            else if(strcmp(value, "epsilon") == 0){
+                config.policy = POLICY_EPSILON;
+            }
+            else if(strcmp(value, "engine") == 0){
+                config.policy = POLICY_ENGINE;
+            }
+            else{
+                return false;
+            }
+            ++i;
+        }
+        else if(strcmp(argv[i], "--epsilon") == 0 && value != NULL){
+            double epsilon = atof(value);
+
+            if(epsilon < 0 || epsilon > 1){
+                return false;
+            }
+            config.epsilon = (unsigned int)(epsilon * 1000000);
+            ++i;
+        }
+        else if(strcmp(argv[i], "--games") == 0 && value != NULL){
+            config.games = atoll(value);
+            ++i;
+        }
+        else if(strcmp(argv[i], "--threads") == 0 && value != NULL){
+            config.n_threads = atoi(value);
+            ++i;
+        }
+        else if(strcmp(argv[i], "--seed") == 0 && value != NULL){
+            config.seed = strtoull(value, NULL, 10);
+            ++i;
+        }
+        else if(*path == NULL && argv[i][0] != '-'){
+            *path = argv[i];
+        }
+        else{
+            return false;
+        }
+    }
+
+    return *path != NULL && config.games > 0 && config.n_threads >= 0 && config.n_threads <= SELFPLAY_MAX_THREADS;
+}
+
+int main(int argc, char* argv[]){
+    static struct worker workers[SELFPLAY_MAX_THREADS];
+    struct timespec start, end;
+    const char* path;
+    long long games = 0, positions = 0, results[4] = {0, 0, 0, 0};
+    double seconds;
+    bool failed = false;
+
+    if(!parse_options(argc, argv, &path)){
+        fprintf(stderr, "Usage: %s [--policy random|epsilon|engine] [--epsilon E] [--games N] [--threads N] [--seed S] FILE\n", argv[0]);
+        return 2;
+    }
+
+    if(config.n_threads == 0){
+        long n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        config.n_threads = n_cores < 1 ? 1 : (n_cores > SELFPLAY_MAX_THREADS ? SELFPLAY_MAX_THREADS : (int)n_cores);
+    }
+
+    config.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(config.fd < 0 || !write_header()){
+        fprintf(stderr, "%s: unable to write %s\n", argv[0], path);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(int i=0; i < config.n_threads; ++i){
+        struct worker* worker = &workers[i];
+
+        worker->games = config.games / config.n_threads + (i < config.games % config.n_threads ? 1 : 0);
+        worker->random_state = splitmix64(config.seed ^ splitmix64(i)) | 1;
+        worker->buffer = malloc(SELFPLAY_BUFFER_RECORDS * SELFPLAY_RECORD_SIZE);
+
+        if(worker->buffer == NULL || pthread_create(&worker->tid, NULL, run_worker, worker) != 0){
+            fprintf(stderr, "%s: unable to start the threads\n", argv[0]);
+            return 1;
+        }
+    }
+
+    for(int i=0; i < config.n_threads; ++i){
+        struct worker* worker = &workers[i];
+
+        pthread_join(worker->tid, NULL);
+        free(worker->buffer);
+
+        failed = failed || worker->failed;
+        games += worker->games;
+        positions += worker->positions;
+        for(int r=1; r <= 3; ++r){
+            results[r] += worker->results[r];
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if(close(config.fd) < 0 || failed){
+        fprintf(stderr, "%s: unable to write %s\n", argv[0], path);
+        return 1;
+    }
+
+    printf("{\n  \"policy\": \"%s\",\n  \"epsilon\": %.6f,\n  \"threads\": %d,\n  \"seed\": %llu,\n",
+        policy_names[config.policy], config.epsilon / 1e6, config.n_threads, config.seed);
+    printf("  \"games\": %lld,\n  \"positions\": %lld,\n  \"host_won\": %lld,\n  \"guest_won\": %lld,\n  \"draws\": %lld,\n",
+        games, positions, results[HOST], results[GUEST], results[3]);
+    printf("  \"seconds\": %.3f,\n  \"positions_per_minute\": %.0f\n}\n", seconds, seconds > 0 ? positions * 60 / seconds : 0);
+
+    return 0;
+}
@@ -0,0 +1,887 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "server.h"
+#include "minilogger.h"
+#include "admission.h"
+#include "common.h"
+#include "communication.h"
+#include "eventLoop.h"
+#include "gameLogic.h"
+#include "handoff.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+/* A guest playing against the server */
+struct connection{
+    int socket;
+    in_addr_t ip;
+    struct shard* shard;
+    long long deadline_ms;      /* the guest is dropped if it has not answered by then */
+    struct session session;
+    struct frame_parser parser;
+    unsigned char output[SERVER_OUTPUT_BUFFER_SIZE];
+    int output_size;
+    bool closing;
+    struct connection* prev;
+    struct connection* next;
+};
+
+const struct server_limits server_default_limits = {
+    .connections_per_second = 20,
+    .connection_burst = 40,
+    .max_sessions = 65536,
+    .handshake_timeout = HANDSHAKE_TIMEOUT,
+    .idle_timeout = TURN_TIMEOUT + TURN_TIMEOUT_MARGIN
+};
+
+static long long monotonic_us(){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Counts the time the guest waited for its answer, since the loop woke up for its message */
+static void record_latency(struct shard* shard){
+    long long latency = monotonic_us() - shard->wake_us;
+    int bucket = 0;
+
+    while(latency > 1 && bucket < SERVER_LATENCY_BUCKETS - 1){
+        latency >>= 1;
+        ++bucket;
+    }
+    __atomic_store_n(&shard->latencies[bucket], shard->latencies[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+/*  Creates a non-blocking tcp socket listening on port (0 chooses a free port) with a backlog of SERVER_BACKLOG.
+    With reuse_port more sockets can listen on the same port. Returns the socket or -1. */
+int create_listening_socket(int port, bool reuse_port){
+    int listen_socket;
+    int enable = 1;
+    struct sockaddr_in address;
+
+    if((listen_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+        mini_log(ERROR, "create_listening_socket", -1, "Unable to create the tcp socket");
+        return -1;
+    }
+
+    /* the port can be bound again while old connections on it are closing (see resume.c) */
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if(reuse_port && setsockopt(listen_socket, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0){
+        mini_log(ERROR, "create_listening_socket", -1, "Unable to set SO_REUSEPORT");
+        close(listen_socket);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if(bind(listen_socket, (struct sockaddr *)&address, sizeof(struct sockaddr_in)) < 0){
+        mini_log(ERROR, "create_listening_socket", -1, "Unable to bind the tcp socket");
+        close(listen_socket);
+        return -1;
+    }
+
+    if(listen(listen_socket, SERVER_BACKLOG) < 0){
+        mini_log(ERROR, "create_listening_socket", -1, "Unable to listen on the tcp socket");
+        close(listen_socket);
+        return -1;
+    }
+
+    return listen_socket;
+}
+
+/* Sends the buffered messages of the session. Returns false if the guest does not read them */
+static bool flush_connection(struct connection* conn){
+    int sent = 0;
+
+    while(sent < conn->output_size){
+        int n_byte_sent = send(conn->socket, &conn->output[sent], conn->output_size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+        if(n_byte_sent < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            /* the socket buffer of a guest that plays by the rules never fills: drop it */
+            conn->output_size = 0;
+            conn->closing = true;
+            return false;
+        }
+        sent += n_byte_sent;
+    }
+
+    conn->output_size = 0;
+    return true;
+}
+
+/* --- session_ops of the server: messages are buffered, the bot moves as soon as it is its turn --- */
+
+static void server_send(struct session* session, struct message* msg){
+    struct connection* conn = session->context;
+
+    if(conn->output_size + MESSAGE_WIRE_SIZE > SERVER_OUTPUT_BUFFER_SIZE && !flush_connection(conn)){
+        return;
+    }
+
+    encode_message(msg, &conn->output[conn->output_size]);
+    conn->output_size += MESSAGE_WIRE_SIZE;
+}
+
+static void server_local_turn(struct session* session){
+    session_play_move(session, choose_bot_move(&session->board, session->state.role));
+}
+
+static void server_remote_turn(struct session* session){
+    (void)session;
+}
+
+static void server_finished(struct session* session, enum outcome outcome){
+    struct connection* conn = session->context;
+    (void)outcome;
+
+    conn->closing = true;
+}
+
+static const struct session_ops server_session_ops = {
+    .send = server_send,
+    .local_turn = server_local_turn,
+    .remote_turn = server_remote_turn,
+    .finished = server_finished
+};
+
+/* message_handler of the server: the message goes to the session of the connection */
+static bool deliver_to_session(struct message* msg, void* context){
+    struct connection* conn = context;
+
+    if(msg->stream != 0){
+        return false;   /* the server plays one game for each connection */
+    }
+
+    /* a guest answers the WELCOME with OK, anything else is dropped before reaching the session */
+    if(conn->session.state.phase == OPEN_CONNECTION && msg->communication != OK){
+        return false;
+    }
+
+    session_handle_message(&conn->session, msg);
+    return true;
+}
+
+static void close_connection(struct connection* conn){
+    struct shard* shard = conn->shard;
+
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_DEL, conn->socket, NULL);
+    close(conn->socket);
+
+    if(conn->prev != NULL){
+        conn->prev->next = conn->next;
+    }
+    else{
+        shard->connections = conn->next;
+    }
+    if(conn->next != NULL){
+        conn->next->prev = conn->prev;
+    }
+
+    if(conn->session.outcome != OUTCOME_NONE){
+        __atomic_store_n(&shard->finished, shard->finished + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&shard->active, shard->active - 1, __ATOMIC_RELAXED);
+
+    free(conn);
+}
+
+static void count_rejected(struct shard* shard){
+    __atomic_store_n(&shard->rejected, shard->rejected + 1, __ATOMIC_RELAXED);
+}
+
+/* The guest did not complete the opening sequence as expected: its address waits longer to come back */
+static void drop_guest(struct connection* conn){
+    admission_penalize(&conn->shard->admission, conn->ip, conn->shard->now_ms);
+    count_rejected(conn->shard);
+    close_connection(conn);
+}
+
+/* Closes a connection refused at accept: the reset frees the socket at once, nothing was allocated for it */
+static void reject_guest(struct shard* shard, int connection_socket){
+    struct linger reset = {1, 0};
+
+    setsockopt(connection_socket, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(connection_socket);
+    count_rejected(shard);
+}
+
+/*  Allocates the connection of a guest on connection_socket and adds it to the sessions of the shard.
+    Returns NULL if it cannot be watched (the socket is left open) */
+static struct connection* watch_connection(struct shard* shard, int connection_socket, in_addr_t ip){
+    struct epoll_event event;
+    struct connection* conn = malloc(sizeof(struct connection));
+
+    if(conn == NULL){
+        mini_log(ERROR, "watch_connection", -1, "Unable to allocate a session");
+        return NULL;
+    }
+
+    conn->socket = connection_socket;
+    conn->ip = ip;
+    conn->shard = shard;
+    conn->output_size = 0;
+    conn->closing = false;
+    frame_parser_init(&conn->parser);
+
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.ptr = conn;
+    if(epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, connection_socket, &event) < 0){
+        mini_log(ERROR, "watch_connection", -1, "Unable to watch the connection");
+        free(conn);
+        return NULL;
+    }
+
+    conn->prev = NULL;
+    conn->next = shard->connections;
+    if(shard->connections != NULL){
+        shard->connections->prev = conn;
+    }
+    shard->connections = conn;
+
+    __atomic_store_n(&shard->active, shard->active + 1, __ATOMIC_RELAXED);
+    return conn;
+}
+
+/*  Accepts every connection waiting on the listening socket of the shard and opens its session.
+    A connection over the limits of the shard is closed before anything is allocated for it. */
+static void accept_guests(struct shard* shard){
+    int connection_socket;
+    int enable = 1;
+    struct sockaddr_in guest_address;
+    socklen_t guest_address_size;
+
+    while(1){
+        guest_address_size = sizeof(guest_address);
+        connection_socket = accept4(shard->listen_socket, (struct sockaddr*)&guest_address, &guest_address_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(connection_socket < 0){
+            break;
+        }
+
+        if(shard->active >= shard->max_sessions || !admission_allow(&shard->admission, guest_address.sin_addr.s_addr, shard->now_ms)){
+            reject_guest(shard, connection_socket);
+            continue;
+        }
+
+        setsockopt(connection_socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        struct connection* conn = watch_connection(shard, connection_socket, guest_address.sin_addr.s_addr);
+        if(conn == NULL){
+            close(connection_socket);
+            continue;
+        }
+        conn->deadline_ms = shard->now_ms + shard->handshake_timeout;
+        __atomic_store_n(&shard->accepted, shard->accepted + 1, __ATOMIC_RELAXED);
+
+        /* the guest moves first */
+        session_init(&conn->session, HOST, &server_session_ops, conn);
+        session_open(&conn->session, GUEST);
+
+        flush_connection(conn);
+        if(conn->closing){
+            close_connection(conn);
+        }
+    }
+
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED){
+        mini_log(WARNING, "accept_guests", -1, "accept returned -1");
+    }
+}
+
+/* Reads what the guest sent and lets the session react to it */
+static void serve_guest(struct connection* conn, uint32_t events){
+    unsigned char receive_buffer[SERVER_OUTPUT_BUFFER_SIZE];
+    int n_byte_read;
+    int n_messages;
+    bool answered = false;
+
+    if(events & EPOLLIN){
+        do{
+            n_byte_read = recv(conn->socket, receive_buffer, sizeof(receive_buffer), 0);
+
+            if(n_byte_read > 0){
+                bool opening = conn->session.state.phase == OPEN_CONNECTION;
+
+                n_messages = parse_frames(&conn->parser, receive_buffer, n_byte_read, deliver_to_session, conn);
+                if(n_messages < 0){
+                    mini_log(WARNING, "serve_guest", -1, "The message received is not correct!");
+                    if(opening){
+                        drop_guest(conn);
+                        return;
+                    }
+                    admission_penalize(&conn->shard->admission, conn->ip, conn->shard->now_ms);
+                    conn->closing = true;
+                }
+                else if(n_messages > 0 && conn->session.state.phase != OPEN_CONNECTION){
+                    /* only whole messages give the guest more time, not single bytes */
+                    conn->deadline_ms = conn->shard->now_ms + conn->shard->idle_timeout;
+                    answered = true;
+                }
+            }
+            else if(n_byte_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+                conn->closing = true;
+            }
+        }while(n_byte_read == (int)sizeof(receive_buffer) && !conn->closing);
+    }
+    else if(events & (EPOLLHUP | EPOLLERR)){
+        conn->closing = true;
+    }
+
+    flush_connection(conn);
+    if(answered){
+        record_latency(conn->shard);
+    }
+    if(conn->closing){
+        close_connection(conn);
+    }
+}
+
+/*  Closes the sessions whose guest did not answer in time: a guest that never completed the opening
+    sequence is dropped, the others are told with DISCONNECT */
+static void sweep_sessions(struct shard* shard){
+    struct connection* conn = shard->connections;
+
+    while(conn != NULL){
+        struct connection* next = conn->next;
+
+        if(conn->deadline_ms <= shard->now_ms){
+            if(conn->session.state.phase == OPEN_CONNECTION){
+                drop_guest(conn);
+            }
+            else{
+                session_leave(&conn->session);
+                flush_connection(conn);
+                close_connection(conn);
+            }
+        }
+        conn = next;
+    }
+
+    shard->next_sweep_ms = shard->now_ms + SERVER_SWEEP_INTERVAL;
+}
+
+static void* shard_loop(void* arg){
+    struct shard* shard = arg;
+    struct epoll_event events[SERVER_EVENT_BATCH];
+    bool stop = false;
+
+    shard->wake_us = monotonic_us();
+    shard->now_ms = shard->wake_us / 1000;
+    shard->next_sweep_ms = shard->now_ms + SERVER_SWEEP_INTERVAL;
+
+    /* the messages of the sessions taken from another process are still buffered */
+    struct connection* conn = shard->connections;
+    while(conn != NULL){
+        struct connection* next = conn->next;
+
+        if(conn->output_size > 0 && !flush_connection(conn)){
+            close_connection(conn);
+        }
+        conn = next;
+    }
+
+    while(!stop){
+        /* without sessions there is no deadline to check */
+        int timeout = -1;
+        if(shard->connections != NULL){
+            long long until_sweep = shard->next_sweep_ms - monotonic_us() / 1000;
+            timeout = until_sweep > 0 ? (int)until_sweep : 0;
+        }
+
+        int n_events = epoll_wait(shard->epoll_fd, events, SERVER_EVENT_BATCH, timeout);
+
+        shard->wake_us = monotonic_us();
+        shard->now_ms = shard->wake_us / 1000;
+
+        if(n_events < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            mini_log(ERROR, "shard_loop", -1, "epoll_wait returned -1");
+            break;
+        }
+
+        for(int i=0; i < n_events; ++i){
+            if(events[i].data.ptr == NULL){
+                accept_guests(shard);
+            }
+            else if(events[i].data.ptr == shard){
+                stop = true;
+            }
+            else{
+                serve_guest(events[i].data.ptr, events[i].events);
+            }
+        }
+
+        if(shard->now_ms >= shard->next_sweep_ms){
+            sweep_sessions(shard);
+        }
+    }
+
+    /* while it is handed off the sessions stay as they are, to go on here if the other process fails */
+    while(!shard->handing_off && shard->connections != NULL){
+        close_connection(shard->connections);
+    }
+
+    return NULL;
+}
+
+/* The share of a limit of the server enforced by each of n_shards shards (0 stays 0, no limit) */
+static int shard_share(int limit, int n_shards){
+    if(limit <= 0){
+        return 0;
+    }
+    return (limit + n_shards - 1) / n_shards;
+}
+
+/* Prepares the epoll instance and the limits of a shard listening on listen_socket (closed if it fails) */
+static bool shard_init(struct shard* shard, int index, int listen_socket, const struct server_limits* limits, int n_shards){
+    struct epoll_event event;
+
+    memset(shard, 0, sizeof(struct shard));
+    shard->index = index;
+    shard->epoll_fd = -1;
+
+    admission_init(&shard->admission, shard_share(limits->connections_per_second, n_shards), shard_share(limits->connection_burst, n_shards));
+    shard->max_sessions = limits->max_sessions > 0 ? shard_share(limits->max_sessions, n_shards) : INT_MAX;
+    shard->handshake_timeout = limits->handshake_timeout;
+    shard->idle_timeout = limits->idle_timeout;
+
+    shard->listen_socket = listen_socket;
+
+    if(!create_event_pipe(shard->stop_pipe)){
+        close(shard->listen_socket);
+        return false;
+    }
+
+    if((shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0){
+        mini_log(ERROR, "shard_init", -1, "Unable to create the epoll instance");
+        close_event_pipe(shard->stop_pipe);
+        close(shard->listen_socket);
+        return false;
+    }
+
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->listen_socket, &event);
+
+    event.events = EPOLLIN;
+    event.data.ptr = shard;
+    epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->stop_pipe[0], &event);
+
+    return true;
+}
+
+static void shard_destroy(struct shard* shard){
+    close(shard->epoll_fd);
+    close_event_pipe(shard->stop_pipe);
+    close(shard->listen_socket);
+}
+
+/* Stops and joins the first n_shards shards of the server */
+static void stop_shards(struct server* server, int n_shards){
+    for(int i=0; i < n_shards; ++i){
+        notify_event(server->shards[i].stop_pipe[1]);
+    }
+    for(int i=0; i < n_shards; ++i){
+        pthread_join(server->shards[i].tid, NULL);
+        shard_destroy(&server->shards[i]);
+    }
+}
+
+/* Starts the thread of a shard, pinned to its core. Returns false if it cannot be created */
+static bool start_shard(struct shard* shard, int n_cores){
+    cpu_set_t cpu_set;
+
+    if(pthread_create(&shard->tid, NULL, shard_loop, shard) != 0){
+        mini_log(ERROR, "start_shard", -1, "Unable to create a shard thread");
+        return false;
+    }
+
+    CPU_ZERO(&cpu_set);
+    CPU_SET(shard->index % n_cores, &cpu_set);
+    pthread_setaffinity_np(shard->tid, sizeof(cpu_set_t), &cpu_set);
+    return true;
+}
+
+static int count_cores(){
+    int n_cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n_cores < 1 ? 1 : n_cores;
+}
+
+/*  Starts n_shards acceptors on port (0 chooses a free port, n_shards <= 0 means one for each core),
+    each thread pinned to its own core. limits can be NULL for server_default_limits.
+    server->port tells the port in use. */
+bool server_start(struct server* server, int port, int n_shards, const struct server_limits* limits){
+    int n_cores = count_cores();
+
+    if(limits == NULL){
+        limits = &server_default_limits;
+    }
+
+    if(n_shards <= 0){
+        n_shards = n_cores;
+    }
+    if(n_shards > SERVER_MAX_SHARDS){
+        n_shards = SERVER_MAX_SHARDS;
+    }
+
+    server->port = port;
+    server->n_shards = 0;
+    server->max_sessions = limits->max_sessions > 0 ? limits->max_sessions : INT_MAX;
+    memset(server->latencies_seen, 0, sizeof(server->latencies_seen));
+
+    for(int i=0; i < n_shards; ++i){
+        struct shard* shard = &server->shards[i];
+        int listen_socket = create_listening_socket(server->port, true);
+
+        if(listen_socket < 0 || !shard_init(shard, i, listen_socket, limits, n_shards)){
+            stop_shards(server, server->n_shards);
+            return false;
+        }
+
+        /* the other shards bind the port chosen by the kernel for the first one */
+        if(server->port == 0){
+            struct sockaddr_in address;
+            socklen_t address_size = sizeof(address);
+
+            getsockname(shard->listen_socket, (struct sockaddr *)&address, &address_size);
+            server->port = ntohs(address.sin_port);
+        }
+
+        if(!start_shard(shard, n_cores)){
+            shard_destroy(shard);
+            stop_shards(server, server->n_shards);
+            return false;
+        }
+
+        ++server->n_shards;
+    }
+
+    return true;
+}
+
+/* Stops every shard: the games in progress are closed */
+void server_stop(struct server* server){
+    stop_shards(server, server->n_shards);
+    server->n_shards = 0;
+}
+
+/* Sums the counters of all the shards */
+void server_get_stats(struct server* server, long long* accepted, long long* finished, long long* rejected, int* active){
+    *accepted = 0;
+    *finished = 0;
+    *rejected = 0;
+    *active = 0;
+
+    for(int i=0; i < server->n_shards; ++i){
+        *accepted += __atomic_load_n(&server->shards[i].accepted, __ATOMIC_RELAXED);
+        *finished += __atomic_load_n(&server->shards[i].finished, __ATOMIC_RELAXED);
+        *rejected += __atomic_load_n(&server->shards[i].rejected, __ATOMIC_RELAXED);
+        *active += __atomic_load_n(&server->shards[i].active, __ATOMIC_RELAXED);
+    }
+}
+
+/*  The move latency under which 99% of the answers of the server were sent since the last call (the upper
+    bound of its bucket, in microseconds), -1 if no move was played. Only one thread can call it. */
+int server_move_latency_p99(struct server* server){
+    long long counts[SERVER_LATENCY_BUCKETS];
+    long long total = 0;
+    long long cumulative = 0;
+
+    for(int bucket=0; bucket < SERVER_LATENCY_BUCKETS; ++bucket){
+        long long seen = 0;
+
+        for(int i=0; i < server->n_shards; ++i){
+            seen += __atomic_load_n(&server->shards[i].latencies[bucket], __ATOMIC_RELAXED);
+        }
+        counts[bucket] = seen - server->latencies_seen[bucket];
+        server->latencies_seen[bucket] = seen;
+        total += counts[bucket];
+    }
+
+    if(total == 0){
+        return -1;
+    }
+
+    for(int bucket=0; bucket < SERVER_LATENCY_BUCKETS; ++bucket){
+        cumulative += counts[bucket];
+        if(cumulative * 100 >= total * 99){
+            return bucket >= 30 ? INT_MAX : (2 << bucket) - 1;
+        }
+    }
+    return INT_MAX;
+}
+
+/* --- handoff: another server process takes the sessions without closing them (see handoff.c) --- */
+
+/* Stops the loops of the shards, their sessions stay as they are */
+static void pause_shards(struct server* server){
+    for(int i=0; i < server->n_shards; ++i){
+        server->shards[i].handing_off = true;
+        notify_event(server->shards[i].stop_pipe[1]);
+    }
+    for(int i=0; i < server->n_shards; ++i){
+        pthread_join(server->shards[i].tid, NULL);
+    }
+}
+
+/* The handoff failed: the shards go on with their sessions */
+static void resume_shards(struct server* server){
+    int n_cores = count_cores();
+
+    for(int i=0; i < server->n_shards; ++i){
+        server->shards[i].handing_off = false;
+        drain_events(server->shards[i].stop_pipe[0]);
+        start_shard(&server->shards[i], n_cores);
+    }
+}
+
+/* Frees the sessions and the shards, closing only the copies of the sockets of this process */
+static void release_shards(struct server* server){
+    for(int i=0; i < server->n_shards; ++i){
+        struct shard* shard = &server->shards[i];
+
+        while(shard->connections != NULL){
+            struct connection* conn = shard->connections;
+
+            shard->connections = conn->next;
+            close(conn->socket);
+            free(conn);
+        }
+        shard->active = 0;
+        shard_destroy(shard);
+    }
+    server->n_shards = 0;
+}
+
+/*  Gives the listening sockets and every session to the process on channel, that takes the place of the server.
+    The shards stop while their sessions are sent (the guests that write in the meantime wait in the socket
+    buffers). Returns true when the other process has taken everything: the server has no shards left and can be
+    freed. If it fails the shards go on with their sessions. */
+bool server_hand_off(struct server* server, int channel){
+    static unsigned char packet[HANDOFF_PACKET_SIZE];
+    int fds[HANDOFF_BATCH];
+    struct handoff_server totals;
+    struct handoff_session snapshot;
+    long long now_ms;
+    int size, n_fds, active;
+    bool handed_off;
+
+    pause_shards(server);
+    now_ms = monotonic_us() / 1000;
+
+    totals.port = server->port;
+    server_get_stats(server, &totals.accepted, &totals.finished, &totals.rejected, &active);
+
+    size = handoff_begin_packet(packet, server->n_shards);
+    size += handoff_encode_server(&totals, &packet[size]);
+    for(int i=0; i < server->n_shards; ++i){
+        fds[i] = server->shards[i].listen_socket;
+    }
+    handed_off = handoff_send(channel, packet, size, fds, server->n_shards);
+
+    n_fds = 0;
+    size = HANDOFF_PACKET_HEADER_SIZE;
+    for(int i=0; i < server->n_shards && handed_off; ++i){
+        for(struct connection* conn = server->shards[i].connections; conn != NULL && handed_off; conn = conn->next){
+            snapshot.ip = conn->ip;
+            snapshot.deadline_in = (int)(conn->deadline_ms - now_ms);
+            snapshot.session = conn->session;
+            snapshot.parser = conn->parser;
+            snapshot.output = conn->output;
+            snapshot.output_size = conn->output_size;
+
+            size += handoff_encode_session(&snapshot, &packet[size]);
+            fds[n_fds++] = conn->socket;
+
+            if(n_fds == HANDOFF_BATCH){
+                handoff_begin_packet(packet, n_fds);
+                handed_off = handoff_send(channel, packet, size, fds, n_fds);
+                n_fds = 0;
+                size = HANDOFF_PACKET_HEADER_SIZE;
+            }
+        }
+    }
+    if(handed_off && n_fds > 0){
+        handoff_begin_packet(packet, n_fds);
+        handed_off = handoff_send(channel, packet, size, fds, n_fds);
+    }
+
+    /* the end, answered by the other process when its shards are ready to go on */
+    if(handed_off){
+        size = handoff_begin_packet(packet, 0);
+        handed_off = handoff_send(channel, packet, size, NULL, 0);
+    }
+    if(handed_off){
+        size = handoff_receive(channel, packet, sizeof(packet), fds, HANDOFF_BATCH, &n_fds);
+        for(int i=0; i < n_fds; ++i){
+            close(fds[i]);
+        }
+        handed_off = size > 0 && handoff_packet_count(packet, size) == 0;
+    }
+
+    if(!handed_off){
+        mini_log(WARNING, "server_hand_off", -1, "The other process did not take the sessions, the server goes on");
+        resume_shards(server);
+        return false;
+    }
+
+    release_shards(server);
+    return true;
+}
+
+/* A session of the old process goes on in shard. Returns false if it cannot (the socket is left open) */
+static bool restore_connection(struct shard* shard, int connection_socket, const struct handoff_session* snapshot){
+    struct connection* conn;
+
+    if(snapshot->output_size > SERVER_OUTPUT_BUFFER_SIZE){
+        return false;
+    }
+    if((conn = watch_connection(shard, connection_socket, snapshot->ip)) == NULL){
+        return false;
+    }
+
+    conn->deadline_ms = shard->now_ms + snapshot->deadline_in;
+    conn->session = snapshot->session;
+    conn->session.ops = &server_session_ops;
+    conn->session.context = conn;
+    conn->parser = snapshot->parser;
+    /* sent by shard_loop: until the other process has the final answer it can still go on with the session */
+    memcpy(conn->output, snapshot->output, snapshot->output_size);
+    conn->output_size = snapshot->output_size;
+    return true;
+}
+
+static void close_fds(const int* fds, int n_fds){
+    for(int i=0; i < n_fds; ++i){
+        close(fds[i]);
+    }
+}
+
+/*  Takes the place of the server of another process, connected on channel (see handoff_connect): its listening
+    sockets and its sessions go on in the shards of this server, one for each listening socket, with the same
+    port and totals. limits can be NULL for server_default_limits. Returns false if nothing was taken: the other
+    server goes on. */
+bool server_take_over(struct server* server, int channel, const struct server_limits* limits){
+    static unsigned char packet[HANDOFF_PACKET_SIZE];
+    int fds[HANDOFF_BATCH];
+    struct handoff_server totals;
+    struct handoff_session snapshot;
+    int size, n_fds, count, n_listen;
+    int n_restored = 0;
+    int n_cores = count_cores();
+    bool taken = true;
+
+    if(limits == NULL){
+        limits = &server_default_limits;
+    }
+
+    size = handoff_receive(channel, packet, sizeof(packet), fds, HANDOFF_BATCH, &n_fds);
+    n_listen = size > 0 ? handoff_packet_count(packet, size) : -1;
+    if(n_listen < 1 || n_listen > SERVER_MAX_SHARDS || n_fds != n_listen
+        || handoff_decode_server(&totals, &packet[HANDOFF_PACKET_HEADER_SIZE], size - HANDOFF_PACKET_HEADER_SIZE) < 0){
+        mini_log(ERROR, "server_take_over", -1, "The other process did not send its listening sockets");
+        close_fds(fds, n_fds);
+        return false;
+    }
+
+    server->port = totals.port;
+    server->n_shards = 0;
+    server->max_sessions = limits->max_sessions > 0 ? limits->max_sessions : INT_MAX;
+    memset(server->latencies_seen, 0, sizeof(server->latencies_seen));
+
+    for(int i=0; i < n_listen; ++i){
+        if(!shard_init(&server->shards[i], i, fds[i], limits, n_listen)){
+            close_fds(&fds[i + 1], n_listen - i - 1);
+            release_shards(server);
+            return false;
+        }
+        server->shards[i].now_ms = monotonic_us() / 1000;
+        ++server->n_shards;
+    }
+    server->shards[0].accepted = totals.accepted;
+    server->shards[0].finished = totals.finished;
+    server->shards[0].rejected = totals.rejected;
+
+    /* the sessions are spread among the shards in turn, until the end */
+    while(taken){
+        size = handoff_receive(channel, packet, sizeof(packet), fds, HANDOFF_BATCH, &n_fds);
+        count = size > 0 ? handoff_packet_count(packet, size) : -1;
+        if(count != n_fds){
+            close_fds(fds, n_fds);
+            taken = false;
+            break;
+        }
+        if(count == 0){
+            break;
+        }
+
+        int offset = HANDOFF_PACKET_HEADER_SIZE;
+        for(int i=0; i < count; ++i){
+            int used = taken ? handoff_decode_session(&snapshot, &packet[offset], size - offset) : -1;
+
+            if(used < 0 || !restore_connection(&server->shards[n_restored % n_listen], fds[i], &snapshot)){
+                close(fds[i]);
+                taken = false;
+                continue;
+            }
+            offset += used;
+            ++n_restored;
+        }
+    }
+
+    /* once the other process has the answer it closes its sockets: from now on the sessions are only here */
+    if(taken){
+        size = handoff_begin_packet(packet, 0);
+        taken = handoff_send(channel, packet, size, NULL, 0);
+    }
+
+    if(!taken){
+        mini_log(ERROR, "server_take_over", -1, "The sessions of the other process cannot be taken");
+        release_shards(server);
+        return false;
+    }
+
+    for(int i=0; i < server->n_shards; ++i){
+        if(!start_shard(&server->shards[i], n_cores)){
+            /* the sessions of the shards that cannot start are closed */
+            int n_started = i;
+
+            for(int j=i; j < server->n_shards; ++j){
+                server->shards[j].handing_off = false;
+                while(server->shards[j].connections != NULL){
+                    close_connection(server->shards[j].connections);
+                }
+                shard_destroy(&server->shards[j]);
+            }
+            stop_shards(server, n_started);
+            server->n_shards = 0;
+            return false;
+        }
+    }
+
+    return true;
+}
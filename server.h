@@ -0,0 +1,94 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* connections the kernel can queue on each listening socket before accept (capped by net.core.somaxconn) */
+#define SERVER_BACKLOG 4096
+
+/* maximum number of acceptor shards, the server starts one for each core */
+#define SERVER_MAX_SHARDS 64
+
+/* events read with one epoll_wait */
+#define SERVER_EVENT_BATCH 64
+
+/* bytes of messages a session can send before they are flushed to its socket */
+#define SERVER_OUTPUT_BUFFER_SIZE (8 * MESSAGE_WIRE_SIZE)
+
+/* milliseconds between two checks of the deadlines of the sessions of a shard */
+#define SERVER_SWEEP_INTERVAL 250
+
+/* buckets of the histogram of the move latencies: bucket i counts the latencies from 2^i to 2^(i+1) - 1 microseconds */
+#define SERVER_LATENCY_BUCKETS 32
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "admission.h"
+#include "common.h"
+#include "communication.h"
+
+struct connection;
+struct server;
+
+/*  What the server accepts, for the whole server (every shard enforces its share of the limits, since the
+    kernel spreads the connections of an address among the shards) */
+struct server_limits{
+    int connections_per_second;     /* new connections of each source address, 0 means no limit */
+    int connection_burst;           /* connections an address can open at once */
+    int max_sessions;               /* sessions open at the same time, 0 means no limit */
+    int handshake_timeout;          /* ms a guest has to answer the WELCOME */
+    int idle_timeout;               /* ms a guest has to make its move */
+};
+
+extern const struct server_limits server_default_limits;
+
+/*  One core of the server: its own listening socket (the kernel spreads the incoming connections among the
+    SO_REUSEPORT sockets bound to the same port) and its own epoll loop, where every session it accepts
+    stays until the end. The shards share nothing, so they never take a lock. */
+struct shard{
+    int index;
+    int listen_socket;
+    int epoll_fd;
+    int stop_pipe[2];
+    pthread_t tid;
+    struct connection* connections;     /* list of the open sessions, to close them when the server stops */
+    struct admission admission;
+    int max_sessions;
+    int handshake_timeout;
+    int idle_timeout;
+    long long now_ms;                   /* monotonic time of the last wake up of the loop */
+    long long wake_us;                  /* the same, in microseconds */
+    long long next_sweep_ms;
+    bool handing_off;                   /* the loop stops without closing the sessions, another process takes them */
+
+    /* written by the shard thread only, read by the others with atomic loads */
+    long long accepted;
+    long long finished;
+    long long rejected;                 /* connections refused at accept, or closed for a late or invalid handshake */
+    int active;
+    long long latencies[SERVER_LATENCY_BUCKETS];    /* from the wake up of the loop to the answer to a guest */
+};
+
+/* Game server: the computer plays as host against every guest that joins */
+struct server{
+    int port;
+    int n_shards;
+    int max_sessions;                   /* of all the shards, INT_MAX if there is no limit */
+    long long latencies_seen[SERVER_LATENCY_BUCKETS];   /* read by the last server_move_latency_p99 */
+    struct shard shards[SERVER_MAX_SHARDS];
+};
+
+int create_listening_socket(int port, bool reuse_port);
+
+bool server_start(struct server* server, int port, int n_shards, const struct server_limits* limits);
+
+void server_stop(struct server* server);
+
+void server_get_stats(struct server* server, long long* accepted, long long* finished, long long* rejected, int* active);
+
+int server_move_latency_p99(struct server* server);
+
+bool server_hand_off(struct server* server, int channel);
+
+bool server_take_over(struct server* server, int channel, const struct server_limits* limits);
+
+#endif /* SERVER_H */
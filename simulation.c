@@ -0,0 +1,512 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "clock.h"
+#include "gameLogic.h"
+#include "protocol.h"
+#include "stateMachine.h"
+
+/*  Deterministic simulation of whole connections between a host and a guest, on the virtual clock. The two
+    sessions run in one thread: every message reaches the other peer after a random latency (in order, as on
+    TCP), the players think for a random time and sometimes play randomly, offer and refuse draws, ask for
+    rematches, leave or let their deadline expire. The deadlines are the same kept by game().
+    After every connection the two sides must agree on every result: the first connection that does not is
+    printed with the seed to run it again, alone. The same seed always gives the same trace hash.
+    Usage: tris_sim [connections [seed [first connection]]]   (default 10000 connections, seed 1, from 0) */
+
+#define SIM_DEFAULT_CONNECTIONS 10000
+
+/* games played at most on the same connection */
+#define SIM_MAX_GAMES 4
+
+/* per mille of the decisions in which the player lets the deadline expire, and of the turns it leaves */
+#define SIM_LATE_PER_MILLE 10
+#define SIM_LEAVE_PER_MILLE 5
+
+/* a connection still open after this many events is stuck */
+#define SIM_MAX_EVENTS 10000
+
+struct sim_player;
+
+struct sim_connection{
+    unsigned long long random_state;
+    int max_latency;                    /* ms, below TURN_TIMEOUT_MARGIN so the deadlines of game() hold */
+    int n_events;
+    bool disconnected;                  /* a peer saw the connection close before it had finished */
+    struct sim_player* players[2];
+};
+
+/* what a player has seen of one game */
+struct sim_game{
+    enum outcome outcome;
+    struct board board;
+};
+
+struct sim_player{
+    struct session session;
+    struct sim_connection* connection;
+    struct sim_player* peer;
+    bool closed;
+    long long deadline_ms;              /* of the turn, as turn_deadline in game() */
+    unsigned int generation;            /* a decision scheduled before the last callback is dropped */
+    long long next_delivery_ms;         /* the messages to the peer arrive in order */
+    int n_games;
+    struct sim_game games[SIM_MAX_GAMES + 1];
+};
+
+struct delivery{
+    struct sim_player* to;
+    struct message msg;
+    bool end_of_stream;                 /* the sender closed the connection after its last message */
+};
+
+struct decision{
+    struct sim_player* player;
+    unsigned int generation;
+};
+
+/* what all the connections did */
+struct sim_stats{
+    long long games;
+    long long host_won;
+    long long guest_won;
+    long long draws;
+    long long draws_agreed;
+    long long left;
+    long long timeouts;
+    long long rematches;
+    long long messages;
+    unsigned long long trace_hash;
+};
+
+static struct sim_stats stats;
+
+/* --- randomness: every connection has its own generator, seeded from the seed and the connection number --- */
+
+static unsigned long long splitmix64(unsigned long long x){
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* xorshift64*: returns a number from 0 to n - 1 */
+static int random_below(struct sim_connection* connection, int n){
+    unsigned long long x = connection->random_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    connection->random_state = x;
+
+    return (int)(((x * 0x2545f4914f6cdd1dULL) >> 33) % (unsigned long long)n);
+}
+
+static bool random_per_mille(struct sim_connection* connection, int per_mille){
+    return random_below(connection, 1000) < per_mille;
+}
+
+static void hash_trace(long long value){
+    stats.trace_hash = splitmix64(stats.trace_hash ^ (unsigned long long)value);
+}
+
+/* --- the network --- */
+
+static void check_closed(struct sim_player* player);
+
+static void deliver(void* context){
+    struct delivery* delivery = context;
+    struct sim_player* player = delivery->to;
+
+    if(!player->closed){
+        if(delivery->end_of_stream){
+            /* every peer leaves with a DISCONNECT, the other one must have finished before the connection closes */
+            player->connection->disconnected = true;
+            player->closed = true;
+        }
+        else{
+            ++player->connection->n_events;
+            session_handle_message(&player->session, &delivery->msg);
+            check_closed(player);
+        }
+    }
+
+    free(delivery);
+}
+
+static void send_to_peer(struct sim_player* player, const struct message* msg, bool end_of_stream){
+    struct sim_connection* connection = player->connection;
+    struct delivery* delivery = malloc(sizeof(struct delivery));
+    long long at_ms = virtual_clock_ms() + 1 + random_below(connection, connection->max_latency);
+
+    if(delivery == NULL){
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    delivery->to = player->peer;
+    delivery->end_of_stream = end_of_stream;
+    if(msg != NULL){
+        delivery->msg = *msg;
+    }
+
+    if(at_ms < player->next_delivery_ms){
+        at_ms = player->next_delivery_ms;
+    }
+    player->next_delivery_ms = at_ms;
+
+    if(!virtual_clock_schedule(at_ms, deliver, delivery)){
+        exit(1);
+    }
+}
+
+/* As the game thread of game(): the connection is closed when the game is over and no rematch is possible */
+static void check_closed(struct sim_player* player){
+    if(!player->closed && player->session.outcome != OUTCOME_NONE && !session_can_rematch(&player->session)){
+        player->closed = true;
+        send_to_peer(player, NULL, true);
+    }
+}
+
+/* --- the deadlines and the decisions of the players --- */
+
+static void on_deadline(void* context){
+    struct sim_player* player = context;
+    struct session* session = &player->session;
+
+    if(player->closed || virtual_clock_ms() < player->deadline_ms){
+        return;     /* the deadline was moved since this timer was scheduled */
+    }
+
+    ++player->connection->n_events;
+    ++stats.timeouts;
+
+    /* a draw offer without answer is refused, otherwise the game is left (as in the headless player) */
+    if(session->draw_offer == DRAW_OFFER_RECEIVED){
+        session_answer_draw(session, false);
+    }
+    else{
+        session_leave(session);
+    }
+    check_closed(player);
+}
+
+static void set_deadline(struct sim_player* player, int ms){
+    player->deadline_ms = virtual_clock_ms() + ms;
+
+    if(!virtual_clock_schedule(player->deadline_ms, on_deadline, player)){
+        exit(1);
+    }
+}
+
+static int random_free_cell(struct sim_player* player){
+    int free_cells[9];
+    int n_free = 0;
+
+    for(int pos=0; pos < 9; ++pos){
+        if(can_place_symbol(&player->session.board, pos)){
+            free_cells[n_free++] = pos + 1;
+        }
+    }
+
+    return n_free > 0 ? free_cells[random_below(player->connection, n_free)] : 1;
+}
+
+/* The player acts on what it is waiting for now */
+static void on_decision(void* context){
+    struct decision* decision = context;
+    struct sim_player* player = decision->player;
+    struct sim_connection* connection = player->connection;
+    struct session* session = &player->session;
+    bool current = !player->closed && decision->generation == player->generation;
+
+    free(decision);
+    if(!current){
+        return;
+    }
+
+    ++connection->n_events;
+
+    if(session_is_local_turn(session)){
+        if(random_per_mille(connection, SIM_LEAVE_PER_MILLE)){
+            session_leave(session);
+        }
+        else if(session->draw_offer == DRAW_OFFER_NONE && session_is_forced_draw(session) && random_below(connection, 3) == 0){
+            session_offer_draw(session);
+        }
+        else if(random_below(connection, 2) == 0){
+            session_play_move(session, choose_bot_move(&session->board, session->state.role));
+        }
+        else{
+            session_play_move(session, random_free_cell(player));
+        }
+    }
+    else if(session->draw_offer == DRAW_OFFER_RECEIVED){
+        session_answer_draw(session, random_below(connection, 2) == 0);
+    }
+    else if(session_can_rematch(session) && session->rematch != REMATCH_SENT){
+        if(player->n_games < SIM_MAX_GAMES && random_below(connection, 4) != 0){
+            session_request_rematch(session);
+        }
+        else{
+            session_leave(session);
+        }
+    }
+    check_closed(player);
+}
+
+/* A new decision replaces the pending one: it comes before the deadline, or just after it */
+static void schedule_decision(struct sim_player* player){
+    struct sim_connection* connection = player->connection;
+    struct decision* decision = malloc(sizeof(struct decision));
+    long long at_ms;
+
+    if(decision == NULL){
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    decision->player = player;
+    decision->generation = ++player->generation;
+
+    if(random_per_mille(connection, SIM_LATE_PER_MILLE)){
+        at_ms = player->deadline_ms + 1 + random_below(connection, 1000);
+    }
+    else{
+        at_ms = virtual_clock_ms() + random_below(connection, 5000);
+    }
+
+    if(!virtual_clock_schedule(at_ms, on_decision, decision)){
+        exit(1);
+    }
+}
+
+/* --- the session callbacks, with the deadlines of game() --- */
+
+static void sim_send(struct session* session, struct message* msg){
+    struct sim_player* player = session->context;
+
+    ++stats.messages;
+    send_to_peer(player, msg, false);
+}
+
+static void sim_local_turn(struct session* session){
+    struct sim_player* player = session->context;
+
+    set_deadline(player, TURN_TIMEOUT);
+    schedule_decision(player);
+}
+
+static void sim_remote_turn(struct session* session){
+    struct sim_player* player = session->context;
+
+    ++player->generation;
+    set_deadline(player, session->state.phase == OPEN_CONNECTION ? HANDSHAKE_TIMEOUT : TURN_TIMEOUT + TURN_TIMEOUT_MARGIN);
+}
+
+static void sim_draw_offered(struct session* session){
+    struct sim_player* player = session->context;
+
+    set_deadline(player, TURN_TIMEOUT);
+    schedule_decision(player);
+}
+
+static void sim_finished(struct session* session, enum outcome outcome){
+    struct sim_player* player = session->context;
+    struct sim_game* game = &player->games[player->n_games++];
+
+    game->outcome = outcome;
+    game->board = session->board;
+
+    ++player->generation;
+    if(session_can_rematch(session)){
+        set_deadline(player, REMATCH_TIMEOUT);
+        schedule_decision(player);
+    }
+}
+
+static void sim_rematch(struct session* session){
+    struct sim_player* player = session->context;
+
+    if(session->rematch == REMATCH_RECEIVED){
+        schedule_decision(player);
+    }
+}
+
+static void sim_restarted(struct session* session){
+    struct sim_player* player = session->context;
+
+    ++player->generation;
+    if(session->state.role == HOST){
+        ++stats.rematches;
+    }
+}
+
+static const struct session_ops sim_session_ops = {
+    .send = sim_send,
+    .local_turn = sim_local_turn,
+    .remote_turn = sim_remote_turn,
+    .finished = sim_finished,
+    .draw_offered = sim_draw_offered,
+    .rematch = sim_rematch,
+    .restarted = sim_restarted
+};
+
+/* --- the checks --- */
+
+static bool is_result(enum outcome outcome){
+    return outcome == OUTCOME_HOST_WON || outcome == OUTCOME_GUEST_WON || outcome == OUTCOME_DRAW;
+}
+
+/*  Returns NULL if the two sides agree, otherwise what went wrong. A game the host opened just before the
+    guest left (the WELCOME crossed the DISCONNECT) is only seen by the host. */
+static const char* check_connection(const struct sim_connection* connection){
+    const struct sim_player* host = connection->players[0];
+    const struct sim_player* guest = connection->players[1];
+    int n_both = host->n_games < guest->n_games ? host->n_games : guest->n_games;
+
+    if(!host->closed || !guest->closed){
+        return "the connection was never closed";
+    }
+    if(connection->disconnected){
+        return "a peer saw the connection close during a game";
+    }
+
+    for(int i=0; i < host->n_games + guest->n_games - n_both; ++i){
+        const struct sim_game* host_game = &host->games[i];
+        const struct sim_game* guest_game = &guest->games[i];
+
+        if(i >= n_both){
+            const struct sim_game* game = i < host->n_games ? host_game : guest_game;
+
+            if(game->outcome != OUTCOME_PEER_LEFT && game->outcome != OUTCOME_LEFT){
+                return "a game was seen by one side only";
+            }
+        }
+        else if(host_game->outcome == OUTCOME_PROTOCOL_ERROR || guest_game->outcome == OUTCOME_PROTOCOL_ERROR){
+            return "protocol error";
+        }
+        else if(is_result(host_game->outcome) != is_result(guest_game->outcome)){
+            return "only one side has a result";
+        }
+        else if(is_result(host_game->outcome) && host_game->outcome != guest_game->outcome){
+            return "the two sides have different results";
+        }
+        else if(is_result(host_game->outcome) && memcmp(host_game->board.cells, guest_game->board.cells, sizeof(host_game->board.cells)) != 0){
+            return "the two sides have different game fields";
+        }
+    }
+
+    return NULL;
+}
+
+static void count_games(const struct sim_player* host){
+    for(int i=0; i < host->n_games; ++i){
+        const struct sim_game* game = &host->games[i];
+
+        ++stats.games;
+        switch(game->outcome){
+            case OUTCOME_HOST_WON:
+                ++stats.host_won;
+            break;
+            case OUTCOME_GUEST_WON:
+                ++stats.guest_won;
+            break;
+            case OUTCOME_DRAW:
+                ++stats.draws;
+                if(!check_draw(&game->board)){
+                    ++stats.draws_agreed;
+                }
+            break;
+            default:
+                ++stats.left;
+            break;
+        }
+        hash_trace(game->outcome);
+        hash_trace(board_to_index(&game->board));
+    }
+}
+
+static void init_player(struct sim_player* player, enum role role, struct sim_connection* connection, struct sim_player* peer){
+    memset(player, 0, sizeof(struct sim_player));
+    player->connection = connection;
+    player->peer = peer;
+    session_init(&player->session, role, &sim_session_ops, player);
+}
+
+/* Plays one connection until both sides have closed it. Returns false if they do not agree */
+static bool simulate_connection(unsigned long long seed, long long number){
+    struct sim_connection connection;
+    struct sim_player host, guest;
+    const char* error;
+
+    connection.random_state = splitmix64(seed ^ splitmix64(number)) | 1;
+    connection.max_latency = 1 + random_below(&connection, 200);
+    connection.n_events = 0;
+    connection.disconnected = false;
+    connection.players[0] = &host;
+    connection.players[1] = &guest;
+
+    init_player(&host, HOST, &connection, &guest);
+    init_player(&guest, GUEST, &connection, &host);
+
+    /* the guest connects: the host opens the session (the guest waits for the WELCOME as game() does) */
+    set_deadline(&guest, HANDSHAKE_TIMEOUT);
+    session_open(&host.session, random_below(&connection, 2) == 0 ? HOST : GUEST);
+
+    while(connection.n_events < SIM_MAX_EVENTS && virtual_clock_run_next());
+
+    /* the timers of a stuck connection point to this stack frame */
+    if(connection.n_events >= SIM_MAX_EVENTS){
+        use_virtual_clock(virtual_clock_ms());
+    }
+
+    error = connection.n_events >= SIM_MAX_EVENTS ? "the connection is stuck" : check_connection(&connection);
+    if(error != NULL){
+        printf("{\"error\": \"%s\", \"seed\": %llu, \"connection\": %lld, \"host_games\": %d, \"guest_games\": %d}\n",
+            error, seed, number, host.n_games, guest.n_games);
+        return false;
+    }
+
+    count_games(&host);
+    hash_trace(virtual_clock_ms());
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    long long n_connections = argc > 1 ? atoll(argv[1]) : SIM_DEFAULT_CONNECTIONS;
+    unsigned long long seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    long long first = argc > 3 ? atoll(argv[3]) : 0;
+    long long n_simulated = 0;
+    struct timespec start, end;
+    double seconds;
+    bool agreed = true;
+
+    if(n_connections < 1 || first < 0){
+        fprintf(stderr, "Usage: %s [connections [seed [first connection]]]\n", argv[0]);
+        return 2;
+    }
+
+    use_virtual_clock(0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(long long i=first; i < first + n_connections && agreed; ++i){
+        agreed = simulate_connection(seed, i);
+        ++n_simulated;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("{\n  \"seed\": %llu,\n  \"connections\": %lld,\n  \"games\": %lld,\n", seed, n_simulated, stats.games);
+    printf("  \"host_won\": %lld,\n  \"guest_won\": %lld,\n  \"draws\": %lld,\n  \"draws_agreed\": %lld,\n  \"left\": %lld,\n",
+        stats.host_won, stats.guest_won, stats.draws, stats.draws_agreed, stats.left);
+    printf("  \"timeouts\": %lld,\n  \"rematches\": %lld,\n  \"messages\": %lld,\n", stats.timeouts, stats.rematches, stats.messages);
+    printf("  \"virtual_hours\": %.1f,\n  \"seconds\": %.3f,\n  \"trace_hash\": \"%016llx\",\n  \"agreed\": %s\n}\n",
+        virtual_clock_ms() / 3600000.0, seconds, stats.trace_hash, agreed ? "true" : "false");
+
+    return agreed ? 0 : 1;
+}
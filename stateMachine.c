@@ -0,0 +1,624 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "minilogger.h"
+#include "stateMachine.h"
+#include "gameLogic.h"
+#include "protocol.h"
+#include "communication.h"
+
+typedef void (*transition)(struct session* session, struct message* msg);
+
+static void send_comm(struct session* session, enum comm comm, int n_args, int arg1, int arg2){
+    struct message msg;
+
+    prepare_message(&msg, comm, n_args, arg1, arg2);
+    session->ops->send(session, &msg);
+    session->state.last_comm = comm;
+}
+
+static enum role other_role(enum role role){
+    return role == HOST ? GUEST : HOST;
+}
+
+static enum phase turn_phase(enum role role){
+    return role == HOST ? GAME_TURN_HOST : GAME_TURN_GUEST;
+}
+
+/* True if the game ended with a result: a player won or it is a draw */
+static bool has_result(const struct session* session){
+    return session->outcome == OUTCOME_HOST_WON || session->outcome == OUTCOME_GUEST_WON || session->outcome == OUTCOME_DRAW;
+}
+
+static void finish(struct session* session, enum phase phase, enum outcome outcome){
+    session->state.phase = phase;
+    session->outcome = outcome;
+    session->ops->finished(session, outcome);
+}
+
+/* The game field of the two peers differs: signal it (the resync itself is not implemented yet) */
+static void start_resync(struct session* session){
+    send_comm(session, NO_RESYNC, 0, 0, 0);
+
+    if(session->state.role == HOST){
+        send_comm(session, SYNC_START, 0, 0, 0);
+    }
+    session->state.phase = RESYNC;
+
+    session->ops->remote_turn(session);
+}
+
+/*  True if the game is a draw for both peers: before version 2 a draw needed a full game field, and an
+    older peer would answer an earlier WIN with NO_RESYNC */
+static bool is_draw(const struct session* session){
+    if(session->peer_version < 2){
+        return check_field_full(&session->board);
+    }
+    return check_draw(&session->board);
+}
+
+/* The local player has to move: first checks if the last move of the other player ended the game */
+static void begin_local_turn(struct session* session){
+    session->state.phase = turn_phase(session->state.role);
+    session->draw_offer = DRAW_OFFER_NONE;
+
+    int victory = check_victory(&session->board);
+    if(victory != 0){
+        /* this section signals the other peer's victory */
+        send_comm(session, WIN, 1, victory, 0);
+        session->state.phase = GAME_END;
+        session->ops->remote_turn(session);
+    }
+    else if(is_draw(session)){
+        /* draw expected (with a peer of version 2 also when no line can be completed anymore), the value 3 represents draw */
+        send_comm(session, WIN, 1, OUTCOME_DRAW, 0);
+        session->state.phase = GAME_END;
+        session->ops->remote_turn(session);
+    }
+    else{
+        session->ops->local_turn(session);
+    }
+}
+
+/* The opening sequence is over, the phase tells who moves first */
+static void start_first_turn(struct session* session){
+    mini_log(LOG, "session", -1, "Opening sequence completed");
+
+    if(session->first_turn == (int)session->state.role){
+        begin_local_turn(session);
+    }
+    else{
+        session->state.phase = turn_phase(other_role(session->state.role));
+        session->ops->remote_turn(session);
+    }
+}
+
+/* Returns the outcome of a finished game field (OUTCOME_NONE if the game is still open) */
+static enum outcome board_outcome(const struct session* session){
+    int victory = check_victory(&session->board);
+
+    if(victory != 0){
+        return (enum outcome)victory;
+    }
+    if(is_draw(session)){
+        return OUTCOME_DRAW;
+    }
+    return OUTCOME_NONE;
+}
+
+/* --- transitions: one function for each kind of reaction, selected by transitions[phase][comm] --- */
+
+static void on_unexpected(struct session* session, struct message* msg){
+    (void)msg;
+    mini_log(ERROR, "session", __LINE__, "INVALID MESSAGE RECEIVED IN THIS PHASE");
+
+    send_comm(session, NO_UNEXPECTED, 0, 0, 0);
+    finish(session, GAME_INTERRUPTED, OUTCOME_PROTOCOL_ERROR);
+}
+
+static void on_ignored(struct session* session, struct message* msg){
+    (void)session;
+    (void)msg;
+}
+
+static void on_peer_left(struct session* session, struct message* msg){
+    (void)msg;
+    finish(session, GAME_INTERRUPTED, OUTCOME_PEER_LEFT);
+}
+
+static void on_no_resync(struct session* session, struct message* msg){
+    (void)msg;
+    mini_log(ERROR, "session", -1, "RESYNC NOT YET SUPPORTED");
+    finish(session, GAME_INTERRUPTED, OUTCOME_PROTOCOL_ERROR);
+}
+
+/* The version announced by the other peer: the first version sent 0 */
+static int announced_version(int version){
+    return version > 0 ? version : 1;
+}
+
+/*  host: the guest accepted the WELCOME. Only a guest that announced version 2 or later receives the token:
+    the older ones would refuse the message, and without the token the game cannot be resumed */
+static void on_open_ok(struct session* session, struct message* msg){
+    if(session->state.role != HOST || session->state.last_comm != WELCOME){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    session->peer_version = announced_version(msg->arg1);
+
+    if(session->peer_version < 2){
+        session->token = 0;
+    }
+    else if(session->token != 0){
+        send_comm(session, TOKEN, 1, session->token, 0);
+    }
+
+    start_first_turn(session);
+}
+
+/* guest: the host chose who moves first */
+static void on_welcome(struct session* session, struct message* msg){
+    if(session->state.role != GUEST){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    session->first_turn = msg->arg1;
+    session->peer_version = announced_version(msg->arg2);
+    send_comm(session, OK, 0, PROTOCOL_VERSION, 0);
+
+    start_first_turn(session);
+}
+
+/* guest: the host sent the token to resume the game, right after the OK to its WELCOME */
+static void on_token(struct session* session, struct message* msg){
+    if(session->state.role != GUEST){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    session->token = msg->arg1;
+}
+
+/*  the other player placed a symbol. arg2 (validated from 0 to 3) is the outcome of the game the move claims: the end
+    is confirmed with a single OK. 0 is no claim, as from an older peer, and the end is signalled with WIN as before */
+static void on_place(struct session* session, struct message* msg){
+    if(session->state.phase != turn_phase(other_role(session->state.role))){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    if(!place_symbol(&session->board, msg->arg1-1, other_role(session->state.role))){
+        start_resync(session);
+        return;
+    }
+
+    if(msg->arg2 == OUTCOME_NONE){
+        begin_local_turn(session);
+    }
+    else if(board_outcome(session) == (enum outcome)msg->arg2){
+        send_comm(session, OK, 0, 0, 0);
+        finish(session, GAME_END, (enum outcome)msg->arg2);
+    }
+    else{
+        start_resync(session);
+    }
+}
+
+/*  the other peer has seen the end of the game after the local player's move: an older peer that did not read
+    the outcome claimed by the PLACE (GAME_END), or the end found after a resumption */
+static void on_win(struct session* session, struct message* msg){
+    if(session->state.phase != turn_phase(other_role(session->state.role)) && session->state.phase != GAME_END){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    enum outcome outcome = board_outcome(session);
+
+    if(outcome != OUTCOME_NONE && (int)outcome == msg->arg1){
+        send_comm(session, OK, 0, 0, 0);
+        finish(session, GAME_END, outcome);
+    }
+    else{
+        start_resync(session);
+    }
+}
+
+/* the other peer confirmed the end of the game claimed by the local PLACE, or signalled by the local WIN */
+static void on_end_ok(struct session* session, struct message* msg){
+    (void)msg;
+    enum outcome outcome = board_outcome(session);
+
+    if(outcome != OUTCOME_NONE){
+        session->state.last_comm = OK;
+        finish(session, GAME_END, outcome);
+    }
+    else{
+        start_resync(session);
+    }
+}
+
+/* the other player offers a draw during its turn: the local player (or the engine, see session_ops) answers */
+static void on_draw_offer(struct session* session, struct message* msg){
+    if(session->state.phase != turn_phase(other_role(session->state.role)) || session->draw_offer != DRAW_OFFER_NONE){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    session->draw_offer = DRAW_OFFER_RECEIVED;
+
+    if(position_value(&session->board, other_role(session->state.role)) != TABLEBASE_DRAW){
+        session_answer_draw(session, false);    /* the game field of the local player says otherwise */
+    }
+    else if(session->ops->draw_offered != NULL){
+        session->ops->draw_offered(session);
+    }
+    else{
+        session_answer_draw(session, true);
+    }
+}
+
+/* the other player answered the draw offered by the local player: OK accepts it, DENIED refuses it */
+static void on_draw_answer(struct session* session, struct message* msg){
+    if(session->state.phase != turn_phase(session->state.role) || session->draw_offer != DRAW_OFFER_SENT){
+        on_unexpected(session, msg);
+        return;
+    }
+
+    if(msg->communication == OK){
+        finish(session, GAME_END, OUTCOME_DRAW);
+    }
+    else{
+        session->draw_offer = DRAW_OFFER_REFUSED;
+        session->ops->local_turn(session);
+    }
+}
+
+/* Empties the game field for a rematch: the session goes back to the opening sequence */
+static void restart(struct session* session){
+    clear_board(&session->board);
+
+    session->state.phase = OPEN_CONNECTION;
+    session->outcome = OUTCOME_NONE;
+    session->draw_offer = DRAW_OFFER_NONE;
+    session->rematch = REMATCH_NONE;
+
+    if(session->ops->restarted != NULL){
+        session->ops->restarted(session);
+    }
+}
+
+/* host: both players want a new game, who moved second in the last one moves first now */
+static void start_rematch(struct session* session){
+    int first_turn = other_role(session->first_turn);
+
+    restart(session);
+    session_open(session, first_turn);
+}
+
+/* The other player asked for a rematch or declined it: the local player (or the engine, see session_ops) reacts */
+static void notify_rematch(struct session* session){
+    if(session->ops->rematch != NULL){
+        session->ops->rematch(session);
+    }
+    else if(session->rematch == REMATCH_RECEIVED){
+        session_leave(session);
+    }
+}
+
+/* the other player wants a new game: if the local player asked too, the host starts it */
+static void on_rematch(struct session* session, struct message* msg){
+    (void)msg;
+
+    if(session->rematch == REMATCH_SENT){
+        if(session->state.role == HOST){
+            start_rematch(session);
+        }
+        return;     /* guest: both asked at the same time, the WELCOME of the host follows */
+    }
+
+    session->rematch = REMATCH_RECEIVED;
+    notify_rematch(session);
+}
+
+/* guest: the host accepted the rematch asked by the local player and opens the new game */
+static void on_rematch_welcome(struct session* session, struct message* msg){
+    if(session->state.role != GUEST || session->rematch != REMATCH_SENT){
+        return;
+    }
+
+    restart(session);
+    on_welcome(session, msg);
+}
+
+static void on_rematch_declined(struct session* session, struct message* msg){
+    (void)msg;
+
+    session->rematch = REMATCH_DECLINED;
+    notify_rematch(session);
+}
+
+/*  Every row lists the transition for each enum comm, in the order of the enum.
+    The static assertions below refuse to compile if a phase or a message is added without updating the table. */
+
+#define ROW_LENGTH(...) (sizeof((const transition[]){__VA_ARGS__}) / sizeof(transition))
+
+#define OPEN_CONNECTION_ROW \
+    /* OK */ on_open_ok, /* NO_RESYNC */ on_unexpected, /* NO_UNEXPECTED */ on_peer_left, \
+    /* WELCOME */ on_welcome, /* DENIED */ on_unexpected, /* DISCONNECT */ on_peer_left, \
+    /* SET */ on_unexpected, /* PLACE */ on_unexpected, /* WIN */ on_unexpected, \
+    /* SYNC_START */ on_unexpected, /* SYNC_FINISCHED */ on_unexpected, \
+    /* RESUME */ on_unexpected, /* DRAW_OFFER */ on_unexpected, /* REMATCH */ on_unexpected, \
+    /* TOKEN */ on_unexpected
+
+/* the resync is not implemented yet: anything but a disconnection ends the game */
+#define NOT_SUPPORTED_ROW \
+    /* OK */ on_no_resync, /* NO_RESYNC */ on_no_resync, /* NO_UNEXPECTED */ on_peer_left, \
+    /* WELCOME */ on_no_resync, /* DENIED */ on_no_resync, /* DISCONNECT */ on_peer_left, \
+    /* SET */ on_no_resync, /* PLACE */ on_no_resync, /* WIN */ on_no_resync, \
+    /* SYNC_START */ on_no_resync, /* SYNC_FINISCHED */ on_no_resync, \
+    /* RESUME */ on_no_resync, /* DRAW_OFFER */ on_no_resync, /* REMATCH */ on_no_resync, \
+    /* TOKEN */ on_no_resync
+
+#define GAME_TURN_ROW \
+    /* OK */ on_draw_answer, /* NO_RESYNC */ on_no_resync, /* NO_UNEXPECTED */ on_peer_left, \
+    /* WELCOME */ on_unexpected, /* DENIED */ on_draw_answer, /* DISCONNECT */ on_peer_left, \
+    /* SET */ on_unexpected, /* PLACE */ on_place, /* WIN */ on_win, \
+    /* SYNC_START */ on_unexpected, /* SYNC_FINISCHED */ on_unexpected, \
+    /* RESUME */ on_unexpected, /* DRAW_OFFER */ on_draw_offer, /* REMATCH */ on_unexpected, \
+    /* TOKEN */ on_token
+
+#define GAME_END_ROW \
+    /* OK */ on_end_ok, /* NO_RESYNC */ on_no_resync, /* NO_UNEXPECTED */ on_peer_left, \
+    /* WELCOME */ on_unexpected, /* DENIED */ on_unexpected, /* DISCONNECT */ on_peer_left, \
+    /* SET */ on_unexpected, /* PLACE */ on_unexpected, /* WIN */ on_win, \
+    /* SYNC_START */ on_unexpected, /* SYNC_FINISCHED */ on_unexpected, \
+    /* RESUME */ on_unexpected, /* DRAW_OFFER */ on_unexpected, /* REMATCH */ on_unexpected, \
+    /* TOKEN */ on_unexpected
+
+/* the session is over, late messages are dropped */
+#define GAME_INTERRUPTED_ROW \
+    on_ignored, on_ignored, on_ignored, on_ignored, on_ignored, on_ignored, \
+    on_ignored, on_ignored, on_ignored, on_ignored, on_ignored, on_ignored, \
+    on_ignored, on_ignored, on_ignored
+
+/* a game ended with a result and a new one can still be asked: late messages are dropped */
+#define REMATCH_ROW \
+    /* OK */ on_ignored, /* NO_RESYNC */ on_ignored, /* NO_UNEXPECTED */ on_rematch_declined, \
+    /* WELCOME */ on_rematch_welcome, /* DENIED */ on_ignored, /* DISCONNECT */ on_rematch_declined, \
+    /* SET */ on_ignored, /* PLACE */ on_ignored, /* WIN */ on_ignored, \
+    /* SYNC_START */ on_ignored, /* SYNC_FINISCHED */ on_ignored, \
+    /* RESUME */ on_ignored, /* DRAW_OFFER */ on_ignored, /* REMATCH */ on_rematch, \
+    /* TOKEN */ on_ignored
+
+_Static_assert(ROW_LENGTH(OPEN_CONNECTION_ROW) == COMM_COUNT, "OPEN_CONNECTION_ROW must cover every enum comm");
+_Static_assert(ROW_LENGTH(NOT_SUPPORTED_ROW) == COMM_COUNT, "NOT_SUPPORTED_ROW must cover every enum comm");
+_Static_assert(ROW_LENGTH(GAME_TURN_ROW) == COMM_COUNT, "GAME_TURN_ROW must cover every enum comm");
+_Static_assert(ROW_LENGTH(GAME_END_ROW) == COMM_COUNT, "GAME_END_ROW must cover every enum comm");
+_Static_assert(ROW_LENGTH(GAME_INTERRUPTED_ROW) == COMM_COUNT, "GAME_INTERRUPTED_ROW must cover every enum comm");
+_Static_assert(ROW_LENGTH(REMATCH_ROW) == COMM_COUNT, "REMATCH_ROW must cover every enum comm");
+
+/* one row for each enum phase, in the order of the enum */
+static const transition transitions[][COMM_COUNT] = {
+    /* OPEN_CONNECTION */   {OPEN_CONNECTION_ROW},
+    /* INITIAL_SYNC */      {NOT_SUPPORTED_ROW},
+    /* RESYNC */            {NOT_SUPPORTED_ROW},
+    /* GAME_TURN_GUEST */   {GAME_TURN_ROW},
+    /* GAME_TURN_HOST */    {GAME_TURN_ROW},
+    /* GAME_END */          {GAME_END_ROW},
+    /* GAME_INTERRUPTED */  {GAME_INTERRUPTED_ROW}
+};
+
+_Static_assert(sizeof(transitions) / sizeof(transitions[0]) == PHASE_COUNT, "transitions must have a row for every enum phase");
+
+/* used instead of transitions while session_can_rematch */
+static const transition rematch_transitions[COMM_COUNT] = {REMATCH_ROW};
+
+/* --- public interface --- */
+
+void session_init(struct session* session, enum role role, const struct session_ops* ops, void* context){
+    if(session == NULL || ops == NULL){
+        mini_log(ERROR, "session_init", -1, "Invalid parameters");
+        return;
+    }
+
+    clear_board(&session->board);
+
+    session->state.phase = OPEN_CONNECTION;
+    session->state.role = role;
+    session->state.last_comm = OK;
+    session->first_turn = HOST;
+    session->token = 0;
+    session->peer_version = 1;
+    session->outcome = OUTCOME_NONE;
+    session->draw_offer = DRAW_OFFER_NONE;
+    session->rematch = REMATCH_NONE;
+    session->ops = ops;
+    session->context = context;
+}
+
+/*  Host only: starts the protocol by telling the guest who plays first. The protocol version goes in arg2,
+    which the older versions do not read in a WELCOME with one argument */
+void session_open(struct session* session, int first_turn){
+    if(session->state.role != HOST || session->state.phase != OPEN_CONNECTION){
+        mini_log(ERROR, "session_open", -1, "Only the host can open a session");
+        return;
+    }
+
+    session->first_turn = first_turn;
+    send_comm(session, WELCOME, 1, first_turn, PROTOCOL_VERSION);
+
+    session->ops->remote_turn(session);
+}
+
+/* Dispatches a (validated) message received from the other peer */
+void session_handle_message(struct session* session, struct message* msg){
+    if((unsigned)session->state.phase >= PHASE_COUNT || (unsigned)msg->communication >= COMM_COUNT){
+        mini_log(ERROR, "session_handle_message", -1, "Invalid phase or message");
+        return;
+    }
+
+    if(session->outcome != OUTCOME_NONE){
+        /* the session is over, only a rematch can start it again */
+        if(session_can_rematch(session)){
+            rematch_transitions[msg->communication](session, msg);
+        }
+        return;
+    }
+
+    transitions[session->state.phase][msg->communication](session, msg);
+}
+
+/*  The local player places a symbol in cell (from 1 to 9). A move that ends the game claims the outcome in arg2
+    of the PLACE (past n_args, so the older versions do not read it): the session waits in GAME_END for the OK
+    of the other peer, or for the WIN of an older one. Returns false if the move is not allowed now */
+bool session_play_move(struct session* session, int cell){
+    if(!session_is_local_turn(session) || !place_symbol(&session->board, cell-1, session->state.role)){
+        return false;
+    }
+
+    enum outcome outcome = board_outcome(session);
+
+    send_comm(session, PLACE, 1, cell, outcome);
+
+    session->state.phase = outcome != OUTCOME_NONE ? GAME_END : turn_phase(other_role(session->state.role));
+    session->draw_offer = DRAW_OFFER_NONE;
+    session->ops->remote_turn(session);
+
+    return true;
+}
+
+/*  The local player leaves: the other peer is informed with a DISCONNECT (after a game with a result, no rematch,
+    which is all an older peer can have) */
+void session_leave(struct session* session){
+    if(has_result(session)){
+        if(session->rematch != REMATCH_DECLINED){
+            send_comm(session, DISCONNECT, 0, 0, 0);
+            session->rematch = REMATCH_DECLINED;
+        }
+        return;
+    }
+
+    if(session->state.phase == GAME_INTERRUPTED || session->outcome != OUTCOME_NONE){
+        return;
+    }
+
+    send_comm(session, DISCONNECT, 0, 0, 0);
+    finish(session, GAME_INTERRUPTED, OUTCOME_LEFT);
+}
+
+bool session_is_local_turn(const struct session* session){
+    return session->outcome == OUTCOME_NONE && session->state.phase == turn_phase(session->state.role) &&
+        session->draw_offer != DRAW_OFFER_SENT;
+}
+
+/* True if the local player has to move and perfect play from both sides can only end in a draw */
+bool session_is_forced_draw(const struct session* session){
+    return session_is_local_turn(session) && position_value(&session->board, session->state.role) == TABLEBASE_DRAW;
+}
+
+/*  True if the local player can offer a draw now: once for each turn, only in a forced draw and only to a peer of
+    version 2 or later (DRAW_OFFER is not a valid message for the older ones, which would close the connection) */
+bool session_can_offer_draw(const struct session* session){
+    return session_is_forced_draw(session) && session->draw_offer == DRAW_OFFER_NONE && session->peer_version >= 2;
+}
+
+/*  The local player offers a draw instead of moving: the turn goes on after a refusal.
+    Returns false if the offer is not allowed now (see session_can_offer_draw) */
+bool session_offer_draw(struct session* session){
+    if(!session_can_offer_draw(session)){
+        return false;
+    }
+
+    send_comm(session, DRAW_OFFER, 0, 0, 0);
+    session->draw_offer = DRAW_OFFER_SENT;
+    session->ops->remote_turn(session);
+
+    return true;
+}
+
+/* The local player answers the draw offered by the other player. Returns false if there is no offer */
+bool session_answer_draw(struct session* session, bool accept){
+    if(session->outcome != OUTCOME_NONE || session->draw_offer != DRAW_OFFER_RECEIVED){
+        return false;
+    }
+
+    session->draw_offer = DRAW_OFFER_NONE;
+
+    if(accept){
+        send_comm(session, OK, 0, 0, 0);
+        finish(session, GAME_END, OUTCOME_DRAW);
+    }
+    else{
+        send_comm(session, DENIED, 0, 0, 0);
+        session->ops->remote_turn(session);
+    }
+
+    return true;
+}
+
+/*  True if the game ended with a result, no player has left since and the other peer is of version 2 or later
+    (REMATCH is not a valid message for the older ones, which would close the connection) */
+bool session_can_rematch(const struct session* session){
+    return has_result(session) && session->rematch != REMATCH_DECLINED && session->peer_version >= 2;
+}
+
+/*  The local player wants a new game on the same connection: it begins when the other player asks too
+    (the host opens it, the first turn alternates). Returns false if a rematch is not possible or already asked */
+bool session_request_rematch(struct session* session){
+    if(!session_can_rematch(session) || session->rematch == REMATCH_SENT){
+        return false;
+    }
+
+    if(session->state.role == HOST && session->rematch == REMATCH_RECEIVED){
+        start_rematch(session);
+        return true;
+    }
+
+    send_comm(session, REMATCH, 0, 0, 0);
+    session->rematch = REMATCH_SENT;
+
+    return true;
+}
+
+/* Whose turn it is: in GAME_END the local player has seen the end of the game and waits for the confirmation */
+enum role session_turn(const struct session* session){
+    if(session->state.phase == GAME_TURN_HOST){
+        return HOST;
+    }
+    if(session->state.phase == GAME_TURN_GUEST){
+        return GUEST;
+    }
+    return session->state.role;
+}
+
+/* A game can be resumed after the connection is lost only if it has started and has not ended yet */
+bool session_can_resume(const struct session* session){
+    enum phase phase = session->state.phase;
+
+    return session->token != 0 && session->outcome == OUTCOME_NONE &&
+        (phase == GAME_TURN_HOST || phase == GAME_TURN_GUEST || phase == GAME_END);
+}
+
+/*  Restarts the game from the snapshot sent by the host after a reconnection: the game field (as a base 3
+    number) and who moves. The end of the game is checked again, as after any move. */
+bool session_resume(struct session* session, int board_index, enum role turn){
+    if((turn != HOST && turn != GUEST) || !board_from_index(&session->board, board_index)){
+        return false;
+    }
+
+    session->outcome = OUTCOME_NONE;
+    session->draw_offer = DRAW_OFFER_NONE;      /* an offer without answer is lost with the connection */
+    session->state.last_comm = SYNC_FINISCHED;
+
+    if(turn == session->state.role){
+        begin_local_turn(session);
+    }
+    else{
+        session->state.phase = turn_phase(turn);
+        session->ops->remote_turn(session);
+    }
+
+    return true;
+}
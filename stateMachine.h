@@ -0,0 +1,94 @@
+#ifndef STATEMACHINE_H
+#define STATEMACHINE_H
+
+#include <stdbool.h>
+
+#include "protocol.h"
+#include "gameLogic.h"
+
+/* How a session ended: the first three values are the same used by the WIN message */
+enum outcome{
+    OUTCOME_NONE = 0,
+    OUTCOME_HOST_WON = HOST,
+    OUTCOME_GUEST_WON = GUEST,
+    OUTCOME_DRAW = 3,
+    OUTCOME_LEFT,               /* the local player left the game */
+    OUTCOME_PEER_LEFT,          /* the other player sent DISCONNECT or NO_UNEXPECTED */
+    OUTCOME_PROTOCOL_ERROR      /* a message was not valid in the current phase */
+};
+
+/* A draw offered by the player that moves, when perfect play from both sides can only end in a draw */
+enum draw_offer{
+    DRAW_OFFER_NONE,
+    DRAW_OFFER_SENT,            /* the local player waits for the answer before moving */
+    DRAW_OFFER_RECEIVED,        /* the local player has to call session_answer_draw */
+    DRAW_OFFER_REFUSED          /* the local player cannot offer again in this turn */
+};
+
+/* A new game on the same connection, asked by either player when a game ends with a result */
+enum rematch{
+    REMATCH_NONE,
+    REMATCH_SENT,               /* the local player waits for the other one */
+    REMATCH_RECEIVED,           /* the other player waits: session_request_rematch accepts */
+    REMATCH_DECLINED            /* one of the players left: no new game */
+};
+
+struct session;
+
+/*  The engine does not know where messages go or who chooses the moves: the terminal game,
+    the bots and the in-process peers only differ in these callbacks. */
+struct session_ops{
+    void (*send)(struct session* session, struct message* msg);
+    void (*local_turn)(struct session* session);            /* the local player must call session_play_move */
+    void (*remote_turn)(struct session* session);           /* a message from the other peer is expected */
+    void (*finished)(struct session* session, enum outcome outcome);
+    void (*draw_offered)(struct session* session);          /* optional, without it every draw offer is accepted */
+    void (*rematch)(struct session* session);               /* optional: session->rematch changed because of the other player,
+                                                               without it every request is declined */
+    void (*restarted)(struct session* session);             /* optional: a rematch begins, the game field is empty again */
+};
+
+struct session{
+    struct board board;
+    struct gameState state;
+    int first_turn;
+    int token;                  /* chosen by the host to resume the game after a disconnection, 0 if not supported */
+    int peer_version;           /* protocol version announced by the other peer in the opening sequence */
+    enum outcome outcome;
+    enum draw_offer draw_offer;
+    enum rematch rematch;
+    const struct session_ops* ops;
+    void* context;
+};
+
+void session_init(struct session* session, enum role role, const struct session_ops* ops, void* context);
+
+void session_open(struct session* session, int first_turn);
+
+void session_handle_message(struct session* session, struct message* msg);
+
+bool session_play_move(struct session* session, int cell);
+
+void session_leave(struct session* session);
+
+bool session_is_local_turn(const struct session* session);
+
+bool session_is_forced_draw(const struct session* session);
+
+bool session_can_offer_draw(const struct session* session);
+
+bool session_offer_draw(struct session* session);
+
+bool session_answer_draw(struct session* session, bool accept);
+
+bool session_can_rematch(const struct session* session);
+
+bool session_request_rematch(struct session* session);
+
+enum role session_turn(const struct session* session);
+
+bool session_can_resume(const struct session* session);
+
+bool session_resume(struct session* session, int board_index, enum role turn);
+
+#endif /* STATEMACHINE_H */
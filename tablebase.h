@@ -0,0 +1,30 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include "protocol.h"
+
+/*  Perfect play for every game field, computed when the program is built: tablebase.c is written by
+    tablebaseGenerator.c (see the Makefile), nothing is searched while playing.
+
+    tablebase[symbol - 1][board index] describes the game field (as a base 3 number, see board_to_index)
+    when the player with symbol has to move. Every entry holds the result of the game if both players
+    play perfectly from there, and the cells (bit i for cell i, from 0 to 8) of the moves that get it
+    (the quickest win, or the slowest loss). Game fields that cannot be reached are TABLEBASE_ILLEGAL. */
+
+enum tablebase_value{
+    TABLEBASE_ILLEGAL = 0,
+    TABLEBASE_WIN = 1,          /* the player that moves wins */
+    TABLEBASE_DRAW = 2,
+    TABLEBASE_LOSS = 3          /* the player that moves loses (or has already lost) */
+};
+
+#define TABLEBASE_MOVES_MASK 0x1ff
+#define TABLEBASE_VALUE_SHIFT 9
+
+#define TABLEBASE_ENTRY(value, moves) ((unsigned short)(((value) << TABLEBASE_VALUE_SHIFT) | (moves)))
+#define TABLEBASE_VALUE(entry) ((enum tablebase_value)((entry) >> TABLEBASE_VALUE_SHIFT))
+#define TABLEBASE_MOVES(entry) ((entry) & TABLEBASE_MOVES_MASK)
+
+extern const unsigned short tablebase[2][BOARD_INDEX_COUNT];
+
+#endif /* TABLEBASE_H */
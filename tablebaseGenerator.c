@@ -0,0 +1,116 @@
+#include <stdio.h>
+
+#include "protocol.h"
+#include "tablebase.h"
+
+/*  Writes tablebase.c on the standard output: every game field that can be reached from the empty one
+    (with either player moving first) is solved once with a complete search, the others stay illegal.
+    The game field and the base 3 index are the same of gameLogic.c: cell i is the digit of weight 3^i,
+    0 if free, otherwise the symbol (HOST or GUEST) placed there. */
+
+static const int lines[8][3] = {
+    {0, 1, 2}, {3, 4, 5}, {6, 7, 8},
+    {0, 3, 6}, {1, 4, 7}, {2, 5, 8},
+    {0, 4, 8}, {2, 4, 6}
+};
+
+static unsigned short entries[2][BOARD_INDEX_COUNT];
+static int scores[2][BOARD_INDEX_COUNT];
+
+static int index_of(const int cells[9]){
+    int index = 0;
+
+    for(int pos=8; pos >= 0; --pos){
+        index = index * 3 + cells[pos];
+    }
+    return index;
+}
+
+static int has_line(const int cells[9], int symbol){
+    for(int i=0; i < 8; ++i){
+        if(cells[lines[i][0]] == symbol && cells[lines[i][1]] == symbol && cells[lines[i][2]] == symbol){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*  Score of the game field for the player with symbol that has to move: positive if it wins, negative if
+    it loses, 0 for a draw. The sooner the game ends, the bigger the absolute value. */
+static int solve(int cells[9], int symbol){
+    int other = symbol == HOST ? GUEST : HOST;
+    int index = index_of(cells);
+    int free_cells = 0;
+    int best = -100;
+    int moves = 0;
+
+    if(entries[symbol - 1][index] != 0){
+        return scores[symbol - 1][index];
+    }
+
+    for(int pos=0; pos < 9; ++pos){
+        free_cells += cells[pos] == 0;
+    }
+
+    if(has_line(cells, other)){
+        best = -(free_cells + 1);
+    }
+    else if(free_cells == 0){
+        best = 0;
+    }
+    else{
+        for(int pos=0; pos < 9; ++pos){
+            if(cells[pos] != 0){
+                continue;
+            }
+
+            cells[pos] = symbol;
+            int score = -solve(cells, other);
+            cells[pos] = 0;
+
+            if(score > best){
+                best = score;
+                moves = 0;
+            }
+            if(score == best){
+                moves |= 1 << pos;
+            }
+        }
+    }
+
+    enum tablebase_value value = best > 0 ? TABLEBASE_WIN : (best < 0 ? TABLEBASE_LOSS : TABLEBASE_DRAW);
+
+    entries[symbol - 1][index] = TABLEBASE_ENTRY(value, moves);
+    scores[symbol - 1][index] = best;
+
+    return best;
+}
+
+int main(){
+    int cells[9] = {0};
+    int legal = 0;
+
+    solve(cells, HOST);
+    solve(cells, GUEST);
+
+    printf("/* Written by tablebaseGenerator.c when the program is built: do not edit */\n\n");
+    printf("#include \"tablebase.h\"\n\n");
+    printf("const unsigned short tablebase[2][BOARD_INDEX_COUNT] = {\n");
+
+    for(int symbol=0; symbol < 2; ++symbol){
+        printf("    {   /* %s moves */\n", symbol == 0 ? "HOST" : "GUEST");
+
+        for(int index=0; index < BOARD_INDEX_COUNT; ++index){
+            legal += entries[symbol][index] != 0;
+
+            printf("%s0x%04x%s", index % 12 == 0 ? "        " : "", entries[symbol][index],
+                index == BOARD_INDEX_COUNT - 1 ? "\n" : (index % 12 == 11 ? ",\n" : ", "));
+        }
+
+        printf("    }%s\n", symbol == 0 ? "," : "");
+    }
+
+    printf("};\n\n/* %d legal entries */\n", legal);
+
+    return 0;
+}